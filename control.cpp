@@ -1,292 +1,777 @@
-///////////////////////////////////////////////////////////////////////////////
-/// CONTROL.H
-///
-/// Control module. This passes information to the LED driver (and in theory
-/// could be to anywhere else) via the message queue
-///
-///////////////////////////////////////////////////////////////////////////////
-
-#include "control.h"
-#include "kernel.h"
-#include "common.h" // we need the message ID.
-#include "pwm.h"
-#include "revcount.h"
-
-typedef struct _TIMERSTRUCT
-{
-	Kernel::OSTimer *	LEDTimer;
-	Kernel::OSTimer *	TestRPMTimer;
-} TIMERSTRUCT;
-
-typedef TIMERSTRUCT * PTIMERSTRUCT;
-
-// the rpm value needs to be seen by more than one function, so make it
-// module scope.
-
-static int demandrps=RPS_MIN;
-static double atomicrps=0;			// the RPS actually read by interrupt context
-
-// Prototype the control task function and encoder callback here as it does not need to be
-// seen outside this module
-
-void CTRLEncoderClicked(void * context);	// someone's tweaked the encoder
-void CTRLNewRPS(void * context);			// if someone enters rpm from keypad
-void ControlTask(void * context);
-void CTRLWriteRPS(unsigned int rps);
-
-///////////////////////////////////////////////////////////////////////////////
-/// CONTROLInitialize
-///
-/// This is called once at system startup. It initializes the control
-/// module (by registering a task to run repetitively) and then exits. This
-/// function needs to be seen outside the module, so it is prototyped in the
-/// header file.
-///
-///////////////////////////////////////////////////////////////////////////////
-
-void CONTROLInitialize(void)
-{
-	// 1) Each test code block needs its own timer. We thus create a structure
-	//    containing pointers to two timer objects. Then we create two new
-	//    non-blocking timer objects and assign them to the pointers in the structure
-	//    This allows us to pass a single pointer to the task handler.
-	//
-	//    This is not the only way of achieving this. We could use static
-	//    or module-global variables. The memory burden is the same.
-	//    We need the timer objects to enable the delay between messages sent
-	//    to the LED driver We declare this pointer as static
-	//    as we need it to stay in place once this function exits.
-	//
-	//    We only want to do this once.
-	//
-	//    We should really check the pointers to see if they were allocated
-	//    successfully by the OS.
-
-	PTIMERSTRUCT taskcontext=new TIMERSTRUCT;
-	taskcontext->LEDTimer=new Kernel::OSTimer(750);	// times out in 750ms
-	taskcontext->TestRPMTimer=new Kernel::OSTimer(1000); // times out in 200ms
-
-	// Register to receive messages from the encoder.
-
-	Kernel::OS.MessageQueue.Subscribe(MSG_ID_ENCODER, CTRLEncoderClicked);
-
-	// Register to receive RPM updates from keypad
-
-	Kernel::OS.MessageQueue.Subscribe(MSG_ID_NEW_RPS_KEYPAD, CTRLNewRPS);
-
-	//
-	// 2) Register our repetitive task. We pass the user parameter 'context' as a
-	//    pointer to our timer structure. Note that the task handler now takes 'ownership'
-	//    of the timer pointer structure. If it required to release the memory associated with it,
-	//    this would take place here. However, this task is running until someone turns the power
-	//    off, so we don't have to worry here about freeing memory. As the pointer is generic, we use
-	//    casting in our ControlTask function to recover the timer object.
-
-	Kernel::OS.TaskManager.RegisterTaskHandler(ControlTask,(void *)taskcontext);
-
-}
-
-//////////////////////////////////////////////////////////////////////////////
-/// ControlTask
-///
-/// This is our main control task. It must not block, as the system as a whole
-/// is single-tasked.
-///
-/// It is passed the timer in the context variable. We could use a module global
-/// here, but this is just to demonstrate one use of the context variable
-///
-//////////////////////////////////////////////////////////////////////////////
-
-void ControlTask(void * context)
-{
-	// Code in this task function CAN NOT BLOCK. If it blocks, it will grab the
-	// CPU and other tasks will not be able to run.
-
-	// Any tasks must take as little time as possible.
-
-	static int ledstate=0;	// declared static as we want to preserve its value across calls
-
-	PTIMERSTRUCT	timers = static_cast<PTIMERSTRUCT>(context);
-
-	if(timers->LEDTimer->isExpired()) {
-
-		// CODE FOR TESTING THE SUBSYSTEMS. YOU MAY WELL NEED TO CHANGE THIS IN YOUR FINAL DESIGN
-		//-----------------------------------------------------------------------------------------
-
-		// The code in the section below will be executed once, when the timer has expired.
-		// Note that this will not happen EXACTLY when the timer is expired, but the next time
-		// this task function runs AFTER the timer has expired. Ergo, it is NOT an 'accurate'
-		// timer at all.
-
-		// It simply flips the value of ledstate: if ledstate==0 it changes to 1, if 1 it is changed to 0
-		// Because ledstate is declared static, it's value is held over subsequent calls to ControlTask.
-
-		ledstate=(ledstate==1)?0:1;
-
-		// Post the value of ledstate in a message. Any function subscribed to MSG_ID_CHANGE_LED will
-		// then be called with the value of 'ledstate' as a parameter. Note that the parameter is
-		// declared as a 'void *' - this is technically a pointer type. However, a pointer is a 16 bit
-		// integer (in this microprocessor). So we can set it to any value between 0-65535. As long
-		// as we don't treat it like a pointer, we can set it to any value!
-
-		Kernel::OS.MessageQueue.Post(MSG_ID_CHANGE_LED, (void *)ledstate, Kernel::MQ_OWNER_CALLER, Kernel::MQ_CONTEXT_TASK);
-
-		//----------------------------------------------------------------------------------------------
-
-		// The timer needs to be reset. If it isn't, it will always be expired and the code within
-		// the 'if' statement will run every time the ControlTask is called by the task manager
-
-		timers->LEDTimer->Set(750);
-
-	}
-
-	// Note: We no longer use the control function test code for the 7-seg. Why? We have already tested it,
-	// and now the keyboard driver can directly post the messages to the 7-seg to display according to
-	// specification. We leave the timer object available, but change its name. It is not doing anything
-	// at the moment, but we keep it as we may need it later.
-
-	// Update the displayed RPM
-	// Note: this is NOT FAST ENOUGH for real-time control purposes, but is fine for
-	// display purposes.
-
-	if(timers->TestRPMTimer->isExpired()) {
-
-		int actualrpm=(int)REVGetRevsPerSec();
-
-		Kernel::OS.MessageQueue.Post(MSG_ID_NEW_ACTUAL_RPS, (void *)actualrpm, Kernel::MQ_OWNER_CALLER, Kernel::MQ_CONTEXT_TASK);
-
-		timers->TestRPMTimer->Set(250);	// Update every 1/4 second
-	}
-}
-
-////////////////////////////////////////////////////////////////////////////////
-/// CTRLEncoderClicked
-///
-/// Callback from the message queue if someone whizzed the encoder. The context
-/// will contain either 1 (if the encoder is clockwise) or -1 if the encoder
-/// is rotated anticlockwise. We update the RPM displayed, if we are able to
-///
-/// @context: TASK
-/// @scope: INTERNAL
-/// @param: void * context - 0 or 1 depending if anticlockwise or clockwise
-/// @return: none
-///
-////////////////////////////////////////////////////////////////////////////////
-
-void CTRLEncoderClicked(void * context)
-{
-	demandrps+=((int)context);
-	if(demandrps<RPS_MIN) {
-		demandrps=RPS_MIN;
-	}
-	if(demandrps>RPS_MAX) {
-		demandrps=RPS_MAX;
-	}
-	CTRLWriteRPS(demandrps);
-}
-
-////////////////////////////////////////////////////////////////////////////////
-/// CTRLNewRPS
-///
-/// Callback from the message queue if someone entered a new RPS from
-/// the keypad. This comes from the display module and will already have
-/// been validated
-///
-/// @context: TASK
-/// @scope: INTERNAL
-/// @param: void * context - 0 or 1 depending if anticlockwise or clockwise
-/// @return: none
-///
-////////////////////////////////////////////////////////////////////////////////
-
-void CTRLNewRPS(void * context)
-{
-	demandrps=(unsigned int)context;
-	CTRLWriteRPS(demandrps);
-}
-
-///////////////////////////////////////////////////////////////////////////////
-/// CTRLWriteRPS
-///
-/// This function consolidates calls from the encoder and the keypad messages
-/// to update the RPM in one place - so we can ensure the writes to 'demandrps'
-/// are atomic
-///
-/// @context: TASK
-/// @scope: INTERNAL
-/// @param: unsigned int rps - revs per second to set
-/// @return: none
-///
-///////////////////////////////////////////////////////////////////////////////
-
-void CTRLWriteRPS(unsigned int rps)
-{
-	// we post this back to the display, to be displayed.
-	// Seems convoluted, but this gives us power of veto if for some
-	// reason we can not accept the keypad value.
-
-	Kernel::OS.MessageQueue.Post(MSG_ID_NEW_DEMAND_RPS, (void *)demandrps, Kernel::MQ_OWNER_CALLER, Kernel::MQ_CONTEXT_TASK);
-
-	REVDisableOvfInterrupt();
-	atomicrps=((double)rps);
-	REVEnableOvfInterrupt();
-}
-
-/////////////////////////////////////////////////////////////////////////////
-/// CTRLPILoop
-///
-/// A simple PI implementation using floating point arithmetic. This is to
-/// demonstrate the slow speed of operation when using software floating
-/// point
-///
-/// Note that this is called in interrupt context - be careful to ensure
-/// atomicity of the input (rpm)
-///
-/// This function will update the PWM from within
-///
-/// @context: INTERRUPT
-/// @scope: EXPORTED
-/// @param: double actualrpsin - the measured RPS
-/// @return: none
-///
-/////////////////////////////////////////////////////////////////////////////
-
-void CTRLPILoop(double actualrpsin)
-{
-  // here out1 represents out(t - T)
-  // and e1 represents e(t - T)
-	static double e1=0,out1=0;	// outputs of z^-1
-
-  // out represents out(t)
-	double out;
-
-  // Calculating the error value e
-  // e represents e(t)
-	double e=atomicrps-actualrpsin;
-
-  // TODO: Implement the difference equation
-  // out(t) = out(t - T) + a0.e(t) + a1.e(t-R)
-  out = out1 + PI_A1*e + PI_A0*e1;
-
-  // TODO: Contrain the value out out to: 0 <= out <= 255
-	// Rationale for this: We are using a limiter here, before the z^-1. 
-	// This helps to prevent integrator windup
-  if (out > 255){
-    out = 255;
-  }
-  if (out < 0){
-    out = 0;
-  }
-  
-  // TODO: Update the internal variables.
-  // This essentially will perform the operations:
-  //    e(t - T) = e(t), and
-  //    out(t - T) = out(t)
-  e1 = e;
-  out1 = out;
-	
-  // By this stage, the value of out has been calculated and limited 
-  // to the range 0 to 255, and the internal variables have been updated.
-  // Now send the value of 'out' to the motor.
-	PWMSetDuty((unsigned char)out);
-}
+///////////////////////////////////////////////////////////////////////////////
+/// CONTROL.H
+///
+/// Control module. This passes information to the LED driver (and in theory
+/// could be to anywhere else) via the message queue
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#include "control.h"
+#include "kernel.h"
+#include "common.h" // we need the message ID.
+#include "pwm.h"
+#include "revcount.h"
+#include "encoder.h"
+#include "prf.h"
+#include "sched.h"
+#include "topics.h"
+#include "tel.h"
+#include "tune.h"
+#include "traj.h"
+
+//
+// Task periods, in ms. The encoder is drained often enough that the knob
+// feels immediate; the LED blink and the actual RPS report are slow.
+
+#define CTRL_ENCODER_PERIOD		5
+#define CTRL_LED_PERIOD			750
+#define CTRL_REPORT_PERIOD		250
+#define CTRL_REPORT_PHASE		1000		// first report once the loop has settled
+
+//
+// The controller output is in 8 bit duty counts, Q15.16. The PWM takes
+// PWM_DITHER_BITS of the fraction as well as the whole part.
+
+#define CTRL_PWM_SHIFT		(CTRL_OUT_FRAC-PWM_DITHER_BITS)
+
+//
+// The trajectory generator's setpoint, Q15.16, in the loop's format
+
+#ifdef CTRL_FIXED_POINT
+#define CTRL_FROM_TRAJ(x)	((CTRLRPS)((x)>>(TRAJ_FRAC-CTRL_RPS_FRAC)))
+#else
+#define CTRL_FROM_TRAJ(x)	((double)(x)/(1L<<TRAJ_FRAC))
+#endif
+
+// the rpm value needs to be seen by more than one function, so make it
+// module scope.
+
+static int demandrps=RPS_MIN;
+static CTRLRPS atomicrps=0;			// the setpoint, from the trajectory generator; interrupt only
+
+#ifdef CTRL_GAIN_SCHEDULE
+
+//
+// The gain schedule: Kp (duty per RPS) and Ki (duty per RPS per second)
+// at a few demands, in increasing order of RPS and spanning RPS_MIN to
+// RPS_MAX. Between entries the gains are interpolated linearly. Ki is
+// stored per sample, Q3.12 as the coefficients are. Low in the range the
+// motor mostly arrives by coasting down, and stiffer gains catch it with
+// less undershoot; higher up, less integral action keeps the rising
+// steps from overshooting.
+
+typedef struct _CTRLSCHEDPOINT {
+
+	unsigned int	rps;			// demand this entry applies at
+	int				kp;				// Q3.12
+	int				ki;				// Ki.T, Q3.12
+
+} CTRLSCHEDPOINT;
+
+#define CTRL_SCHED(rps,kp,ki)	{ rps, CTRL_TO_COEF(kp), CTRL_TO_COEF((ki)*REV_SAMPLE_SECONDS) }
+
+static CTRLSCHEDPOINT ctrlsched[]={
+
+	CTRL_SCHED(RPS_MIN,	1.55,	3.6),
+	CTRL_SCHED(50,		1.55,	3.9),
+	CTRL_SCHED(100,		1.15,	3.2),
+	CTRL_SCHED(RPS_MAX,	1.15,	3.2)
+};
+
+#define CTRL_SCHED_POINTS	(sizeof(ctrlsched)/sizeof(ctrlsched[0]))
+
+//
+// The anti-windup gain T/Tt, Q3.12, and the integrator's limits. The
+// integrator never needs to go far beyond the duty range; the limit only
+// keeps the arithmetic in range if the gains are set strangely.
+
+#define CTRL_TRACK_Q	CTRL_TO_COEF((REV_SAMPLE_SECONDS<CTRL_TRACK_SECONDS)?REV_SAMPLE_SECONDS/CTRL_TRACK_SECONDS:1.0)
+#define CTRL_INT_MAX	(512L<<CTRL_OUT_FRAC)
+
+// The gains in force for the present demand, read by interrupt context,
+// in the arithmetic the loop uses
+
+#ifdef CTRL_FIXED_POINT
+typedef int CTRLCOEF;				// Q3.12
+#define CTRL_COEF(q)	(q)
+#else
+typedef double CTRLCOEF;
+#define CTRL_COEF(q)	((double)(q)/(1<<CTRL_COEF_FRAC))
+#endif
+
+static CTRLCOEF ctrlkp;
+static CTRLCOEF ctrlki;
+
+#else
+
+// The PI coefficients, also read by interrupt context
+
+#ifdef CTRL_FIXED_POINT
+static int ctrla1=PI_A1_Q;			// Q3.12
+static int ctrla0=PI_A0_Q;
+#else
+static double ctrla1=PI_A1;
+static double ctrla0=PI_A0;
+#endif
+
+#endif
+
+// Prototype the control task function and encoder callback here as it does not need to be
+// seen outside this module
+
+void CTRLEncoderClicked(void);			// someone's tweaked the encoder
+void ControlTask(void * context);
+void CTRLLedTask(void * context);
+void CTRLReportTask(void * context);
+void CTRLWriteRPS(unsigned int rps);
+
+#ifdef CTRL_GAIN_SCHEDULE
+static void CTRLScheduleGains(unsigned int rps, CTRLCOEF * kp, CTRLCOEF * ki);
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// CONTROLInitialize
+///
+/// This is called once at system startup. It initializes the control
+/// module (by registering a task to run repetitively) and then exits. This
+/// function needs to be seen outside the module, so it is prototyped in the
+/// header file.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void CONTROLInitialize(void)
+{
+	// RPM updates from the keypad arrive at CTRLNewRPS, routed in topics.h.
+	//
+	// Our tasks. The scheduler calls each only when it is due, so none
+	// needs a timer of its own. The encoder is the one the user can feel,
+	// so it goes first.
+
+	SCHAddTask(ControlTask,(void *)NULL,CTRL_ENCODER_PERIOD,0,SCH_PRIO_HIGH);
+	SCHAddTask(CTRLReportTask,(void *)NULL,CTRL_REPORT_PERIOD,CTRL_REPORT_PHASE,SCH_PRIO_NORMAL);
+	SCHAddTask(CTRLLedTask,(void *)NULL,CTRL_LED_PERIOD,CTRL_LED_PERIOD,SCH_PRIO_LOW);
+
+#ifdef CTRL_GAIN_SCHEDULE
+	// Gains to suit the demand we start with. The sample interrupt is not
+	// running yet.
+
+	CTRLScheduleGains(demandrps,&ctrlkp,&ctrlki);
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// ControlTask
+///
+/// This is our main control task. It must not block, as the system as a whole
+/// is single-tasked. It runs every CTRL_ENCODER_PERIOD ms.
+///
+//////////////////////////////////////////////////////////////////////////////
+
+void ControlTask(void * context)
+{
+	PRF_SCOPE(PRF_TASK_CONTROL);
+
+	// Code in this task function CAN NOT BLOCK. If it blocks, it will grab the
+	// CPU and other tasks will not be able to run.
+
+	// Pick up any encoder movement. The ISR only counts, so this is cheap
+	// when the knob is still.
+
+	CTRLEncoderClicked();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// CTRLLedTask
+///
+/// Flip the LED, to show we are alive. Runs every CTRL_LED_PERIOD ms.
+///
+/// @context: TASK
+/// @scope: INTERNAL
+/// @param: void * context - unused
+/// @return: none
+///
+//////////////////////////////////////////////////////////////////////////////
+
+void CTRLLedTask(void * context)
+{
+	static unsigned char ledstate=0;	// declared static as we want to preserve its value across calls
+
+	// It simply flips the value of ledstate: if ledstate==0 it changes to 1, if 1 it is changed to 0
+
+	ledstate=(ledstate==1)?0:1;
+
+	// Post the value of ledstate in a message. Every function routed MSGLED in topics.h will
+	// then be called with it.
+
+	MsgPost(MSGLED{ledstate});
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// CTRLReportTask
+///
+/// Update the displayed RPS, every CTRL_REPORT_PERIOD ms.
+/// Note: this is NOT FAST ENOUGH for real-time control purposes, but is fine
+/// for display purposes.
+///
+/// @context: TASK
+/// @scope: INTERNAL
+/// @param: void * context - unused
+/// @return: none
+///
+//////////////////////////////////////////////////////////////////////////////
+
+void CTRLReportTask(void * context)
+{
+#ifdef CTRL_FIXED_POINT
+	int actualrpm=REVGetRevsPerSecFixed()>>CTRL_RPS_FRAC;
+#else
+	int actualrpm=(int)REVGetRevsPerSec();
+#endif
+
+	MsgPost(MSGACTUALRPS{(unsigned int)actualrpm});
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// CTRLEncoderClicked
+///
+/// Called every pass of the control task to drain the encoder. A fast spin
+/// arrives as one larger (accelerated) step, so the demand, and the message
+/// to the display, is only updated once per pass however quickly the knob
+/// is turned. We update the RPM displayed, if we are able to
+///
+/// @context: TASK
+/// @scope: INTERNAL
+/// @param: none
+/// @return: none
+///
+////////////////////////////////////////////////////////////////////////////////
+
+void CTRLEncoderClicked(void)
+{
+	int steps=ENCGetSteps();
+
+	if(!steps) {
+		return;
+	}
+	TRAJClearProgram();					// the knob takes over from a program
+	demandrps+=steps;
+	if(demandrps<RPS_MIN) {
+		demandrps=RPS_MIN;
+	}
+	if(demandrps>RPS_MAX) {
+		demandrps=RPS_MAX;
+	}
+	CTRLWriteRPS(demandrps);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// CTRLNewRPS
+///
+/// Message handler for when someone entered a new RPS from the keypad.
+/// This comes from the display module and will already have been
+/// validated
+///
+/// @context: TASK
+/// @scope: INTERNAL
+/// @param: const MSGKEYPADRPS & msg - the new demand
+/// @return: none
+///
+////////////////////////////////////////////////////////////////////////////////
+
+void CTRLNewRPS(const MSGKEYPADRPS & msg)
+{
+	PRF_SCOPE(PRF_MESSAGES);
+
+	TRAJClearProgram();					// as does the keypad
+	demandrps=msg.rps;
+	CTRLWriteRPS(demandrps);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// CTRLProgramRPS
+///
+/// Message handler for the next demand of a setpoint program (traj.h).
+/// The program has already checked it.
+///
+/// @context: TASK
+/// @scope: INTERNAL
+/// @param: const MSGPROGRAMRPS & msg - the new demand
+/// @return: none
+///
+////////////////////////////////////////////////////////////////////////////////
+
+void CTRLProgramRPS(const MSGPROGRAMRPS & msg)
+{
+	PRF_SCOPE(PRF_MESSAGES);
+
+	demandrps=msg.rps;
+	CTRLWriteRPS(demandrps);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CTRLWriteRPS
+///
+/// This function consolidates calls from the encoder, the keypad and the
+/// setpoint program to update the RPM in one place - so we can ensure the
+/// writes to 'demandrps' are atomic. The demand goes to the trajectory
+/// generator, which moves the loop's setpoint to it.
+///
+/// @context: TASK
+/// @scope: INTERNAL
+/// @param: unsigned int rps - revs per second to set
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void CTRLWriteRPS(unsigned int rps)
+{
+	// we post this back to the display, to be displayed.
+	// Seems convoluted, but this gives us power of veto if for some
+	// reason we can not accept the keypad value.
+
+	MsgPost(MSGDEMANDRPS{(unsigned int)demandrps});
+
+#ifdef CTRL_GAIN_SCHEDULE
+	// The gains for the new demand are worked out here, and change at the
+	// same sample as the demand does.
+	CTRLCOEF kp,ki;
+
+	CTRLScheduleGains(rps,&kp,&ki);
+#endif
+
+	REVDisableOvfInterrupt();
+	TRAJSetTarget(rps);
+#ifdef CTRL_GAIN_SCHEDULE
+	ctrlkp=kp;
+	ctrlki=ki;
+#endif
+	REVEnableOvfInterrupt();
+}
+
+#ifdef CTRL_GAIN_SCHEDULE
+
+///////////////////////////////////////////////////////////////////////////////
+/// CTRLScheduleGains
+///
+/// Look up the gains for a demand in the schedule, interpolating linearly
+/// between the entries either side of it. Demands beyond either end of
+/// the table take that end's gains.
+///
+/// @context: TASK
+/// @scope: INTERNAL
+/// @param: unsigned int rps - the demand
+/// @param: CTRLCOEF * kp, CTRLCOEF * ki - filled in
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void CTRLScheduleGains(unsigned int rps, CTRLCOEF * kp, CTRLCOEF * ki)
+{
+	const CTRLSCHEDPOINT * lo;
+	const CTRLSCHEDPOINT * hi;
+	unsigned char idx;
+	long span;
+	long pos;
+
+	for(idx=1;idx<CTRL_SCHED_POINTS-1 && rps>ctrlsched[idx].rps;idx++);
+	hi=&ctrlsched[idx];
+	lo=hi-1;
+
+	if(rps<=lo->rps) {
+		*kp=CTRL_COEF(lo->kp);
+		*ki=CTRL_COEF(lo->ki);
+		return;
+	}
+	if(rps>=hi->rps) {
+		*kp=CTRL_COEF(hi->kp);
+		*ki=CTRL_COEF(hi->ki);
+		return;
+	}
+	span=hi->rps-lo->rps;
+	pos=rps-lo->rps;
+	*kp=CTRL_COEF(lo->kp+(int)(((long)(hi->kp-lo->kp)*pos)/span));
+	*ki=CTRL_COEF(lo->ki+(int)(((long)(hi->ki-lo->ki)*pos)/span));
+}
+
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// CTRLSetGains
+///
+/// Replace the PI coefficients. As with the demand, the sample interrupt is
+/// held off while the pair is written, so the loop never runs with one old
+/// and one new.
+///
+/// @context: TASK
+/// @scope: EXPORTED
+/// @param: double a1 - coefficient of the error now
+/// @param: double a0 - coefficient of the error one sample ago
+/// @return: int - zero if set, -1 if either is outside +/-CTRL_COEF_MAX
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int CTRLSetGains(double a1, double a0)
+{
+	if(a1<=-CTRL_COEF_MAX || a1>=CTRL_COEF_MAX || a0<=-CTRL_COEF_MAX || a0>=CTRL_COEF_MAX) {
+		return -1;
+	}
+
+#ifdef CTRL_GAIN_SCHEDULE
+	CTRLSCHEDPOINT * near=&ctrlsched[0];
+	unsigned int rps=(unsigned int)demandrps;
+	unsigned int best=0xffff;
+	CTRLCOEF kp,ki;
+
+	if(a1+a0<=-CTRL_COEF_MAX || a1+a0>=CTRL_COEF_MAX) {
+		return -1;
+	}
+
+	// The entry nearest the present demand takes the new gains, and the
+	// gains in force are looked up again with it.
+
+	for(unsigned char idx=0;idx<CTRL_SCHED_POINTS;idx++) {
+		unsigned int dist=(ctrlsched[idx].rps>rps)?ctrlsched[idx].rps-rps:rps-ctrlsched[idx].rps;
+
+		if(dist<best) {
+			best=dist;
+			near=&ctrlsched[idx];
+		}
+	}
+	near->kp=CTRL_TO_COEF(-a0);
+	near->ki=CTRL_TO_COEF(a1+a0);
+	CTRLScheduleGains(rps,&kp,&ki);
+
+	REVDisableOvfInterrupt();
+	ctrlkp=kp;
+	ctrlki=ki;
+	REVEnableOvfInterrupt();
+#else
+	REVDisableOvfInterrupt();
+#ifdef CTRL_FIXED_POINT
+	ctrla1=CTRL_TO_COEF(a1);
+	ctrla0=CTRL_TO_COEF(a0);
+#else
+	ctrla1=a1;
+	ctrla0=a0;
+#endif
+	REVEnableOvfInterrupt();
+#endif
+	return 0;
+}
+///////////////////////////////////////////////////////////////////////////////
+/// CTRLGetGains
+///
+/// The PI coefficients in use
+///
+/// @context: TASK
+/// @scope: EXPORTED
+/// @param: double * a1, double * a0 - filled in
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void CTRLGetGains(double * a1, double * a0)
+{
+#ifdef CTRL_GAIN_SCHEDULE
+	CTRLCOEF kp,ki;
+
+	REVDisableOvfInterrupt();
+	kp=ctrlkp;
+	ki=ctrlki;
+	REVEnableOvfInterrupt();
+
+#ifdef CTRL_FIXED_POINT
+	*a1=(double)(kp+ki)/(1<<CTRL_COEF_FRAC);
+	*a0=-(double)kp/(1<<CTRL_COEF_FRAC);
+#else
+	*a1=kp+ki;
+	*a0=-kp;
+#endif
+#else
+	REVDisableOvfInterrupt();
+#ifdef CTRL_FIXED_POINT
+	*a1=(double)ctrla1/(1<<CTRL_COEF_FRAC);
+	*a0=(double)ctrla0/(1<<CTRL_COEF_FRAC);
+#else
+	*a1=ctrla1;
+	*a0=ctrla0;
+#endif
+	REVEnableOvfInterrupt();
+#endif
+}
+
+#ifdef CTRL_GAIN_SCHEDULE
+
+/////////////////////////////////////////////////////////////////////////////
+/// CTRLPILoop
+///
+/// PI in position form with an explicit integrator, back-calculation
+/// anti-windup and scheduled gains (see CTRL_GAIN_SCHEDULE in control.h).
+/// In Q-format integer arithmetic the integrator is Q15.16, like the
+/// output: Kp.e and Ki.T.e are Q4*Q12 products as before, and the
+/// anti-windup term scales the Q16 excess down to Q4 first so its product
+/// with the Q12 gain is Q16 too. The extra cost over the velocity form is
+/// one 16x16 and one 32x16 bit multiply.
+///
+/// While the auto-tuner runs its relay drives the motor instead, and the
+/// integrator is set to whatever would have given the relay's duty, so the
+/// loop picks up from where the relay left off.
+///
+/// Note that this is called in interrupt context - be careful to ensure
+/// atomicity of the input (rpm)
+///
+/// This function will update the PWM from within
+///
+/// @context: INTERRUPT
+/// @scope: EXPORTED
+/// @param: CTRLRPS actualrpsin - the measured RPS
+/// @return: none
+///
+/////////////////////////////////////////////////////////////////////////////
+
+#ifdef CTRL_FIXED_POINT
+
+void CTRLPILoop(CTRLRPS actualrpsin)
+{
+	// the integrator, i(t), Q15.16
+	static long integ=0;
+
+	atomicrps=CTRL_FROM_TRAJ(TRAJStep());
+
+	// the error, Q11.4, and the output before and after the limiter, Q15.16
+	int e=atomicrps-actualrpsin;
+	long p=(long)ctrlkp*e;
+	long u=p+integ;
+	long out=u;
+	unsigned char duty;
+
+	if (out > (255L<<CTRL_OUT_FRAC)) {
+		out = (255L<<CTRL_OUT_FRAC);
+	}
+	if (out < 0) {
+		out = 0;
+	}
+
+	duty = (unsigned char)(out>>CTRL_OUT_FRAC);
+	if (TUNERelay(atomicrps,actualrpsin,&duty)) {
+		out = (long)duty<<CTRL_OUT_FRAC;
+		integ = out-p;
+	} else {
+		// i(t+T) = i(t) + Ki.T.e(t) + (T/Tt).(out(t) - u(t))
+		integ += (long)ctrlki*e + (long)CTRL_TRACK_Q*((out-u)>>CTRL_COEF_FRAC);
+	}
+	if (integ > CTRL_INT_MAX) {
+		integ = CTRL_INT_MAX;
+	}
+	if (integ < -CTRL_INT_MAX) {
+		integ = -CTRL_INT_MAX;
+	}
+
+	TEL_RECORD(atomicrps,actualrpsin,e,integ,duty);
+	PWMSetDuty((unsigned int)(out>>CTRL_PWM_SHIFT));
+}
+
+#else
+
+void CTRLPILoop(CTRLRPS actualrpsin)
+{
+	static double integ=0;
+
+	atomicrps=CTRL_FROM_TRAJ(TRAJStep());
+
+	double e=atomicrps-actualrpsin;
+	double p=ctrlkp*e;
+	double u=p+integ;
+	double out=u;
+	unsigned char duty;
+
+	if (out > 255) {
+		out = 255;
+	}
+	if (out < 0) {
+		out = 0;
+	}
+
+	duty = (unsigned char)out;
+	if (TUNERelay(atomicrps,actualrpsin,&duty)) {
+		out = duty;
+		integ = out-p;
+	} else {
+		integ += ctrlki*e + ((double)CTRL_TRACK_Q/(1<<CTRL_COEF_FRAC))*(out-u);
+	}
+	if (integ > (double)(CTRL_INT_MAX>>CTRL_OUT_FRAC)) {
+		integ = (double)(CTRL_INT_MAX>>CTRL_OUT_FRAC);
+	}
+	if (integ < -(double)(CTRL_INT_MAX>>CTRL_OUT_FRAC)) {
+		integ = -(double)(CTRL_INT_MAX>>CTRL_OUT_FRAC);
+	}
+
+	TEL_RECORD((int)(atomicrps*(1<<CTRL_RPS_FRAC)),(int)(actualrpsin*(1<<CTRL_RPS_FRAC)),
+		(int)(e*(1<<CTRL_RPS_FRAC)),(long)(integ*(1L<<CTRL_OUT_FRAC)),duty);
+	PWMSetDuty((unsigned int)(out*(1<<PWM_DITHER_BITS)));
+}
+
+#endif
+
+#else
+
+/////////////////////////////////////////////////////////////////////////////
+/// CTRLPILoop
+///
+/// A simple PI implementation using Q-format integer arithmetic. The
+/// difference equation and the limiter are identical to the floating point
+/// version below; only the number representation changes (see control.h).
+///
+/// Estimated cost per call on the ATmega328P at 16MHz, including the
+/// conversion of the rev count to RPS in the Timer1 ISR (avr-libc soft-float
+/// timings, not measured on the bench):
+///
+///                          double            fixed point
+///   count -> RPS           ~550 (u32->f, /)  ~20  (8x32 multiply)
+///   error                  ~100 (fsub)       ~4   (16 bit subtract)
+///   a1.e + a0.e1           ~280 (2 fmul)     ~50  (2 16x16->32 mul)
+///   out1 + ...             ~200 (2 fadd)     ~10  (2 32 bit add)
+///   limiter                ~90  (2 fcmp)     ~16
+///   out -> duty            ~70  (f->u16)     ~8   (shift)
+///   total                  ~1300 (~80us)     ~110 (~7us)
+///
+/// Note that this is called in interrupt context - be careful to ensure
+/// atomicity of the input (rpm)
+///
+/// This function will update the PWM from within
+///
+/// @context: INTERRUPT
+/// @scope: EXPORTED
+/// @param: CTRLRPS actualrpsin - the measured RPS, Q11.4
+/// @return: none
+///
+/////////////////////////////////////////////////////////////////////////////
+
+#ifdef CTRL_FIXED_POINT
+
+void CTRLPILoop(CTRLRPS actualrpsin)
+{
+	// here out1 represents out(t - T), Q15.16
+	// and e1 represents e(t - T), Q11.4
+	static long out1=0;
+	static int e1=0;
+
+	// out represents out(t), Q15.16, and duty its whole part
+	long out;
+	unsigned char duty;
+
+	// This sample's setpoint, on its way to the demand
+	atomicrps=CTRL_FROM_TRAJ(TRAJStep());
+
+	// Calculating the error value e. Both operands are limited to
+	// the Q11.4 range so this can not overflow.
+	int e=atomicrps-actualrpsin;
+
+	// The difference equation
+	// out(t) = out(t - T) + a0.e(t) + a1.e(t-R)
+	// Each product is Q4*Q12=Q16 and bounded by 2^30, so the sum of two
+	// of them and a limited out1 always fits in a long.
+	out = out1 + (long)ctrla1*e + (long)ctrla0*e1;
+
+	// Constrain the value of out to: 0 <= out <= 255 (in Q16).
+	// As before, the limiter sits before the z^-1 to prevent windup.
+	if (out > (255L<<CTRL_OUT_FRAC)) {
+		out = (255L<<CTRL_OUT_FRAC);
+	}
+	if (out < 0) {
+		out = 0;
+	}
+
+	// The integer part of out is the duty in whole counts, which is
+	// what the auto-tuner works in. While it runs its relay drives the
+	// motor instead, and the loop follows it, so that it picks up from
+	// where the relay left off.
+	duty = (unsigned char)(out>>CTRL_OUT_FRAC);
+	if (TUNERelay(atomicrps,actualrpsin,&duty)) {
+		out = (long)duty<<CTRL_OUT_FRAC;
+	}
+
+	// Update the internal variables.
+	e1 = e;
+	out1 = out;
+
+	TEL_RECORD(atomicrps,actualrpsin,e,out,duty);
+	PWMSetDuty((unsigned int)(out>>CTRL_PWM_SHIFT));
+}
+
+#else
+
+/////////////////////////////////////////////////////////////////////////////
+/// CTRLPILoop
+///
+/// A simple PI implementation using floating point arithmetic. This is to
+/// demonstrate the slow speed of operation when using software floating
+/// point
+///
+/// Note that this is called in interrupt context - be careful to ensure
+/// atomicity of the input (rpm)
+///
+/// This function will update the PWM from within
+///
+/// @context: INTERRUPT
+/// @scope: EXPORTED
+/// @param: double actualrpsin - the measured RPS
+/// @return: none
+///
+/////////////////////////////////////////////////////////////////////////////
+
+void CTRLPILoop(CTRLRPS actualrpsin)
+{
+  // here out1 represents out(t - T)
+  // and e1 represents e(t - T)
+	static double e1=0,out1=0;	// outputs of z^-1
+
+  // out represents out(t), and duty its whole part
+	double out;
+	unsigned char duty;
+
+  // This sample's setpoint, on its way to the demand
+	atomicrps=CTRL_FROM_TRAJ(TRAJStep());
+
+  // Calculating the error value e
+  // e represents e(t)
+	double e=atomicrps-actualrpsin;
+
+  // TODO: Implement the difference equation
+  // out(t) = out(t - T) + a0.e(t) + a1.e(t-R)
+  out = out1 + ctrla1*e + ctrla0*e1;
+
+  // TODO: Contrain the value out out to: 0 <= out <= 255
+	// Rationale for this: We are using a limiter here, before the z^-1. 
+	// This helps to prevent integrator windup
+  if (out > 255){
+    out = 255;
+  }
+  if (out < 0){
+    out = 0;
+  }
+  
+  // The auto-tuner's relay takes over while it runs, as above
+  duty = (unsigned char)out;
+  if (TUNERelay(atomicrps,actualrpsin,&duty)) {
+    out = duty;
+  }
+
+  // TODO: Update the internal variables.
+  // This essentially will perform the operations:
+  //    e(t - T) = e(t), and
+  //    out(t - T) = out(t)
+  e1 = e;
+  out1 = out;
+	
+  // By this stage, the value of out has been calculated and limited 
+  // to the range 0 to 255, and the internal variables have been updated.
+  // Now send the value of 'out' to the motor.
+	TEL_RECORD((int)(atomicrps*(1<<CTRL_RPS_FRAC)),(int)(actualrpsin*(1<<CTRL_RPS_FRAC)),
+		(int)(e*(1<<CTRL_RPS_FRAC)),(long)(out*(1L<<CTRL_OUT_FRAC)),duty);
+	PWMSetDuty((unsigned int)(out*(1<<PWM_DITHER_BITS)));
+}
+
+#endif
+
+#endif
@@ -10,10 +10,84 @@
 #define _CONTROL_H_
 
 //
-// coefficients of PI. These can be arbitrary for the speed test
+// Arithmetic used by the PI loop. With CTRL_FIXED_POINT defined the loop runs
+// in integer (Q-format) arithmetic, so nothing on the sample interrupt path
+// calls the software floating point library. Comment it out to build the
+// original double implementation for comparison.
 
-#define PI_A1	0.04
-#define PI_A0	0.01
+#define CTRL_FIXED_POINT
+
+//
+// Structure of the PI loop. With CTRL_GAIN_SCHEDULE defined the loop keeps
+// its integrator as explicit state and works in position form:
+//
+//   u(t) = Kp.e(t) + i(t)          duty = limit(u(t))
+//   i(t+T) = i(t) + Ki.T.e(t) + (T/Tt).(duty - u(t))
+//
+// The last term is back-calculation anti-windup: while the limiter is
+// cutting the output, the integrator is pulled back towards the value
+// that would just reach the limit, with time constant Tt, rather than
+// carrying on integrating an error the motor can not act on. Kp and Ki
+// come from a table against demand RPS (control.cpp), interpolated each
+// time the demand changes.
+//
+// Comment it out to build the original velocity form loop, with the
+// PI_A1/PI_A0 pair below and the limiter as its only windup protection.
+
+#define CTRL_GAIN_SCHEDULE
+
+//
+// Starting gains of the velocity form PI: Kp in duty per RPS, Ki in duty
+// per RPS per second. These are the original coefficient pair, 0.04 and
+// 0.01 at its 131ms sample. The coefficients follow from the sample time
+// (revcount.h): A1 = Kp+Ki.T multiplies the error now, A0 = -Kp the error
+// one sample ago. They can be replaced at run time (CTRLSetGains), which
+// the auto-tuner (tune.h) does.
+
+#define PI_KP	(-0.01)
+#define PI_KI	0.3815
+
+#define PI_A1	(PI_KP+PI_KI*REV_SAMPLE_SECONDS)
+#define PI_A0	(-(PI_KP))
+
+//
+// Anti-windup tracking time constant Tt, in seconds. Shorter lets go of
+// the limit sooner; much shorter than Ti and the integrator forgets its
+// load too. Roughly Ti is the usual choice for PI.
+
+#define CTRL_TRACK_SECONDS	0.4
+
+//
+// Q-formats used by the fixed point loop (the speed format is also used by
+// the rev counter's integer estimators, whichever loop is built):
+//
+//   speed and error   - Q11.4 held in an int  (RPS * 16)
+//   coefficients      - Q3.12 held in an int  (CTRL_TO_COEF, to nearest)
+//   controller output - Q15.16 held in a long (duty * 65536)
+//
+// The product of a Q4 error and a Q12 coefficient is exactly Q16, and a
+// 16x16 bit product can never overflow the 32 bit accumulator, so the
+// difference equation needs no intermediate shifts.
+
+#define CTRL_RPS_FRAC	4
+#define CTRL_COEF_FRAC	12
+#define CTRL_OUT_FRAC	(CTRL_RPS_FRAC+CTRL_COEF_FRAC)
+
+#define CTRL_TO_COEF(x)	((int)(((x)<0)?(x)*(1<<CTRL_COEF_FRAC)-0.5:(x)*(1<<CTRL_COEF_FRAC)+0.5))
+#define CTRL_COEF_MAX	8.0			// coefficients must be within +/- this
+
+#define PI_A1_Q		CTRL_TO_COEF(PI_A1)
+#define PI_A0_Q		CTRL_TO_COEF(PI_A0)
+
+#ifdef CTRL_FIXED_POINT
+
+typedef int CTRLRPS;		// speed in RPS, Q11.4
+
+#else
+
+typedef double CTRLRPS;		// speed in RPS
+
+#endif
 
 ///////////////////////////////////////////////////////////////////////////////
 /// CONTROLInitialize
@@ -27,11 +101,32 @@
 
 void CONTROLInitialize(void);
 
+///////////////////////////////////////////////////////////////////////////////
+/// CTRLSetGains / CTRLGetGains
+///
+/// Replace, or read, the coefficients the PI loop uses, in the velocity
+/// form's terms (a1 = Kp + Ki.T, a0 = -Kp). The new pair takes effect
+/// together at the next sample. With CTRL_GAIN_SCHEDULE, setting replaces
+/// the schedule entry nearest the present demand, so tuning at a few
+/// speeds fills in the table; reading gives the gains interpolated for
+/// the present demand.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: double a1 - coefficient of the error now
+/// @param: double a0 - coefficient of the error one sample ago
+/// @return: int - zero if set, -1 if either is outside +/-CTRL_COEF_MAX
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int CTRLSetGains(double a1, double a0);
+void CTRLGetGains(double * a1, double * a0);
+
 /////////////////////////////////////////////////////////////////////////////
 /// CTRLPILoop
 ///
-/// A simple PI implementation using floating point arithmetic. This is to
-/// demonstrate the slow speed of operation when using software floating
+/// A simple PI implementation. Depending on CTRL_FIXED_POINT this uses
+/// either Q-format integer arithmetic or (the original) software floating
 /// point
 ///
 /// Note that this is called in interrupt context - be careful to ensure
@@ -41,11 +136,11 @@ void CONTROLInitialize(void);
 ///
 /// @context: INTERRUPT
 /// @scope: EXPORTED
-/// @param: double actualrpsin - the measured RPS
+/// @param: CTRLRPS actualrpsin - the measured RPS
 /// @return: none
 ///
 /////////////////////////////////////////////////////////////////////////////
 
-void CTRLPILoop(double actualrpsin);
+void CTRLPILoop(CTRLRPS actualrpsin);
 
 #endif
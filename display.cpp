@@ -1,307 +1,554 @@
-////////////////////////////////////////////////////////////////////////////////
-/// DISPLAY.H
-///
-/// Display module
-///
-/// Dr J A Gow / Dr M A Oliver 2022
-///
-////////////////////////////////////////////////////////////////////////////////
-
-#include "display.h"
-#include "common.h"
-#include <kernel.h>
-#include <LiquidCrystal_I2C.h>
-
-
-//
-// This enum defines the states used by the state machine
-
-typedef enum _DISPSTATE {
-
-	DISPSTATE_REFSH,
-	DISPSTATE_IDLE,
-	DISPSTATE_UPDATING,
-	DISPSTATE_VALIDATE,
-	DISPSTATE_ERROR
-
-} DISPSTATE;
-
-
-// One module-wide instance of the display object, as declared in the
-// library.
-
-LiquidCrystal_I2C lcd(DISP_I2C_ADDR,16,2);
-
-// Two module variables containing the demanded and
-// actual RPM to display
-static unsigned int ActualRPS = 0;
-static unsigned int DemandRPS = 0;
-
-// Another module variable contains the unvalidated
-// entered RPM value.
-static unsigned int EnteredRPS = 0;	// value entered
-
-// The character sequence entered by the user. We keep this because
-// it is needed in both task and message handler
-static char numarr[5];
-
-// Display state variable
-DISPSTATE state = DISPSTATE_REFSH;
-
-// Prototype of display task functions
-
-void DISPTask(void * context);			// display task handler
-void DISPUpdateRPS(void * context);		// message handler for actual RPM updates
-void DISPUpdateDemandRPS(void * context);	// message handler for demand RPM updates
-void DISPKeyPressed(void * context);		// keypad update pressed
-
-////////////////////////////////////////////////////////////////////////////////
-/// DISPInitialize
-///
-/// Initialize the display
-///
-/// @scope: EXPORTED
-/// @context: TASK
-/// @param: none
-/// @return: none
-///
-////////////////////////////////////////////////////////////////////////////////
-
-void DISPInitialize(void)
-{
-  // Preliminary setup
-  lcd.init();
-  lcd.backlight();
-  lcd.clear();
-  lcd.setCursor(0,0);
-  lcd.print(F("Starting.."));
-
-  Kernel::OS.MessageQueue.Subscribe(MSG_ID_NEW_ACTUAL_RPS,DISPUpdateRPS); //DISPUpdateRPS() mapped against MSG_ID_NEW_ACTUAL_RPS
-  Kernel::OS.MessageQueue.Subscribe(MSG_ID_KEY_PRESSED,DISPKeyPressed); //DISPKeyPressed() mapped against MSG_ID_KEY_PRESSED
-  Kernel::OS.MessageQueue.Subscribe(MSG_ID_NEW_DEMAND_RPS,DISPUpdateDemandRPS); //DISPUpdateDemandRPS() mapped against MSG_ID_NEW_DEMAND_RPS
-
-  Kernel::OS.TaskManager.RegisterTaskHandler(DISPTask,(void *)NULL); // Register the task for the display
-}
-
-////////////////////////////////////////////////////////////////////////////////
-/// DISPTask
-///
-/// Main task for the display module
-///
-/// @scope: INTERNAL
-/// @context: TASK
-/// @param: none (context is null)
-/// @return: none
-///
-////////////////////////////////////////////////////////////////////////////////
-
-void DISPTask(void * context)
-{
-	static Kernel::OSTimer *errtimer;	// timeout for error.
-	switch(state) {
-
-		case DISPSTATE_REFSH:		
-        
-        //Displays the current "ActualRPS" value on the first line
-        char act[3];
-        sprintf(act,"%3.3d",ActualRPS);
-        lcd.setCursor(0,0);
-        lcd.print(F("Actual RPS:"));
-        lcd.setCursor(12,0);
-        lcd.print(act);
-        
-        //Displays the current "DemandRPS" value on the second line
-        char dem[3];
-        sprintf(dem,"%3.3d",DemandRPS);
-        lcd.setCursor(0,1);
-        lcd.print(F("Demand RPS:"));
-        lcd.setCursor(12,1);
-        lcd.print(dem);
-        
-			break;
-
-		case DISPSTATE_IDLE:
-		case DISPSTATE_UPDATING:	
-		  // do nothing. We only update when messages arrive asking us to.
-			break;
-
-		case DISPSTATE_VALIDATE:
-		    //Checks if EnteredRPS is valid
-		    //EnteredRPS is valid if it is within RPS_MIN and RPS_MAX and is not equal to zero
-			  if(EnteredRPS > RPS_MAX || EnteredRPS < RPS_MIN && (EnteredRPS != 0)){
-			    errtimer=new Kernel::OSTimer(2000);                 // starts the errtimer of 2sec if the above two conditions are met
-				  errtimer->Set(2000);
-          lcd.setCursor(2,1);
-          lcd.print(F("INVALID RPS"));					              // displays an error message, showing the invalidity of the EnteredRPS
-			    state=DISPSTATE_ERROR;                              // change state to DISPSTATE_ERROR
-			    }
-        else {Kernel::OS.MessageQueue.Post(MSG_ID_NEW_RPS_KEYPAD, (void *)EnteredRPS, Kernel::MQ_OWNER_CALLER, Kernel::MQ_CONTEXT_TASK);
-          lcd.clear();
-          state=DISPSTATE_REFSH;
-          }
-			break;
-
-		case DISPSTATE_ERROR:		
-		  if(errtimer->isExpired()) {                           //checks is errTimer is expired
-				delete errtimer;                                    
-        char tem[5];
-        lcd.clear();                                        //clears display
-        sprintf(tem,"%3.3d",EnteredRPS);                    //saves the enteredRPS in %3.3d format into 'tem' variable
-        lcd.setCursor(0,0);                                 //Resets the cursor
-        lcd.print(F("RE-SET:"));                            //prints "RE-SET"
-        lcd.setCursor(9,0);                                 //sets cursor at position to display the EnteredRPS value
-        lcd.print(tem);                                     
-        lcd.setCursor(9,0);
-        lcd.blink();                                        //place the cursor at the first number of the EnteredRPS
-       
-				state=DISPSTATE_UPDATING;                           // Return to updating state in hope that a valid Demand RPM may be entered
-      }
-		  break;
-
-		// a catch-all, we should never get here.
-		default: 					
-		  state=DISPSTATE_IDLE;
-			break;
-	}
-}
-
-////////////////////////////////////////////////////////////////////////////////
-/// DISPUpdateRPM
-///
-/// Responds to messages coming in with an updated actual RPM. We
-/// check if there is any change, and if so, display it. We can only
-/// do this if in DISPSTATE_IDLE
-///
-/// @context: TASK
-/// @scope: INTERNAL
-/// @param: void * context - RPM value cast to unsigned int
-/// @return: none
-///
-////////////////////////////////////////////////////////////////////////////////
-
-void DISPUpdateRPS(void * context)
-{
-	unsigned int newrps=(unsigned int)context;
-
-	// NOTE: The display is slow. We may thus want to
-	// control the update rate, and not update every time
-	// a change is made.
-  
-	if(state==DISPSTATE_IDLE || state==DISPSTATE_REFSH) {
-		// we only update the display if we need to.
-		if(newrps!=ActualRPS) {
-			ActualRPS=newrps;
-			char tempstr[6];
-			sprintf(tempstr,"%3.3d",ActualRPS);
-			lcd.setCursor(12,1);
-			lcd.print(tempstr);
-		}
-	}
-}
-
-
-////////////////////////////////////////////////////////////////////////////////
-/// DISPUpdateDemandRPM
-///
-/// Responds to messages coming in to change the displayed demand RPM. We
-/// check if there is any change, and if so, display it. We can only
-/// do this if in DISPSTATE_IDLE
-///
-/// @context: TASK
-/// @scope: INTERNAL
-/// @param: void * context - RPM value cast to unsigned int
-/// @return: none
-///
-////////////////////////////////////////////////////////////////////////////////
-
-void DISPUpdateDemandRPS(void * context)
-{
-	unsigned int newrps=(unsigned int)context;
-  if(state==DISPSTATE_IDLE || state==DISPSTATE_REFSH) {     //This update function is ran only when the program is in the DISPSTATE_IDLE or DISPSTATE_REFSH state                                                           
-    if(newrps!=DemandRPS) {                                 // checks if new input is same with old DemandRPS value
-      DemandRPS=newrps;                                     // update the DemandRPS value to the new input
-      char tempstrr[6];                                       
-      sprintf(tempstrr,"%3.3d",DemandRPS);                  //saves the DemandRPS in %3.3d format into 'tempstrr' variable
-      lcd.setCursor(12,0);
-      lcd.print(tempstrr);                                  //Displays the updated DemandRPS
-    }
-  }
-}
-////////////////////////////////////////////////////////////////////////////////
-/// DISPKeyPressed
-///
-/// Someone has pressed a button. We need to read the user's value, and
-/// deal with it according to state.
-///
-/// @context:  TASK
-/// @scope: INTERNAL
-/// @param: void * context: encoded value of key pressed as unsigned char
-/// @return: none
-///
-////////////////////////////////////////////////////////////////////////////////
-
-void DISPKeyPressed(void * context)
-{
-	unsigned char keyval=(unsigned char)context;
-	static unsigned int curpos=9;
-  unsigned char old;
-	switch(state) {
-
-		case DISPSTATE_IDLE:
-		case DISPSTATE_REFSH:		// if the key is anything but a numeral, ignore it
-		   if(state==DISPSTATE_IDLE || state==DISPSTATE_REFSH){
-		    if(keyval<0x0a) {
-				  // This is the first press. Set up the display:
-				  curpos=9;
-				  sprintf(numarr,"%3.3d",DemandRPS);
-    			numarr[0]=0x30+keyval;
-    			lcd.clear();
-    			lcd.setCursor(0,0);
-    			lcd.print(F("New RPS:"));
-    			lcd.setCursor(curpos,0);
-    			lcd.print(numarr);
-    			lcd.setCursor(++curpos,0);				
-    			lcd.blink();
-          
-    			state=DISPSTATE_UPDATING;}}
-    	  break;
-    		
-		case DISPSTATE_UPDATING:
-        if(keyval<0x0a){                    //executes if the keypad press is a number (less than 10)
-          if(curpos <12){                   //stops input from keypad if the values inputted are already 3
-            old=13;                         //resets to a dp value   
-            if(old != keyval){              //executes a new key is pressed
-              old=keyval;                   //save the current keypress in variable old
-              numarr[curpos-9]=0x30+old;    //save the keypress in ascii into the next index of the array
-              lcd.print(old);               //displays the key pressed 
-              lcd.setCursor(++curpos,0);    // sets cursor in the next position awaiting input
-              lcd.blink();                            
-              }}}
-       
-        else if(keyval==0x0a && curpos!=9){ // executes if the key pressed is an (*) and the cursor isn't at the beginning of the input 
-              --curpos;            // takes the cursor back by a step
-              lcd.setCursor(curpos,0); 
-              lcd.blink();
-              state=DISPSTATE_UPDATING;     //remains in state for figures of RPM to be set
-              break;}
-
-        if(keyval==0x0b){                   //checks if a (#) was pressed
-              lcd.noCursor();
-              lcd.noBlink();
-              curpos=9;                     // resets cursor position variable back to first digit
-              sscanf(numarr,"%d",&EnteredRPS); //saves the new RPS value into EnteredRPS, to be validated in the next state
-              state=DISPSTATE_VALIDATE;       // change state to DISPSTATE_VALIDATE for validation of figure
-              break;}
-               
-              
-      // TODO: Add the code to deal with Enter (#),
-      // Backspace (*) and subsequent 0-9 keypresses.
-        
-		  
-
-		// in all other states, we take no action if a key is pressed.
-
-		default:					break;
-	
-  }
-}
+////////////////////////////////////////////////////////////////////////////////
+/// DISPLAY.H
+///
+/// Display module
+///
+/// Dr J A Gow / Dr M A Oliver 2022
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#include <Arduino.h>
+#include <string.h>
+#include "display.h"
+#include "common.h"
+#include "iic.h"
+#include "fmt.h"
+#include "prf.h"
+#include "sched.h"
+#include "timer.h"
+#include "topics.h"
+#include "tune.h"
+#include <kernel.h>
+#include <LiquidCrystal_I2C.h>
+
+
+//
+// This enum defines the states used by the state machine
+
+typedef enum _DISPSTATE {
+
+	DISPSTATE_REFSH,
+	DISPSTATE_IDLE,
+	DISPSTATE_UPDATING,
+	DISPSTATE_VALIDATE,
+	DISPSTATE_ERROR,
+	DISPSTATE_TUNING
+
+} DISPSTATE;
+
+
+// One module-wide instance of the display object, as declared in the
+// library.
+
+LiquidCrystal_I2C lcd(DISP_I2C_ADDR,DISP_COLS,DISP_ROWS);
+
+//
+// Shadow framebuffer. All display code writes into dispshadow; disppanel
+// is what the LCD holds. DISPFlush sends the cells that differ, a few per
+// pass, so a screen that is not changing costs nothing on the bus. Cells
+// are numbered row*DISP_COLS+col.
+
+#define DISP_CELLS		(DISP_COLS*DISP_ROWS)
+#define DISP_NOWHERE	0xff		// panel address not known
+
+static char dispshadow[DISP_CELLS];
+static char disppanel[DISP_CELLS];
+static unsigned char dispscan=0;			// where the next flush starts looking
+static unsigned char dispaddr=DISP_NOWHERE;	// cell the LCD will write next
+static unsigned char dispcursor=DISP_NOWHERE;	// blinking cursor wanted here, or not at all
+static unsigned char dispblink=0;			// nonzero if the panel is blinking
+
+// Two module variables containing the demanded and
+// actual RPM to display
+static unsigned int ActualRPS = 0;
+static unsigned int DemandRPS = 0;
+static unsigned char redraw = 1;		// the RPS screen needs rendering
+
+// Another module variable contains the unvalidated
+// entered RPM value.
+static unsigned int EnteredRPS = 0;	// value entered
+
+// The character sequence entered by the user. We keep this because
+// it is needed in both task and message handler
+static char numarr[FMT_UNSIGNED_LEN];
+
+// Display state variable
+DISPSTATE state = DISPSTATE_REFSH;
+
+// How long an invalid entry, or the end of an auto-tune, is shown, from a
+// timer taken from the pool at initialization
+
+#define DISP_ERROR_MS	2000
+
+static TMRHANDLE disperrtimer=TMR_NONE;
+
+// Prototype of display task functions
+
+void DISPTask(void * context);			// display task handler
+
+// The message handlers, for actual and demand RPM updates and key presses,
+// are prototyped in topics.h along with their routes.
+
+////////////////////////////////////////////////////////////////////////////////
+/// DISPClear / DISPPutStr / DISPPutStrP / DISPPutChar / DISPSetCursor
+///
+/// Draw into the shadow buffer. Nothing reaches the LCD until DISPFlush
+/// gets to it. Text is clipped at the end of the row. DISPPutStrP takes a
+/// string in program memory (PSTR). DISPSetCursor places the blinking
+/// cursor, or hides it if col is DISP_NOWHERE.
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: unsigned char col, row - where the text starts
+/// @param: str / ch - what to draw
+/// @return: none
+///
+////////////////////////////////////////////////////////////////////////////////
+
+static void DISPClear(void)
+{
+	memset(dispshadow,' ',DISP_CELLS);
+	dispcursor=DISP_NOWHERE;
+}
+
+static void DISPPutStr(unsigned char col, unsigned char row, const char * str)
+{
+	char * cell=&dispshadow[row*DISP_COLS];
+
+	while(*str && col<DISP_COLS) {
+		cell[col++]=*str++;
+	}
+}
+
+static void DISPPutStrP(unsigned char col, unsigned char row, const char * str)
+{
+	char * cell=&dispshadow[row*DISP_COLS];
+	char ch;
+
+	while((ch=pgm_read_byte(str++)) && col<DISP_COLS) {
+		cell[col++]=ch;
+	}
+}
+
+static void DISPPutChar(unsigned char col, unsigned char row, char ch)
+{
+	dispshadow[row*DISP_COLS+col]=ch;
+}
+
+static void DISPSetCursor(unsigned char col, unsigned char row)
+{
+	dispcursor=(col==DISP_NOWHERE)?DISP_NOWHERE:row*DISP_COLS+col;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// DISPFlush
+///
+/// Send at most DISP_FLUSH_BYTES changed cells (cursor moves count as one)
+/// to the LCD. Runs of changed cells go out back to back, relying on the
+/// LCD's address auto-increment. The scan carries on where it left off, so
+/// every cell is reached within a few passes. Once the panel matches the
+/// shadow the cursor is put back where it is wanted.
+///
+/// The LCD library drives the TWI itself, so we stay off the bus while the
+/// IIC engine has anything queued.
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: none
+/// @return: none
+///
+////////////////////////////////////////////////////////////////////////////////
+
+static void DISPFlush(void)
+{
+	unsigned char budget=DISP_FLUSH_BYTES;
+	unsigned char scanned;
+
+	if(!IICIsIdle()) {
+		return;
+	}
+
+	for(scanned=0;scanned<DISP_CELLS && budget;scanned++) {
+		unsigned char idx=dispscan;
+
+		if(dispshadow[idx]!=disppanel[idx]) {
+			if(dispaddr!=idx) {
+				lcd.setCursor(idx%DISP_COLS,idx/DISP_COLS);
+				dispaddr=idx;
+				if(!--budget) {
+					break;
+				}
+			}
+			lcd.write(dispshadow[idx]);
+			disppanel[idx]=dispshadow[idx];
+			budget--;
+
+			// The LCD address runs on past the end of a row, but not
+			// onto the next row
+
+			dispaddr=((idx+1)%DISP_COLS)?idx+1:DISP_NOWHERE;
+		}
+		dispscan=(dispscan+1)%DISP_CELLS;
+	}
+	if(scanned<DISP_CELLS) {
+		return;		// out of budget, may not be clean yet
+	}
+
+	// All clean. Put the cursor back if the writes moved it.
+
+	if(dispcursor==DISP_NOWHERE) {
+		if(dispblink) {
+			lcd.noCursor();
+			lcd.noBlink();
+			dispblink=0;
+		}
+	} else if(dispaddr!=dispcursor || !dispblink) {
+		lcd.setCursor(dispcursor%DISP_COLS,dispcursor/DISP_COLS);
+		dispaddr=dispcursor;
+		if(!dispblink) {
+			lcd.blink();
+			dispblink=1;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// DISPRenderRPS
+///
+/// Draw the actual and demand RPS screen
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: none
+/// @return: none
+///
+////////////////////////////////////////////////////////////////////////////////
+
+static void DISPRenderRPS(void)
+{
+	char num[FMT_UNSIGNED_LEN];
+
+	//Displays the current "ActualRPS" value on the first line
+	DISPPutStrP(0,0,PSTR("Actual RPS:     "));
+	FMTUnsigned(num,ActualRPS,3);
+	DISPPutStr(12,0,num);
+
+	//Displays the current "DemandRPS" value on the second line
+	DISPPutStrP(0,1,PSTR("Demand RPS:     "));
+	FMTUnsigned(num,DemandRPS,3);
+	DISPPutStr(12,1,num);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// DISPInitialize
+///
+/// Initialize the display
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: none
+/// @return: none
+///
+////////////////////////////////////////////////////////////////////////////////
+
+void DISPInitialize(void)
+{
+  // Preliminary setup
+  lcd.init();
+  lcd.backlight();
+  lcd.clear();
+
+  // The panel is blank after the clear; the shadow starts out the same.
+  memset(disppanel,' ',DISP_CELLS);
+  DISPClear();
+  DISPPutStrP(0,0,PSTR("Starting.."));
+
+  // Flag only: DISPTask polls it. Should the pool be used up this is
+  // TMR_NONE, which reads as already expired, so the messages it holds
+  // are just not held.
+  disperrtimer=TMRCreate(NULL,NULL);
+
+
+  SCHAddTask(DISPTask,(void *)NULL,0,0,SCH_PRIO_LOW); // Register the task for the display, in the background
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// DISPGetShadow
+///
+/// The shadow buffer, row by row
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: none
+/// @return: const char * - DISP_CELLS characters, not terminated
+///
+////////////////////////////////////////////////////////////////////////////////
+
+const char * DISPGetShadow(void)
+{
+	return dispshadow;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// DISPTask
+///
+/// Main task for the display module. The states only draw into the shadow
+/// buffer; the flush at the end of every pass gets it onto the LCD.
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: none (context is null)
+/// @return: none
+///
+////////////////////////////////////////////////////////////////////////////////
+
+void DISPTask(void * context)
+{
+	PRF_SCOPE(PRF_TASK_DISPLAY);
+
+	switch(state) {
+
+		case DISPSTATE_REFSH:
+			// Only redrawn when a value has changed, and even then only
+			// the cells that differ go to the LCD.
+			if(redraw) {
+				DISPRenderRPS();
+				redraw=0;
+			}
+			break;
+
+		case DISPSTATE_IDLE:
+		case DISPSTATE_UPDATING:	
+		  // do nothing. We only update when messages arrive asking us to.
+			break;
+
+		case DISPSTATE_VALIDATE:
+		    //Checks if EnteredRPS is valid
+		    //EnteredRPS is valid if it is within RPS_MIN and RPS_MAX and is not equal to zero
+			  if(EnteredRPS > RPS_MAX || (EnteredRPS < RPS_MIN && (EnteredRPS != 0))){
+			    TMRArm(disperrtimer,DISP_ERROR_MS);                 // starts the error timer of 2sec if the above two conditions are met
+          DISPPutStrP(2,1,PSTR("INVALID RPS"));					// displays an error message, showing the invalidity of the EnteredRPS
+			    state=DISPSTATE_ERROR;                              // change state to DISPSTATE_ERROR
+			    }
+        else {MsgPost(MSGKEYPADRPS{EnteredRPS});
+          DISPClear();
+          redraw=1;
+          state=DISPSTATE_REFSH;
+          }
+			break;
+
+		case DISPSTATE_ERROR:		
+		  if(TMRIsExpired(disperrtimer)) {                      //checks if the error timer is expired
+        char tem[FMT_UNSIGNED_LEN];
+        DISPClear();                                        //clears display
+        FMTUnsigned(tem,EnteredRPS,3);                      //saves the enteredRPS, 3 digits zero padded, into 'tem' variable
+        DISPPutStrP(0,0,PSTR("RE-SET:"));                   //prints "RE-SET"
+        DISPPutStr(9,0,tem);                                //displays the EnteredRPS value
+        DISPSetCursor(9,0);                                 //place the cursor at the first number of the EnteredRPS
+       
+				state=DISPSTATE_UPDATING;                           // Return to updating state in hope that a valid Demand RPM may be entered
+      }
+		  break;
+
+		case DISPSTATE_TUNING:
+			// The tuner's messages draw the screen. Once the outcome has
+			// been up for long enough, go back to the RPS screen.
+			if(TMRIsExpired(disperrtimer)) {
+				DISPClear();
+				redraw=1;
+				state=DISPSTATE_REFSH;
+			}
+			break;
+
+		// a catch-all, we should never get here.
+		default: 					
+		  state=DISPSTATE_IDLE;
+			break;
+	}
+
+	DISPFlush();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// DISPUpdateRPM
+///
+/// Responds to messages coming in with an updated actual RPM. We
+/// check if there is any change, and if so, display it. It only reaches
+/// the screen in DISPSTATE_REFSH
+///
+/// @context: TASK
+/// @scope: INTERNAL
+/// @param: const MSGACTUALRPS & msg - the new actual RPS
+/// @return: none
+///
+////////////////////////////////////////////////////////////////////////////////
+
+void DISPUpdateRPS(const MSGACTUALRPS & msg)
+{
+	PRF_SCOPE(PRF_MESSAGES);
+
+	unsigned int newrps=msg.rps;
+
+	// The display is slow, but the shadow buffer is not. We keep the value
+	// whatever the state, and the flush only sends digits that changed.
+
+	if(newrps!=ActualRPS) {
+		ActualRPS=newrps;
+		redraw=1;
+	}
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+/// DISPUpdateDemandRPM
+///
+/// Responds to messages coming in to change the displayed demand RPM. We
+/// check if there is any change, and if so, display it. It only reaches
+/// the screen in DISPSTATE_REFSH
+///
+/// @context: TASK
+/// @scope: INTERNAL
+/// @param: const MSGDEMANDRPS & msg - the new demand RPS
+/// @return: none
+///
+////////////////////////////////////////////////////////////////////////////////
+
+void DISPUpdateDemandRPS(const MSGDEMANDRPS & msg)
+{
+	PRF_SCOPE(PRF_MESSAGES);
+
+	unsigned int newrps=msg.rps;
+
+	if(newrps!=DemandRPS) {                                   // checks if new input is same with old DemandRPS value
+		DemandRPS=newrps;                                     // update the DemandRPS value to the new input
+		redraw=1;
+	}
+}
+////////////////////////////////////////////////////////////////////////////////
+/// DISPKeyPressed
+///
+/// Someone has pressed a button. We need to read the user's value, and
+/// deal with it according to state.
+///
+/// @context:  TASK
+/// @scope: INTERNAL
+/// @param: const MSGKEYPRESSED & msg - encoded value of key pressed
+/// @return: none
+///
+////////////////////////////////////////////////////////////////////////////////
+
+void DISPKeyPressed(const MSGKEYPRESSED & msg)
+{
+	PRF_SCOPE(PRF_MESSAGES);
+
+	unsigned char keyval=msg.key;
+	static unsigned int curpos=9;
+  unsigned char old;
+	switch(state) {
+
+		case DISPSTATE_IDLE:
+		case DISPSTATE_REFSH:		// if the key is anything but a numeral, ignore it
+		   if(state==DISPSTATE_IDLE || state==DISPSTATE_REFSH){
+		    if(keyval<0x0a) {
+				  // This is the first press. Set up the display:
+				  curpos=9;
+				  FMTUnsigned(numarr,DemandRPS,3);
+    			numarr[0]=0x30+keyval;
+    			DISPClear();
+    			DISPPutStrP(0,0,PSTR("New RPS:"));
+    			DISPPutStr(curpos,0,numarr);
+    			DISPSetCursor(++curpos,0);
+          
+    			state=DISPSTATE_UPDATING;}
+		    else if(keyval==0x0a) {           // (*) starts the auto-tuner
+		      MsgPost(MSGAUTOTUNE{1});
+		    }
+		    else if(keyval==0x0b) {           // (#) runs the setpoint program
+		      MsgPost(MSGPROGRAM{1});
+		    }}
+    	  break;
+    		
+		case DISPSTATE_UPDATING:
+        if(keyval<0x0a){                    //executes if the keypad press is a number (less than 10)
+          if(curpos <12){                   //stops input from keypad if the values inputted are already 3
+            old=13;                         //resets to a dp value   
+            if(old != keyval){              //executes a new key is pressed
+              old=keyval;                   //save the current keypress in variable old
+              numarr[curpos-9]=0x30+old;    //save the keypress in ascii into the next index of the array
+              DISPPutChar(curpos,0,0x30+old); //displays the key pressed 
+              DISPSetCursor(++curpos,0);    // sets cursor in the next position awaiting input
+              }}}
+       
+        else if(keyval==0x0a && curpos!=9){ // executes if the key pressed is an (*) and the cursor isn't at the beginning of the input 
+              --curpos;            // takes the cursor back by a step
+              DISPSetCursor(curpos,0);
+              state=DISPSTATE_UPDATING;     //remains in state for figures of RPM to be set
+              break;}
+
+        if(keyval==0x0b){                   //checks if a (#) was pressed
+              DISPSetCursor(DISP_NOWHERE,0);
+              curpos=9;                     // resets cursor position variable back to first digit
+              FMTParseUnsigned(numarr,3,&EnteredRPS); //saves the new RPS value into EnteredRPS, to be validated in the next state
+              state=DISPSTATE_VALIDATE;       // change state to DISPSTATE_VALIDATE for validation of figure
+              break;}
+               
+              
+      // TODO: Add the code to deal with Enter (#),
+      // Backspace (*) and subsequent 0-9 keypresses.
+        
+		  break;
+
+		case DISPSTATE_TUNING:		// any key stops a run in progress
+			MsgPost(MSGAUTOTUNE{0});
+			break;
+
+		// in all other states, we take no action if a key is pressed.
+
+		default:					break;
+	
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// DISPTuneStatus
+///
+/// The auto-tuner reports progress. While it runs it has the screen; its
+/// outcome is shown for DISP_ERROR_MS, and then the RPS screen is back.
+///
+/// @context: TASK
+/// @scope: INTERNAL
+/// @param: const MSGTUNESTATUS & msg - TUNE_STATUS_...
+/// @return: none
+///
+////////////////////////////////////////////////////////////////////////////////
+
+void DISPTuneStatus(const MSGTUNESTATUS & msg)
+{
+	PRF_SCOPE(PRF_MESSAGES);
+
+	switch(msg.status) {
+
+		case TUNE_STATUS_RUNNING:
+			TMRCancel(disperrtimer);
+			DISPClear();
+			DISPPutStrP(0,0,PSTR("Auto-tune"));
+			DISPPutStrP(0,1,PSTR("running"));
+			state=DISPSTATE_TUNING;
+			break;
+
+		case TUNE_STATUS_DONE:
+			DISPPutStrP(0,1,PSTR("done   "));
+			TMRArm(disperrtimer,DISP_ERROR_MS);
+			break;
+
+		case TUNE_STATUS_FAILED:
+			DISPPutStrP(0,1,PSTR("failed "));
+			TMRArm(disperrtimer,DISP_ERROR_MS);
+			break;
+
+		default:
+			DISPPutStrP(0,1,PSTR("stopped"));
+			TMRArm(disperrtimer,DISP_ERROR_MS);
+			break;
+	}
+}
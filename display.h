@@ -15,6 +15,20 @@
 
 #define DISP_I2C_ADDR	0x3f
 
+//
+// Panel size
+
+#define DISP_COLS		16
+#define DISP_ROWS		2
+
+//
+// Most bytes (characters or cursor moves) sent to the LCD per pass of the
+// display task. Each is several blocking I2C writes through the backpack,
+// so this bounds the time the display can take from the other tasks. A full
+// screen takes about ten passes at 4.
+
+#define DISP_FLUSH_BYTES	4
+
 
 ///
 /// Exported functions
@@ -34,5 +48,21 @@
 
 void DISPInitialize(void);
 
+////////////////////////////////////////////////////////////////////////////////
+/// DISPGetShadow
+///
+/// What the display code has drawn, which the LCD will show once the
+/// flush has caught up. For diagnostics.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: none
+/// @return: const char * - DISP_ROWS rows of DISP_COLS characters, not
+///          terminated
+///
+////////////////////////////////////////////////////////////////////////////////
+
+const char * DISPGetShadow(void);
+
 
 #endif
@@ -1,92 +1,206 @@
-///////////////////////////////////////////////////////////////////////////////
-/// ENCODER.H
-///
-/// This module manages the rotary encoder. It is interrupt-driven rather
-/// than polled and provides a good demonstration of how to use the pin change
-/// interrupt to capture a real time signal
-///
-/// Dr J A Gow / Dr M A Oliver 2022
-///
-///////////////////////////////////////////////////////////////////////////////
-
-#include <Arduino.h>
-#include <kernel.h>
-#include "encoder.h"
-#include "common.h"
-
-/////////////////////////////
-/// Exported functions
-/////////////////////////////
-
-///////////////////////////////////////////////////////////////////////////////
-/// ENCInitialize
-///
-/// Initialize the rotary encoder. This function will enable the relevant
-/// pin change interrupt, so the message queue should be initialized first
-///
-/// @scope: EXPORTED
-/// @context: TASK
-/// @param: none
-/// @return: none
-///
-///////////////////////////////////////////////////////////////////////////////
-
-void ENCInitialize(void)
-{
-	// INC ENC A (on schematic) is attached to A1 -> PORTC bit 1
-	// INC ENC B (on schematic) is attached to A2 -> PORTC bit 2
-	//
-	// According to ATMega328P datasheet, PC1 -> PCINT9
-	//                                    PC2 -> PCINT10
-	//
-	// We need to enable both as inputs, but we only need to enable
-	// the pin change interrupt on one of the two, as the
-	// encoder works with relative phase.
-
-	DDRC &= ~0b00000110; // both set to inputs
-
-	// now set up the pin change ints on A1. We use pin change interrupt 0,
-	// as we will use PCINT1 later for the motor speed encoder.
-
-	PCMSK1 |= 0b00000010;	// PC9
-	PCICR  |= 0b00000010;	// enable PCI1
-
-  // Unfortunately the beam-breaker tacho shares the same PCI as the rotary
-  // encoder. So both devices will eventually share the same ISR. The ISR will
-  // have to do extra checking to work out which device raised the interrupt.
-  // This is not ideal as the ISR needs to be as lean as possible.
-}
-
-
-///////////////////////////////////////////////////////////////////////////////
-/// ISR(PCINT1_vect)
-///
-/// Interrupt Service Routine: Handles pin change 1 interrupt
-///
-/// @scope: INTERNAL
-/// @context: INTERRUPT
-/// @param: none
-/// @return: none
-///
-///////////////////////////////////////////////////////////////////////////////
-
-void ENCInterruptHandler(void)
-{
-	// This interrupt is set a change of PC9. 
-	
-	// TODO: If the state of PC1 is high we deal with this with the following:-
-  //       If the state of PC2 is high, this means anticlockwise
-  //       - so send the value -1 to the Encoder Message ID.
-  //       If the state of PC2 is low, this means clockwise
-  //       - so send the value +1 to the Encoder Message ID.
-  
-  if (PINC & 0b00000010){               // executes if PC1 is high
-    if (PINC & 0b00000100){             //post -1 to MSG_ID_ENCODER if PORTC pin 2 is HIGH (anti-clockwise) and +1 to MSG_ID_ENCODER if PORTC pin 2 is LOW (CLockwise)
-      Kernel::OS.MessageQueue.Post(MSG_ID_ENCODER, (void * )-1, Kernel::MQ_OWNER_CALLER, Kernel::MQ_CONTEXT_TASK);
-    }
-    else{
-      Kernel::OS.MessageQueue.Post(MSG_ID_ENCODER, (void * )1, Kernel::MQ_OWNER_CALLER, Kernel::MQ_CONTEXT_TASK);
-    }
-  }
-	// done. We really do need this to be as short as possible.
-}
+///////////////////////////////////////////////////////////////////////////////
+/// ENCODER.H
+///
+/// This module manages the rotary encoder. It is interrupt-driven rather
+/// than polled and provides a good demonstration of how to use the pin change
+/// interrupt to capture a real time signal
+///
+/// Both channels are decoded (x4): every edge on A or B is looked up in a
+/// transition table and moves a signed count by one, so contact bounce on
+/// one channel just counts back and forth and cancels. The ISR only
+/// accumulates; the control task drains whole detents once per pass.
+///
+/// Dr J A Gow / Dr M A Oliver 2022
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#include <Arduino.h>
+#include <kernel.h>
+#include "encoder.h"
+#include "common.h"
+#include "pinchange.h"
+
+//
+// Transition table, indexed by (previous state << 2) | new state, where the
+// state is (A << 1) | B. Clockwise, A leads: 00 -> 10 -> 11 -> 01 -> 00.
+// Both channels changing at once is impossible from a real encoder - an edge
+// was missed - so it is counted and ignored.
+
+#define ENC_ILLEGAL		2
+
+static const signed char enctable[16]={
+	0,				-1,				1,				ENC_ILLEGAL,	// from 00
+	1,				0,				ENC_ILLEGAL,	-1,				// from 01
+	-1,				ENC_ILLEGAL,	0,				1,				// from 10
+	ENC_ILLEGAL,	1,				-1,				0				// from 11
+};
+
+//
+// Acceleration. If the detents drained in a pass came in quicker than
+// 'ms' apart each, each one counts as 'steps'. Fastest first.
+
+typedef struct _ENCACCEL {
+
+	unsigned char	ms;
+	unsigned char	steps;
+
+} ENCACCEL;
+
+static const ENCACCEL encaccel[]={
+	{ 15, 10 },
+	{ 40, 4 },
+	{ 80, 2 }
+};
+
+#define ENC_NACCEL	(sizeof(encaccel)/sizeof(encaccel[0]))
+
+//
+// Module variables. Those marked volatile are shared with the ISR.
+
+static unsigned char encstate=0;			// last (A << 1) | B, ISR only
+static volatile int enccount=0;				// counts not yet drained
+static volatile unsigned int encillegal=0;	// impossible transitions seen
+static unsigned long enclastmove=0;			// millis() of the last drained detent
+
+//
+// State of the two channels, A on PC1 and B on PC2
+
+#define ENC_STATE(pins)		(((pins)&0b00000010)|(((pins)>>2)&0b00000001))
+
+/////////////////////////////
+/// Exported functions
+/////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// ENCInitialize
+///
+/// Initialize the rotary encoder. This function will enable the relevant
+/// pin change interrupt
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: none
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void ENCInitialize(void)
+{
+	// INC ENC A (on schematic) is attached to A1 -> PORTC bit 1
+	// INC ENC B (on schematic) is attached to A2 -> PORTC bit 2
+	//
+	// According to ATMega328P datasheet, PC1 -> PCINT9
+	//                                    PC2 -> PCINT10
+	//
+	// Both are inputs, and both raise the pin change interrupt: the
+	// quadrature decoder needs to see every edge on either channel.
+
+	DDRC &= ~0b00000110; // both set to inputs
+
+	encstate=ENC_STATE(PINC);
+	enccount=0;
+	encillegal=0;
+	enclastmove=millis();
+
+	// The beam-breaker tacho shares the same PCI as the rotary encoder.
+	// The pin change ISR sorts out which edges are ours, and tests the
+	// tacho's first, so the encoder only adds to its latency when it
+	// moves.
+
+	PINAddHandler(0b00000110,PIN_EDGE_BOTH,ENCInterruptHandler);	// PCINT9 and PCINT10
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// ENCGetSteps
+///
+/// Drain the whole detents counted since the last call and return them,
+/// scaled up if the knob is being spun quickly. Counts short of a detent
+/// are kept for next time.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: none
+/// @return: int - signed steps, positive clockwise. Zero if no movement
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int ENCGetSteps(void)
+{
+	unsigned char sreg=SREG;
+	unsigned long now;
+	unsigned long interval;
+	int detents;
+
+	cli();
+	detents=enccount/ENC_COUNTS_PER_DETENT;
+	enccount-=detents*ENC_COUNTS_PER_DETENT;
+	SREG=sreg;
+
+	if(!detents) {
+		return 0;
+	}
+
+	// Time per detent since the last movement, for the acceleration
+
+	now=millis();
+	interval=(now-enclastmove)/(detents<0?-detents:detents);
+	enclastmove=now;
+
+	for(unsigned char idx=0;idx<ENC_NACCEL;idx++) {
+		if(interval<encaccel[idx].ms) {
+			return detents*encaccel[idx].steps;
+		}
+	}
+	return detents;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// ENCGetIllegal
+///
+/// Diagnostics: the number of impossible transitions (both channels changed
+/// between interrupts) seen since initialization
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: none
+/// @return: unsigned int - count
+///
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned int ENCGetIllegal(void)
+{
+	unsigned char sreg=SREG;
+	unsigned int count;
+
+	cli();
+	count=encillegal;
+	SREG=sreg;
+	return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// ENCInterruptHandler
+///
+/// Called from the pin change ISR when either encoder channel changes.
+/// One table lookup and an add.
+///
+/// @scope: EXPORTED
+/// @context: INTERRUPT
+/// @param: unsigned char pins - PINC as sampled by the ISR
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void ENCInterruptHandler(unsigned char pins)
+{
+	unsigned char state=ENC_STATE(pins);
+	signed char move=enctable[(encstate<<2)|state];
+
+	encstate=state;
+	if(move==ENC_ILLEGAL) {
+		encillegal++;
+	} else {
+		enccount+=move;
+	}
+	// done. We really do need this to be as short as possible.
+}
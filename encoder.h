@@ -1,36 +1,71 @@
-///////////////////////////////////////////////////////////////////////////////
-/// ENCODER.H
-///
-/// This module manages the rotary encoder. It is interrupt-driven rather
-/// than polled and provides a good demonstration of how to use the pin change
-/// interrupt to capture a real time signal
-///
-/// Dr J A Gow 2022
-///
-///////////////////////////////////////////////////////////////////////////////
-
-#ifndef ENCODER_H_
-#define ENCODER_H_
-
-/////////////////////////////
-/// Exported functions
-/////////////////////////////
-
-///////////////////////////////////////////////////////////////////////////////
-/// ENCInitialize
-///
-/// Initialize the rotary encoder. This function will enable the relevant
-/// pin change interrupt, so the message queue should be initialized first
-///
-/// @scope: EXPORTED
-/// @context: TASK
-/// @param: none
-/// @return: none
-///
-///////////////////////////////////////////////////////////////////////////////
-
-void ENCInitialize(void);
-void ENCInterruptHandler(void);
-
-
-#endif
+///////////////////////////////////////////////////////////////////////////////
+/// ENCODER.H
+///
+/// This module manages the rotary encoder. It is interrupt-driven rather
+/// than polled and provides a good demonstration of how to use the pin change
+/// interrupt to capture a real time signal
+///
+/// Dr J A Gow 2022
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef ENCODER_H_
+#define ENCODER_H_
+
+//
+// Quadrature counts (edges on A and B) per mechanical detent
+
+#define ENC_COUNTS_PER_DETENT	4
+
+/////////////////////////////
+/// Exported functions
+/////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// ENCInitialize
+///
+/// Initialize the rotary encoder. This function will enable the relevant
+/// pin change interrupt
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: none
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void ENCInitialize(void);
+
+///////////////////////////////////////////////////////////////////////////////
+/// ENCGetSteps
+///
+/// Drain the whole detents counted since the last call, scaled up if the
+/// knob is being spun quickly
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: none
+/// @return: int - signed steps, positive clockwise. Zero if no movement
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int ENCGetSteps(void);
+
+///////////////////////////////////////////////////////////////////////////////
+/// ENCGetIllegal
+///
+/// Number of impossible transitions seen since initialization
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: none
+/// @return: unsigned int - count
+///
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned int ENCGetIllegal(void);
+
+void ENCInterruptHandler(unsigned char pins);
+
+
+#endif
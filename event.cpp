@@ -0,0 +1,177 @@
+///////////////////////////////////////////////////////////////////////////////
+/// EVENT.CPP
+///
+/// Interrupt to task event ring. See event.h.
+///
+/// evthead and evttail run freely over 0..255 and are masked on use, so
+/// full and empty are told apart without wasting a slot. evthead is only
+/// written by the producer (interrupt side) and evttail only by the pump,
+/// and each is a single byte, so neither side needs to mask interrupts.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#include <Arduino.h>
+#include <kernel.h>
+#include "event.h"
+#include "prf.h"
+
+#define EVT_MASK		(EVT_QUEUE_LEN-1)
+
+//
+// Module variables. The ring contents are volatile so the compiler cannot
+// move the stores to an event past the store to evthead that publishes it.
+
+typedef struct _EVENT {
+
+	EVTDELIVER		deliver;
+	unsigned char	payload[EVT_PAYLOAD_LEN];
+
+} EVENT;
+
+static volatile EVENT ring[EVT_QUEUE_LEN];
+static volatile unsigned char evthead=0;
+static volatile unsigned char evttail=0;
+static volatile unsigned int evtoverflows=0;	// written by the producer only
+static unsigned char evthighwater=0;
+
+void EVTTask(void * context);
+
+/////////////////////////////
+/// Exported functions
+/////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// EVTInitialize
+///
+/// Empty the ring and register the pump task
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void EVTInitialize(void)
+{
+	evthead=evttail=0;
+	evtoverflows=0;
+	evthighwater=0;
+
+	Kernel::OS.TaskManager.RegisterTaskHandler(EVTTask,(void *)NULL);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// EVTQueue
+///
+/// Queue an event. This is the whole of the interrupt side cost: a compare,
+/// a few stores and the index update.
+///
+/// @scope: EXPORTED
+/// @context: INTERRUPT
+/// @param: EVTDELIVER deliver - called from the pump with the payload
+/// @param: const unsigned char * payload - copied into the ring
+/// @param: unsigned char len - payload bytes, at most EVT_PAYLOAD_LEN
+/// @return: int - zero if queued, -1 if dropped
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int EVTQueue(EVTDELIVER deliver, const unsigned char * payload, unsigned char len)
+{
+	unsigned char head=evthead;
+	volatile EVENT * evt=&ring[head&EVT_MASK];
+
+	if((unsigned char)(head-evttail)>=EVT_QUEUE_LEN) {
+		evtoverflows++;
+		return -1;
+	}
+	evt->deliver=deliver;
+	while(len--) {
+		evt->payload[len]=payload[len];
+	}
+	evthead=head+1;		// publish
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// EVTTask
+///
+/// The pump. Everything queued when the pass starts is posted to the bus in
+/// order. Each event is copied out and its slot freed before it is
+/// delivered, so a subscriber that takes a while does not hold the ring.
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: void * context - unused
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void EVTTask(void * context)
+{
+	PRF_SCOPE(PRF_TASK_EVENT);
+
+	unsigned char tail=evttail;
+	unsigned char head=evthead;
+	unsigned char depth=head-tail;
+
+	if(depth>evthighwater) {
+		evthighwater=depth;
+	}
+
+	while(tail!=head) {
+		volatile EVENT * evt=&ring[tail&EVT_MASK];
+		unsigned char payload[EVT_PAYLOAD_LEN];
+		EVTDELIVER deliver=evt->deliver;
+
+		for(unsigned char idx=0;idx<EVT_PAYLOAD_LEN;idx++) {
+			payload[idx]=evt->payload[idx];
+		}
+		tail++;
+		evttail=tail;	// slot is free once the event has been copied out
+
+		deliver(payload);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// EVTGetOverflows
+///
+/// Events dropped since initialization because the ring was full
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: NONE
+/// @return: unsigned int - count
+///
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned int EVTGetOverflows(void)
+{
+	unsigned char sreg=SREG;
+	unsigned int count;
+
+	// Two bytes, written from interrupt context
+
+	cli();
+	count=evtoverflows;
+	SREG=sreg;
+	return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// EVTGetHighWater
+///
+/// The deepest the ring has been at the start of a pump pass
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: NONE
+/// @return: unsigned char - number of events
+///
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned char EVTGetHighWater(void)
+{
+	return evthighwater;
+}
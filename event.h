@@ -0,0 +1,126 @@
+///////////////////////////////////////////////////////////////////////////////
+/// EVENT.H
+///
+/// Interrupt to task event ring. The message bus (msgbus.h) delivers in
+/// the poster's context, so an interrupt handler can not post to it. ISRs
+/// post a message here instead, which is a couple of stores and no
+/// interrupt masking, and a task pumps the ring, posting each message to
+/// the bus in order. A topic posted this way is routed in topics.h like
+/// any other, and its subscribers run in task context.
+///
+/// EVTPost is typed just as MsgPost is: the ring holds each message's
+/// payload with the delivery function for its topic, so posting a topic
+/// with no route, or one too big for the ring, is a compile error.
+///
+/// The ring is single producer, single consumer. The AVR does not nest
+/// interrupts, so all ISRs together count as the one producer - as long as
+/// none of them re-enables interrupts (ISR_NOBLOCK). The pump task is the
+/// only consumer.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _EVENT_H_
+#define _EVENT_H_
+
+#include <string.h>
+#include "msgbus.h"
+
+//
+// Ring capacity. This must be a power of two no greater than 128, so the
+// free running 8 bit indices wrap cleanly. One event is the delivery
+// function and EVT_PAYLOAD_LEN bytes of payload, 4 bytes of RAM.
+
+#define EVT_QUEUE_LEN		16
+#define EVT_PAYLOAD_LEN		2
+
+#if (EVT_QUEUE_LEN & (EVT_QUEUE_LEN-1)) || EVT_QUEUE_LEN>128
+#error EVT_QUEUE_LEN must be a power of two no greater than 128
+#endif
+
+//
+// Exported functions
+
+///////////////////////////////////////////////////////////////////////////////
+/// EVTInitialize
+///
+/// Empty the ring and register the pump task. Call this before anything
+/// that enables an interrupt which posts events.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void EVTInitialize(void);
+
+//
+// Delivers one topic's payload, copied out of the ring, to the bus
+
+typedef void (*EVTDELIVER)(const unsigned char * payload);
+
+///////////////////////////////////////////////////////////////////////////////
+/// EVTQueue
+///
+/// Queue a payload and the function that delivers it. Use EVTPost, which
+/// supplies both for a topic.
+///
+/// @scope: EXPORTED
+/// @context: INTERRUPT
+/// @param: EVTDELIVER deliver - called from the pump with the payload
+/// @param: const unsigned char * payload - copied into the ring
+/// @param: unsigned char len - payload bytes, at most EVT_PAYLOAD_LEN
+/// @return: int - zero if queued, -1 if dropped
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int EVTQueue(EVTDELIVER deliver, const unsigned char * payload, unsigned char len);
+
+template<typename T>
+static void EVTDeliver(const unsigned char * payload)
+{
+	T msg;
+
+	memcpy(&msg,payload,sizeof(T));
+	MsgPost(msg);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// EVTPost
+///
+/// Queue a message for delivery to the subscribers of its topic, from the
+/// pump task. If the ring is full the message is dropped and counted.
+///
+/// @scope: EXPORTED
+/// @context: INTERRUPT
+/// @param: const T & msg - the message, of a routed topic (topics.h)
+/// @return: int - zero if queued, -1 if dropped
+///
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+static inline int EVTPost(const T & msg)
+{
+	static_assert(sizeof(T)<=EVT_PAYLOAD_LEN,"payload too big for the event ring");
+
+	return EVTQueue(EVTDeliver<T>,(const unsigned char *)&msg,sizeof(T));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// EVTGetOverflows / EVTGetHighWater
+///
+/// Diagnostics: the number of events dropped because the ring was full, and
+/// the deepest the ring has been seen by the pump.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: NONE
+/// @return: unsigned int / unsigned char
+///
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned int EVTGetOverflows(void);
+unsigned char EVTGetHighWater(void);
+
+#endif
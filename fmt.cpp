@@ -0,0 +1,190 @@
+///////////////////////////////////////////////////////////////////////////////
+/// FMT.CPP
+///
+/// Small integer formatting and parsing. See fmt.h.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#include <Arduino.h>
+#include "fmt.h"
+
+//
+// Powers of ten, worked out by the compiler and kept in flash. An unsigned
+// int has at most FMT_MAX_DIGITS digits; the last entry (1) is only used
+// to scale fractions.
+
+#define FMT_MAX_DIGITS	5
+
+static constexpr unsigned int FMTPow10(unsigned char n)
+{
+	return n?10*FMTPow10(n-1):1;
+}
+
+static constexpr unsigned int fmtpow10[FMT_MAX_DIGITS] PROGMEM={
+	FMTPow10(4), FMTPow10(3), FMTPow10(2), FMTPow10(1), FMTPow10(0)
+};
+
+static_assert(FMTPow10(4)==10000,"power of ten table");
+
+#define FMT_POW10(n)	((unsigned int)pgm_read_word(&fmtpow10[FMT_MAX_DIGITS-1-(n)]))
+
+/////////////////////////////
+/// Exported functions
+/////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// FMTUnsigned
+///
+/// Write an unsigned number, zero padded. Each digit is found by counting
+/// subtractions of its power of ten: at most nine 16 bit subtracts per
+/// digit, where a divide by ten costs some 200 cycles on the AVR.
+///
+/// @scope: EXPORTED
+/// @context: ANY
+/// @param: char * buf - destination
+/// @param: unsigned int value - number to write
+/// @param: unsigned char width - minimum width
+/// @return: unsigned char - characters written, not counting the terminator
+///
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned char FMTUnsigned(char * buf, unsigned int value, unsigned char width)
+{
+	char * p=buf;
+	unsigned char started=0;
+
+	while(width>FMT_MAX_DIGITS) {
+		*p++='0';
+		width--;
+	}
+
+	for(unsigned char idx=0;idx<FMT_MAX_DIGITS-1;idx++) {
+		unsigned int pow=pgm_read_word(&fmtpow10[idx]);
+		char digit='0';
+
+		while(value>=pow) {
+			value-=pow;
+			digit++;
+		}
+		if(started || digit!='0' || width>=FMT_MAX_DIGITS-idx) {
+			*p++=digit;
+			started=1;
+		}
+	}
+	*p++='0'+value;		// units, always written
+	*p=0;
+	return p-buf;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// FMTSigned
+///
+/// Write a signed number, zero padded after the sign
+///
+/// @scope: EXPORTED
+/// @context: ANY
+/// @param: char * buf - destination
+/// @param: int value - number to write
+/// @param: unsigned char width - minimum width, including any sign
+/// @return: unsigned char - characters written, not counting the terminator
+///
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned char FMTSigned(char * buf, int value, unsigned char width)
+{
+	if(value>=0) {
+		return FMTUnsigned(buf,value,width);
+	}
+	*buf='-';
+	return 1+FMTUnsigned(buf+1,0u-(unsigned int)value,width?width-1:0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// FMTFixed
+///
+/// Write a fixed point number. The fraction bits are scaled to the number
+/// of decimal places wanted and rounded, carrying into the integer part if
+/// they round up to a whole unit.
+///
+/// @scope: EXPORTED
+/// @context: ANY
+/// @param: char * buf - destination
+/// @param: long value - the fixed point number
+/// @param: unsigned char frac - fraction bits in value
+/// @param: unsigned char decimals - decimal places to show
+/// @param: unsigned char width - minimum width of the integer part
+/// @return: unsigned char - characters written, not counting the terminator
+///
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned char FMTFixed(char * buf, long value, unsigned char frac, unsigned char decimals, unsigned char width)
+{
+	unsigned long mag=(value<0)?0ul-(unsigned long)value:(unsigned long)value;
+	unsigned int ipart=(unsigned int)(mag>>frac);
+	unsigned int fpart=0;
+	char * p=buf;
+
+	if(decimals>FMT_MAX_DIGITS-1) {
+		decimals=FMT_MAX_DIGITS-1;
+	}
+
+	// Fraction bits to decimal places, rounded. At most 16 bits times
+	// 10000, so this fits in 32 bits.
+
+	if(frac) {
+		unsigned long f=(mag&((1ul<<frac)-1))*FMT_POW10(decimals);
+
+		fpart=(unsigned int)((f+(1ul<<(frac-1)))>>frac);
+		if(fpart>=FMT_POW10(decimals)) {
+			fpart-=FMT_POW10(decimals);
+			ipart++;
+		}
+	}
+
+	// No sign on a value that rounds to zero
+
+	if(value<0 && (ipart || fpart)) {
+		*p++='-';
+		if(width) {
+			width--;
+		}
+	}
+	p+=FMTUnsigned(p,ipart,width);
+	if(decimals) {
+		*p++='.';
+		p+=FMTUnsigned(p,fpart,decimals);
+	}
+	return p-buf;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// FMTParseUnsigned
+///
+/// Read decimal digits, saturating at 65535
+///
+/// @scope: EXPORTED
+/// @context: ANY
+/// @param: const char * str - digits
+/// @param: unsigned char maxdigits - stop after this many
+/// @param: unsigned int * value - receives the number (0 if no digits)
+/// @return: unsigned char - number of digits read
+///
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned char FMTParseUnsigned(const char * str, unsigned char maxdigits, unsigned int * value)
+{
+	unsigned int v=0;
+	unsigned char n=0;
+
+	while(n<maxdigits && str[n]>='0' && str[n]<='9') {
+		unsigned char digit=str[n++]-'0';
+
+		if(v>6553 || (v==6553 && digit>5)) {
+			v=65535;
+		} else {
+			v=v*10+digit;
+		}
+	}
+	*value=v;
+	return n;
+}
@@ -0,0 +1,97 @@
+///////////////////////////////////////////////////////////////////////////////
+/// FMT.H
+///
+/// Small integer formatting and parsing, for the display, keypad and serial
+/// output. This replaces sprintf/sscanf, which pull the whole avr-libc
+/// printf/scanf machinery into flash, and divide by ten for every digit.
+/// Digits here are found by subtracting powers of ten, held in a table in
+/// flash, so there is no division at all.
+///
+/// Estimated cost against the sprintf("%3.3d")/sscanf("%d") calls it
+/// replaced in display.cpp (ATmega328P, avr-libc defaults, not measured on
+/// the bench):
+///
+///                          sprintf/sscanf       FMT
+///   flash                  ~3.4k (vfprintf,     ~300 bytes
+///                          vfscanf, udivmod)
+///   stack                  ~60 bytes            ~8 bytes
+///   3 digit number         ~1800 cycles         ~120 cycles
+///   parse 3 digits         ~1200 cycles         ~60 cycles
+///
+/// None of the functions allocate. Output is always terminated; the buffer
+/// sizes needed are given below.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _FMT_H_
+#define _FMT_H_
+
+//
+// Buffer sizes, including the terminator, that will hold any value with
+// the default (minimum) width
+
+#define FMT_UNSIGNED_LEN	6		// 65535
+#define FMT_SIGNED_LEN		7		// -32768
+
+//
+// Exported functions
+
+///////////////////////////////////////////////////////////////////////////////
+/// FMTUnsigned / FMTSigned
+///
+/// Write a number in decimal, zero padded to at least 'width' characters
+/// (as printf's "%0*u" and "%0*d"; the sign counts toward the width). A
+/// width of zero or one gives no padding. Wider numbers are written in
+/// full, never truncated.
+///
+/// @scope: EXPORTED
+/// @context: ANY
+/// @param: char * buf - destination, at least max(width+1, FMT_*_LEN)
+/// @param: value - number to write
+/// @param: unsigned char width - minimum width
+/// @return: unsigned char - characters written, not counting the terminator
+///
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned char FMTUnsigned(char * buf, unsigned int value, unsigned char width);
+unsigned char FMTSigned(char * buf, int value, unsigned char width);
+
+///////////////////////////////////////////////////////////////////////////////
+/// FMTFixed
+///
+/// Write a signed fixed point number with 'frac' fraction bits (the Q11.4
+/// speeds in control.h, say) as decimal, rounded to 'decimals' places. The
+/// integer part is zero padded to 'width' as FMTSigned, and must fit in an
+/// int.
+///
+/// @scope: EXPORTED
+/// @context: ANY
+/// @param: char * buf - destination, FMT_SIGNED_LEN+decimals+1 is enough
+/// @param: long value - the fixed point number
+/// @param: unsigned char frac - fraction bits in value, up to 16
+/// @param: unsigned char decimals - decimal places to show, up to 4
+/// @param: unsigned char width - minimum width of the integer part
+/// @return: unsigned char - characters written, not counting the terminator
+///
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned char FMTFixed(char * buf, long value, unsigned char frac, unsigned char decimals, unsigned char width);
+
+///////////////////////////////////////////////////////////////////////////////
+/// FMTParseUnsigned
+///
+/// Read up to 'maxdigits' decimal digits from the start of a string. Leading
+/// spaces are not skipped. A value that would pass 65535 saturates there.
+///
+/// @scope: EXPORTED
+/// @context: ANY
+/// @param: const char * str - digits
+/// @param: unsigned char maxdigits - stop after this many
+/// @param: unsigned int * value - receives the number (0 if no digits)
+/// @return: unsigned char - number of digits read
+///
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned char FMTParseUnsigned(const char * str, unsigned char maxdigits, unsigned int * value);
+
+#endif
@@ -0,0 +1,39 @@
+///////////////////////////////////////////////////////////////////////////////
+/// ARDUINO.H
+///
+/// Host build stand-in for the parts of the Arduino core the firmware uses.
+/// Registers come from the HAL shim; time comes from simulated cycles.
+///
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef ARDUINO_H_
+#define ARDUINO_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "hal.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define LOW		0
+#define HIGH	1
+
+//
+// Flash is ordinary memory here. The reads go through the pointer's own
+// type: an unsigned int table is 32 bits on the host, and reading it
+// through a uint16_t pointer would break the aliasing rules.
+
+#define PROGMEM
+#define pgm_read_byte(addr)	((uint8_t)*(addr))
+#define pgm_read_word(addr)	((uint16_t)*(addr))
+#define PSTR(str)	(str)
+#define F(str)	(str)
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+#endif
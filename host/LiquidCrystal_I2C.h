@@ -0,0 +1,78 @@
+///////////////////////////////////////////////////////////////////////////////
+/// LIQUIDCRYSTAL_I2C.H
+///
+/// Host build stand-in for the LCD library. It models what the display
+/// module relies on of the HD44780 behind the backpack: the display RAM,
+/// which for a two line panel is two rows of 40 cells of which the first
+/// 'cols' are shown, and the address counter, which setCursor loads and
+/// each character written steps on by one. Running off the end of the
+/// first row's 40 cells carries on at the start of the second, as the
+/// controller does.
+///
+/// Nothing reaches the terminal. The host can read back what the panel
+/// shows with cell(), and how many bytes were sent with dataBytes() and
+/// commandBytes(); each is one byte to the controller, which the backpack
+/// sends as several I2C writes.
+///
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef LIQUIDCRYSTAL_I2C_H_
+#define LIQUIDCRYSTAL_I2C_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define LCD_ROW_CELLS	40		// display RAM per row in two line mode
+#define LCD_MAX_ROWS	2
+
+class LiquidCrystal_I2C
+{
+public:
+	LiquidCrystal_I2C(uint8_t addr, uint8_t cols, uint8_t rows) : ncols(cols), addr(0), ndata(0), ncmds(0)
+	{
+		memset(ram,' ',sizeof(ram));
+	}
+
+	void init(void) { clear(); }
+	void backlight(void) {}
+	void clear(void) { memset(ram,' ',sizeof(ram)); addr=0; ncmds++; }
+	void setCursor(uint8_t col, uint8_t row) { addr=(row%LCD_MAX_ROWS)*LCD_ROW_CELLS+col%LCD_ROW_CELLS; ncmds++; }
+	void cursor(void) { ncmds++; }
+	void noCursor(void) { ncmds++; }
+	void blink(void) { ncmds++; }
+	void noBlink(void) { ncmds++; }
+
+	size_t write(uint8_t ch)
+	{
+		ram[addr]=(char)ch;
+		addr=(addr+1)%sizeof(ram);
+		ndata++;
+		return 1;
+	}
+
+	size_t print(const char * str)
+	{
+		size_t n=0;
+
+		while(*str) {
+			n+=write((uint8_t)*str++);
+		}
+		return n;
+	}
+
+	// Host only
+
+	char cell(uint8_t col, uint8_t row) const { return (col<ncols && row<LCD_MAX_ROWS)?ram[row*LCD_ROW_CELLS+col]:' '; }
+	unsigned long dataBytes(void) const { return ndata; }
+	unsigned long commandBytes(void) const { return ncmds; }
+
+private:
+	uint8_t ncols;
+	char ram[LCD_MAX_ROWS*LCD_ROW_CELLS];
+	unsigned int addr;
+	unsigned long ndata;
+	unsigned long ncmds;
+};
+
+#endif
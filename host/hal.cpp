@@ -0,0 +1,626 @@
+///////////////////////////////////////////////////////////////////////////////
+/// HAL.CPP
+///
+/// Register-level hardware shim for the host (Linux) build. See hal.h.
+///
+/// Timing is event driven: HALAdvance jumps straight to the next timer
+/// compare match (or the end of the character on the serial line) rather
+/// than clocking every cycle, so long simulated runs are cheap. TWI
+/// transfers complete instantly (no bus time is modelled).
+///
+//////////////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+#include <time.h>
+#include "hal.h"
+
+//
+// The registers
+
+HALReg8 SREG;
+HALReg8 PINB, DDRB, PORTB;
+HALReg8 PINC, DDRC, PORTC;
+HALReg8 PIND, DDRD, PORTD;
+HALReg8 PCICR, PCIFR, PCMSK0, PCMSK1, PCMSK2;
+HALReg8 TCCR0A, TCCR0B, TCNT0, OCR0A, OCR0B, TIMSK0, TIFR0;
+HALReg8 TCCR1A, TCCR1B, TCCR1C, TIMSK1, TIFR1;
+HALReg16 TCNT1, OCR1A, OCR1B, ICR1;
+HALReg8 TCCR2A, TCCR2B, TCNT2, OCR2A, OCR2B, TIMSK2, TIFR2;
+HALReg8 TWBR, TWSR, TWCR, TWDR, TWAR;
+HALReg8 SPCR, SPSR, SPDR;
+HALReg8 UCSR0A, UCSR0B, UCSR0C, UBRR0L, UBRR0H, UDR0;
+
+//
+// Model state
+
+#define HAL_MAX_TWI_DEVICES	4
+
+typedef enum _HALTWISTATE {
+
+	HAL_TWI_IDLE,
+	HAL_TWI_ADDR,
+	HAL_TWI_WRITE,
+	HAL_TWI_READ,
+	HAL_TWI_NACKED
+
+} HALTWISTATE;
+
+static unsigned long long cycles=0;		// simulated time
+static unsigned long t1rem=0;			// cycles into the current Timer1 tick
+static unsigned long t2rem=0;			// cycles into the current Timer2 tick
+static int sreg_i=0;				// global interrupt enable
+static int inservice=0;				// HALService re-entry guard
+
+static const HALTWIDEVICE * twidevs[HAL_MAX_TWI_DEVICES];
+static const HALTWIDEVICE * twicur=0;
+static HALTWISTATE twistate=HAL_TWI_IDLE;
+static unsigned char twistatus=0xf8;
+
+static void (*uartsink)(unsigned char c)=0;
+static int uartrxfull=0;
+static unsigned long long uarttxready=0;	// when UDR0 is next empty
+
+static HALVECSTATS vecstats[HAL_VEC_COUNT];
+
+static void HALService(void);
+
+///////////////////////////////////////////////////////////////////////////////
+/// HALTimer1Prescale
+///
+/// Return the Timer1 clock divider selected by CS12:0, or zero if stopped.
+/// External clocking is not modelled.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static unsigned long HALTimer1Prescale(void)
+{
+	static const unsigned long presc[8]={0,1,8,64,256,1024,0,0};
+
+	return presc[TCCR1B.val&0x07];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// HALTimer1TicksToMatch
+///
+/// Number of Timer1 ticks until OCF1A is next set. As on the part, the flag
+/// is set on the tick after TCNT1 equals OCR1A: in CTC mode the same tick
+/// that clears the counter. Otherwise the counter wraps at 0xffff.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static unsigned long HALTimer1TicksToMatch(void)
+{
+	unsigned long cnt=TCNT1.val;
+
+	if(cnt<=OCR1A.val) {
+		return OCR1A.val-cnt+1;
+	}
+	// past the compare value - wrap at 0xffff first
+	return (0xffff-cnt)+1+OCR1A.val+1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// HALTimer1Advance
+///
+/// Clock Timer1 by the given number of ticks, setting OCF1A (and in CTC
+/// mode clearing the counter) on the tick after a match. The caller never
+/// advances past the first such tick.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void HALTimer1Advance(unsigned long ticks)
+{
+	unsigned long tomatch=HALTimer1TicksToMatch();
+
+	if(ticks<tomatch) {
+		TCNT1.val=(uint16_t)(TCNT1.val+ticks);
+		return;
+	}
+	TIFR1.val|=(1<<OCF1A);
+	if(TCCR1B.val&(1<<WGM12)) {
+		TCNT1.val=(uint16_t)(ticks-tomatch);
+	} else {
+		TCNT1.val=(uint16_t)(TCNT1.val+ticks);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// HALTimer2Prescale / HALTimer2TicksToMatch / HALTimer2Advance
+///
+/// The same for Timer2, which is 8 bit and has its own prescaler choices.
+/// Only normal and CTC (WGM21) modes are modelled.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static unsigned long HALTimer2Prescale(void)
+{
+	static const unsigned long presc[8]={0,1,8,32,64,128,256,1024};
+
+	return presc[TCCR2B.val&0x07];
+}
+
+static unsigned long HALTimer2TicksToMatch(void)
+{
+	unsigned long cnt=TCNT2.val;
+
+	if(cnt<=OCR2A.val) {
+		return OCR2A.val-cnt+1;
+	}
+	return (0xff-cnt)+1+OCR2A.val+1;
+}
+
+static void HALTimer2Advance(unsigned long ticks)
+{
+	unsigned long tomatch=HALTimer2TicksToMatch();
+
+	if(ticks<tomatch) {
+		TCNT2.val=(uint8_t)(TCNT2.val+ticks);
+		return;
+	}
+	TIFR2.val|=(1<<OCF2A);
+	if(TCCR2A.val&(1<<WGM21)) {
+		TCNT2.val=(uint8_t)(ticks-tomatch);
+	} else {
+		TCNT2.val=(uint8_t)(TCNT2.val+ticks);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// HALTimer0CyclesToMatchB
+///
+/// CPU cycles until Timer0 next reaches OCR0B. Timer0 is not clocked like
+/// the others: it is free running at /64 from time zero (HALReadTCNT0), so
+/// the match is at a fixed phase in each 256 tick period.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#define HAL_T0_PERIOD	(256UL*64)
+
+static unsigned long HALTimer0CyclesToMatchB(void)
+{
+	unsigned long phase=(unsigned long)(cycles%HAL_T0_PERIOD);
+	unsigned long match=(unsigned long)OCR0B.val*64;
+
+	return (match>phase)?match-phase:HAL_T0_PERIOD-phase+match;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// HALUartCharCycles
+///
+/// CPU cycles to send one 10 bit character at the rate set in UBRR0 and
+/// U2X0
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static unsigned long HALUartCharCycles(void)
+{
+	unsigned long ubrr=((unsigned long)(UBRR0H.val&0x0f)<<8)|UBRR0L.val;
+
+	return 10*((UCSR0A.val&(1<<U2X0))?8:16)*(ubrr+1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// HALUartUDRIPending
+///
+/// Whether the data register empty interrupt is enabled and due
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static int HALUartUDRIPending(void)
+{
+	return (UCSR0B.val&(1<<UDRIE0)) && (UCSR0B.val&(1<<TXEN0)) && cycles>=uarttxready;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Register hooks
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static uint8_t HALReadTCNT0(uint8_t val)
+{
+	// The core runs Timer0 free at /64
+	return (uint8_t)(cycles/64);
+}
+
+static uint8_t HALReadSREG(uint8_t val)
+{
+	return sreg_i?(1<<SREG_I):0;
+}
+
+static void HALWriteSREG(uint8_t oldval, uint8_t newval)
+{
+	sreg_i=(newval&(1<<SREG_I))?1:0;
+	HALService();
+}
+
+static void HALWriteTCCR1B(uint8_t oldval, uint8_t newval)
+{
+	if((oldval&0x07)!=(newval&0x07)) {
+		t1rem=0;
+	}
+}
+
+static void HALWriteTCCR2B(uint8_t oldval, uint8_t newval)
+{
+	if((oldval&0x07)!=(newval&0x07)) {
+		t2rem=0;
+	}
+}
+
+static void HALWriteTIFR2(uint8_t oldval, uint8_t newval)
+{
+	TIFR2.val=oldval&~newval;
+}
+
+static void HALWriteTIFR0(uint8_t oldval, uint8_t newval)
+{
+	TIFR0.val=oldval&~newval;
+}
+
+static void HALWriteTIFR1(uint8_t oldval, uint8_t newval)
+{
+	// writing a one clears the flag
+	TIFR1.val=oldval&~newval;
+}
+
+static void HALWritePCIFR(uint8_t oldval, uint8_t newval)
+{
+	PCIFR.val=oldval&~newval;
+}
+
+static void HALWriteTIMSK(uint8_t oldval, uint8_t newval)
+{
+	// unmasking a pending flag raises the interrupt
+	HALService();
+}
+
+static uint8_t HALReadUCSR0A(uint8_t val)
+{
+	return (val&~((1<<RXC0)|(1<<FE0)|(1<<UDRE0)))|
+		((cycles>=uarttxready)?(1<<UDRE0):0)|(uartrxfull?(1<<RXC0):0);
+}
+
+static uint8_t HALReadUDR0(uint8_t val)
+{
+	uartrxfull=0;
+	return val;
+}
+
+static void HALWriteUDR0(uint8_t oldval, uint8_t newval)
+{
+	UDR0.val=oldval;				// the receive buffer is unaffected
+	if(!(UCSR0B.val&(1<<TXEN0))) {
+		return;
+	}
+	uarttxready=cycles+HALUartCharCycles();
+	if(uartsink) {
+		uartsink(newval);
+	}
+}
+
+static void HALWriteUCSR0B(uint8_t oldval, uint8_t newval)
+{
+	// enabling UDRIE0 with the data register empty raises the interrupt
+	HALService();
+}
+
+static uint8_t HALReadTWSR(uint8_t val)
+{
+	return (twistatus&0xf8)|(val&0x03);
+}
+
+static void HALWriteTWCR(uint8_t oldval, uint8_t newval)
+{
+	// TWINT is cleared by writing a one to it. Until then, nothing happens.
+
+	if(!(newval&(1<<TWINT)) || !(newval&(1<<TWEN))) {
+		TWCR.val=(newval&~(1<<TWINT))|(oldval&(1<<TWINT));
+		HALService();
+		return;
+	}
+
+	TWCR.val=newval&~((1<<TWINT)|(1<<TWSTA));
+
+	if(newval&(1<<TWSTO)) {
+		// bus released; TWSTO clears itself and TWINT is not set
+		TWCR.val&=~(1<<TWSTO);
+		twistate=HAL_TWI_IDLE;
+		twicur=0;
+		twistatus=0xf8;
+		if(!(newval&(1<<TWSTA))) {
+			return;
+		}
+		// with TWSTA as well, a START follows the STOP
+	}
+
+	if(newval&(1<<TWSTA)) {
+		twistatus=(twistate==HAL_TWI_IDLE)?0x08:0x10;
+		twistate=HAL_TWI_ADDR;
+		twicur=0;
+	} else {
+		switch(twistate) {
+
+			case HAL_TWI_ADDR:
+				for(int idx=0;idx<HAL_MAX_TWI_DEVICES;idx++) {
+					if(twidevs[idx] && twidevs[idx]->addr==(TWDR.val&0xfe)) {
+						twicur=twidevs[idx];
+					}
+				}
+				if(twicur) {
+					if(twicur->start) {
+						twicur->start();
+					}
+					twistatus=(TWDR.val&0x01)?0x40:0x18;
+					twistate=(TWDR.val&0x01)?HAL_TWI_READ:HAL_TWI_WRITE;
+				} else {
+					twistatus=(TWDR.val&0x01)?0x48:0x20;
+					twistate=HAL_TWI_NACKED;
+				}
+				break;
+
+			case HAL_TWI_WRITE:
+				if(twicur->write) {
+					twicur->write(TWDR.val);
+				}
+				twistatus=0x28;
+				break;
+
+			case HAL_TWI_READ:
+				TWDR.val=twicur->read?twicur->read():0xff;
+				twistatus=(newval&(1<<TWEA))?0x50:0x58;
+				break;
+
+			default:
+				twistatus=0x30;
+				break;
+		}
+	}
+
+	TWCR.val|=(1<<TWINT);
+	HALService();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// HALCallVector
+///
+/// Run an ISR the way the hardware does: with the global interrupt flag
+/// cleared, restored on return.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void HALCallVector(HALVECTOR vec, void (*isr)(void))
+{
+	struct timespec t0,t1;
+
+	sreg_i=0;
+	clock_gettime(CLOCK_MONOTONIC,&t0);
+	isr();
+	clock_gettime(CLOCK_MONOTONIC,&t1);
+	sreg_i=1;
+
+	vecstats[vec].calls++;
+	vecstats[vec].hostns+=(t1.tv_sec-t0.tv_sec)*1000000000ULL+t1.tv_nsec-t0.tv_nsec;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// HALService
+///
+/// Run any pending, enabled interrupts in hardware priority order: the
+/// lower the vector number, the higher the priority (HALVECTOR, hal.h)
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void HALService(void)
+{
+	if(inservice) {
+		return;
+	}
+	inservice=1;
+
+	while(sreg_i) {
+		if((PCIFR.val&(1<<PCIF1)) && (PCICR.val&(1<<PCIE1)) && PCINT1_vect) {
+			PCIFR.val&=~(1<<PCIF1);
+			HALCallVector(HAL_VEC_PCINT1,PCINT1_vect);
+		} else if((TIFR2.val&(1<<OCF2A)) && (TIMSK2.val&(1<<OCIE2A)) && TIMER2_COMPA_vect) {
+			TIFR2.val&=~(1<<OCF2A);
+			HALCallVector(HAL_VEC_TIMER2_COMPA,TIMER2_COMPA_vect);
+		} else if((TIFR1.val&(1<<OCF1A)) && (TIMSK1.val&(1<<OCIE1A)) && TIMER1_COMPA_vect) {
+			TIFR1.val&=~(1<<OCF1A);
+			HALCallVector(HAL_VEC_TIMER1_COMPA,TIMER1_COMPA_vect);
+		} else if((TIFR0.val&(1<<OCF0B)) && (TIMSK0.val&(1<<OCIE0B)) && TIMER0_COMPB_vect) {
+			TIFR0.val&=~(1<<OCF0B);
+			HALCallVector(HAL_VEC_TIMER0_COMPB,TIMER0_COMPB_vect);
+		} else if(HALUartUDRIPending() && USART_UDRE_vect) {
+			HALCallVector(HAL_VEC_USART_UDRE,USART_UDRE_vect);
+		} else if((TWCR.val&(1<<TWINT)) && (TWCR.val&(1<<TWIE)) && (TWCR.val&(1<<TWEN)) && TWI_vect) {
+			HALCallVector(HAL_VEC_TWI,TWI_vect);
+		} else {
+			break;
+		}
+	}
+
+	inservice=0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Exported functions
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void cli(void)
+{
+	sreg_i=0;
+}
+
+void sei(void)
+{
+	sreg_i=1;
+	HALService();
+}
+
+void HALInitialize(void)
+{
+	HALReg8 * regs8[]={
+		&SREG,&PINB,&DDRB,&PORTB,&PINC,&DDRC,&PORTC,&PIND,&DDRD,&PORTD,
+		&PCICR,&PCIFR,&PCMSK0,&PCMSK1,&PCMSK2,
+		&TCCR0A,&TCCR0B,&TCNT0,&OCR0A,&OCR0B,&TIMSK0,&TIFR0,
+		&TCCR1A,&TCCR1B,&TCCR1C,&TIMSK1,&TIFR1,
+		&TCCR2A,&TCCR2B,&TCNT2,&OCR2A,&OCR2B,&TIMSK2,&TIFR2,
+		&TWBR,&TWSR,&TWCR,&TWDR,&TWAR,&SPCR,&SPSR,&SPDR,
+		&UCSR0A,&UCSR0B,&UCSR0C,&UBRR0L,&UBRR0H,&UDR0
+	};
+	HALReg16 * regs16[]={&TCNT1,&OCR1A,&OCR1B,&ICR1};
+
+	for(unsigned int idx=0;idx<sizeof(regs8)/sizeof(regs8[0]);idx++) {
+		regs8[idx]->val=0;
+		regs8[idx]->onwrite=0;
+		regs8[idx]->onread=0;
+	}
+	for(unsigned int idx=0;idx<sizeof(regs16)/sizeof(regs16[0]);idx++) {
+		regs16[idx]->val=0;
+		regs16[idx]->onread=0;
+	}
+
+	SREG.onread=HALReadSREG;
+	SREG.onwrite=HALWriteSREG;
+	TCNT0.onread=HALReadTCNT0;
+	TIFR0.onwrite=HALWriteTIFR0;
+	TIMSK0.onwrite=HALWriteTIMSK;
+	TCCR1B.onwrite=HALWriteTCCR1B;
+	TIFR1.onwrite=HALWriteTIFR1;
+	PCIFR.onwrite=HALWritePCIFR;
+	TIMSK1.onwrite=HALWriteTIMSK;
+	TCCR2B.onwrite=HALWriteTCCR2B;
+	TIFR2.onwrite=HALWriteTIFR2;
+	TIMSK2.onwrite=HALWriteTIMSK;
+	TWSR.onread=HALReadTWSR;
+	UCSR0A.onread=HALReadUCSR0A;
+	UDR0.onread=HALReadUDR0;
+	UDR0.onwrite=HALWriteUDR0;
+	UCSR0B.onwrite=HALWriteUCSR0B;
+	TWCR.onwrite=HALWriteTWCR;
+
+	// What the Arduino core has done before UserInit: Timer0 in fast PWM
+	// at /64 for the millisecond tick, and interrupts on.
+
+	TCCR0A.val=0b00000011;
+	TCCR0B.val=0b00000011;
+
+	// The IIC lines idle high on their pull-ups
+
+	PINC.val=0b00110000;
+
+	cycles=0;
+	t1rem=0;
+	t2rem=0;
+	twistate=HAL_TWI_IDLE;
+	twicur=0;
+	twistatus=0xf8;
+	memset(twidevs,0,sizeof(twidevs));
+	uartsink=0;
+	uartrxfull=0;
+	uarttxready=0;
+	memset(vecstats,0,sizeof(vecstats));
+	sreg_i=1;
+}
+
+void HALAdvance(unsigned long ncycles)
+{
+	while(ncycles) {
+		unsigned long step=ncycles;
+		unsigned long presc1=HALTimer1Prescale();
+		unsigned long presc2=HALTimer2Prescale();
+
+		// do not step past the next compare match of any timer in use,
+		// nor the end of a character the UART interrupt is waiting on
+
+		if(presc1) {
+			unsigned long long tomatch=(unsigned long long)HALTimer1TicksToMatch()*presc1-t1rem;
+			if(tomatch<step) {
+				step=(unsigned long)tomatch;
+			}
+		}
+		if(presc2) {
+			unsigned long long tomatch=(unsigned long long)HALTimer2TicksToMatch()*presc2-t2rem;
+			if(tomatch<step) {
+				step=(unsigned long)tomatch;
+			}
+		}
+		if(TIMSK0.val&(1<<OCIE0B)) {
+			unsigned long tomatch=HALTimer0CyclesToMatchB();
+			if(tomatch<step) {
+				step=tomatch;
+			}
+		}
+		if((UCSR0B.val&(1<<UDRIE0)) && uarttxready>cycles && uarttxready-cycles<step) {
+			step=(unsigned long)(uarttxready-cycles);
+		}
+		if(presc1) {
+			t1rem+=step;
+			HALTimer1Advance(t1rem/presc1);
+			t1rem%=presc1;
+		}
+		if(presc2) {
+			t2rem+=step;
+			HALTimer2Advance(t2rem/presc2);
+			t2rem%=presc2;
+		}
+
+		cycles+=step;
+		ncycles-=step;
+		if(cycles%HAL_T0_PERIOD==(unsigned long)OCR0B.val*64) {
+			TIFR0.val|=(1<<OCF0B);
+		}
+		HALService();
+	}
+}
+
+void HALSetPin(HALReg8 & pin, unsigned char bit, int level)
+{
+	unsigned char old=pin.val;
+
+	if(level) {
+		pin.val|=(1<<bit);
+	} else {
+		pin.val&=~(1<<bit);
+	}
+
+	if((&pin==&PINC) && ((old^pin.val)&PCMSK1.val)) {
+		PCIFR.val|=(1<<PCIF1);
+		HALService();
+	}
+}
+
+int HALAttachTWIDevice(const HALTWIDEVICE * dev)
+{
+	for(int idx=0;idx<HAL_MAX_TWI_DEVICES;idx++) {
+		if(!twidevs[idx]) {
+			twidevs[idx]=dev;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+void HALUartReceive(unsigned char c)
+{
+	if(UCSR0B.val&(1<<RXEN0)) {
+		UDR0.val=c;
+		uartrxfull=1;
+	}
+}
+
+void HALUartSetSink(void (*sink)(unsigned char c))
+{
+	uartsink=sink;
+}
+
+unsigned long long HALGetCycles(void)
+{
+	return cycles;
+}
+
+const HALVECSTATS * HALGetVectorStats(HALVECTOR vec)
+{
+	return &vecstats[vec];
+}
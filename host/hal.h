@@ -0,0 +1,281 @@
+///////////////////////////////////////////////////////////////////////////////
+/// HAL.H
+///
+/// Register-level hardware shim for the host (Linux) build. Each AVR
+/// peripheral register used by the firmware is an object that behaves like
+/// the real register when read or written, so the firmware modules compile
+/// unchanged. The shim models just enough of the ATMega328P to run the
+/// closed loop: Timer1 (CTC and compare A interrupt), Timer2 (the same, for
+/// the display refresh), the port C pin change interrupt, Timer0 (free
+/// running /64, as set up by the core, with PWM duty on OCR0A and the
+/// compare B interrupt), a TWI
+/// master with pluggable slaves and USART0 (line time and the data
+/// register empty interrupt on the transmit side, polled receive).
+///
+/// Simulated time is counted in CPU cycles at F_CPU. Nothing moves unless
+/// HALAdvance is called.
+///
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef HAL_H_
+#define HAL_H_
+
+#include <stdint.h>
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+//
+// A register. Reads and writes can be hooked so the peripheral model sees
+// every access, exactly as the hardware would.
+
+class HALReg8
+{
+public:
+	typedef void (*WRITEHOOK)(uint8_t oldval, uint8_t newval);
+	typedef uint8_t (*READHOOK)(uint8_t val);
+
+	HALReg8() : val(0), onwrite(0), onread(0) {}
+
+	operator uint8_t() const { return onread?onread(val):val; }
+
+	HALReg8 & operator=(uint8_t v) { Write(v); return *this; }
+	HALReg8 & operator=(const HALReg8 & r) { Write((uint8_t)r); return *this; }
+	HALReg8 & operator|=(uint8_t v) { Write((uint8_t)*this|v); return *this; }
+	HALReg8 & operator&=(uint8_t v) { Write((uint8_t)*this&v); return *this; }
+	HALReg8 & operator^=(uint8_t v) { Write((uint8_t)*this^v); return *this; }
+
+	void Write(uint8_t v) { uint8_t old=val; val=v; if(onwrite) onwrite(old,v); }
+
+	uint8_t		val;		// raw value, for use by the models only
+	WRITEHOOK	onwrite;
+	READHOOK	onread;
+};
+
+class HALReg16
+{
+public:
+	typedef uint16_t (*READHOOK)(uint16_t val);
+
+	HALReg16() : val(0), onread(0) {}
+
+	operator uint16_t() const { return onread?onread(val):val; }
+
+	HALReg16 & operator=(uint16_t v) { val=v; return *this; }
+	HALReg16 & operator|=(uint16_t v) { val|=v; return *this; }
+	HALReg16 & operator&=(uint16_t v) { val&=v; return *this; }
+
+	uint16_t	val;
+	READHOOK	onread;
+};
+
+//
+// The registers the firmware uses
+
+extern HALReg8 SREG;
+extern HALReg8 PINB, DDRB, PORTB;
+extern HALReg8 PINC, DDRC, PORTC;
+extern HALReg8 PIND, DDRD, PORTD;
+extern HALReg8 PCICR, PCIFR, PCMSK0, PCMSK1, PCMSK2;
+extern HALReg8 TCCR0A, TCCR0B, TCNT0, OCR0A, OCR0B, TIMSK0, TIFR0;
+extern HALReg8 TCCR1A, TCCR1B, TCCR1C, TIMSK1, TIFR1;
+extern HALReg16 TCNT1, OCR1A, OCR1B, ICR1;
+extern HALReg8 TCCR2A, TCCR2B, TCNT2, OCR2A, OCR2B, TIMSK2, TIFR2;
+extern HALReg8 TWBR, TWSR, TWCR, TWDR, TWAR;
+extern HALReg8 SPCR, SPSR, SPDR;
+extern HALReg8 UCSR0A, UCSR0B, UCSR0C, UBRR0L, UBRR0H, UDR0;
+
+//
+// Register bit names
+
+#define TWINT	7
+#define TWEA	6
+#define TWSTA	5
+#define TWSTO	4
+#define TWWC	3
+#define TWEN	2
+#define TWIE	0
+
+#define SREG_I	7
+
+#define OCIE0B	2
+#define OCF0B	2
+
+#define OCIE1A	1
+#define OCF1A	1
+#define WGM12	3
+
+#define WGM21	1
+#define CS22	2
+#define CS21	1
+#define CS20	0
+#define OCIE2A	1
+#define OCF2A	1
+
+#define RXC0	7
+#define UDRE0	5
+#define UDRIE0	5
+#define FE0		4
+#define U2X0	1
+#define RXEN0	4
+#define TXEN0	3
+#define UCSZ01	2
+#define UCSZ00	1
+
+#define PCIE1	1
+#define PCIF1	1
+
+//
+// Interrupt vectors. The firmware defines these with ISR() - the shim only
+// calls the ones that are linked in.
+
+#define ISR(vector)	extern "C" void vector(void)
+
+extern "C" {
+void PCINT1_vect(void) __attribute__((weak));
+void TIMER1_COMPA_vect(void) __attribute__((weak));
+void TIMER2_COMPA_vect(void) __attribute__((weak));
+void TIMER0_COMPB_vect(void) __attribute__((weak));
+void TWI_vect(void) __attribute__((weak));
+void USART_UDRE_vect(void) __attribute__((weak));
+}
+
+//
+// Global interrupt enable. SREG can also be saved and restored, and only
+// its I bit is modelled.
+
+void cli(void);
+void sei(void);
+
+//
+// The device model hooked onto a TWI address. Addresses are in the
+// firmware's 8 bit (shifted) form with the R/W bit clear.
+
+typedef struct _HALTWIDEVICE {
+
+	unsigned char	addr;
+	void		(*start)(void);			// START or repeated START addressed to us
+	void		(*write)(unsigned char data);	// byte written by the master
+	unsigned char	(*read)(void);			// byte read by the master
+
+} HALTWIDEVICE;
+
+///////////////////////////////////////////////////////////////////////////////
+/// HALInitialize
+///
+/// Reset all registers and simulated time, and hook the peripheral models
+/// onto their registers. Call this once before the firmware is initialized.
+///
+/// @context: HOST
+/// @param: none
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void HALInitialize(void);
+
+///////////////////////////////////////////////////////////////////////////////
+/// HALAdvance
+///
+/// Advance simulated time by the given number of CPU cycles. Timers are
+/// clocked and any interrupts that become pending are serviced (if enabled)
+/// at the point in time they occur.
+///
+/// @context: HOST
+/// @param: unsigned long cycles - CPU cycles to advance
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void HALAdvance(unsigned long cycles);
+
+///////////////////////////////////////////////////////////////////////////////
+/// HALSetPin
+///
+/// Drive an input pin from outside (e.g. the motor model). Port C pins
+/// raise the pin change interrupt if enabled in PCMSK1.
+///
+/// @context: HOST
+/// @param: HALReg8 & pin - PINB, PINC or PIND
+/// @param: unsigned char bit - bit number
+/// @param: int level - zero or nonzero
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void HALSetPin(HALReg8 & pin, unsigned char bit, int level);
+
+///////////////////////////////////////////////////////////////////////////////
+/// HALAttachTWIDevice
+///
+/// Attach a slave model to the simulated TWI bus. Addresses with nothing
+/// attached are NACKed.
+///
+/// @context: HOST
+/// @param: const HALTWIDEVICE * dev - device model, must stay in scope
+/// @return: int - zero on success, -1 if the bus is full
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int HALAttachTWIDevice(const HALTWIDEVICE * dev);
+
+///////////////////////////////////////////////////////////////////////////////
+/// HALUartReceive / HALUartSetSink
+///
+/// Hand USART0 a received byte (it is dropped if the receiver is off, and
+/// overwrites one not yet read), and set where transmitted bytes go. Each
+/// byte written is handed to the sink at once, and the data register then
+/// stays full for one character time at the programmed rate.
+///
+/// @context: HOST
+/// @param: unsigned char c - byte received
+/// @param: sink - called with each byte written to UDR0, or NULL to drop
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void HALUartReceive(unsigned char c);
+void HALUartSetSink(void (*sink)(unsigned char c));
+
+///////////////////////////////////////////////////////////////////////////////
+/// HALGetCycles
+///
+/// Return simulated time in CPU cycles since HALInitialize
+///
+/// @context: HOST
+/// @param: none
+/// @return: unsigned long long - cycles
+///
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned long long HALGetCycles(void);
+
+//
+// Per-vector statistics, so the simulator can report where the CPU went.
+// Host time is measured around each call; it is only useful relative to
+// other vectors, not as an AVR cycle count. Listed in priority order,
+// with the ATmega328P vector numbers.
+
+typedef enum _HALVECTOR {
+
+	HAL_VEC_PCINT1,				// 5
+	HAL_VEC_TIMER2_COMPA,		// 8
+	HAL_VEC_TIMER1_COMPA,		// 12
+	HAL_VEC_TIMER0_COMPB,		// 16
+	HAL_VEC_USART_UDRE,			// 20
+	HAL_VEC_TWI,				// 25
+	HAL_VEC_COUNT
+
+} HALVECTOR;
+
+typedef struct _HALVECSTATS {
+
+	unsigned long		calls;
+	unsigned long long	hostns;
+
+} HALVECSTATS;
+
+const HALVECSTATS * HALGetVectorStats(HALVECTOR vec);
+
+#endif
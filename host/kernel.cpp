@@ -0,0 +1,139 @@
+///////////////////////////////////////////////////////////////////////////////
+/// KERNEL.CPP
+///
+/// Host build stand-in for the cooperative kernel. See kernel.h.
+///
+//////////////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+#include "kernel.h"
+
+namespace Kernel {
+
+OSKernel OS;
+
+OSMessageQueue::OSMessageQueue()
+{
+	head=tail=0;
+	posted=dropped=0;
+	highwater=0;
+	memset(subscribers,0,sizeof(subscribers));
+}
+
+int OSMessageQueue::Post(int id, void * context, MQOWNER owner, MQCONTEXT ctx)
+{
+	unsigned int next=(head+1)%MQ_DEPTH;
+	unsigned int depth;
+
+	if(id<0 || id>=MQ_MAX_IDS) {
+		return -1;
+	}
+	if(next==tail) {
+		dropped++;
+		return -1;
+	}
+	queue[head].id=id;
+	queue[head].context=context;
+	head=next;
+	posted++;
+
+	depth=(head+MQ_DEPTH-tail)%MQ_DEPTH;
+	if(depth>highwater) {
+		highwater=depth;
+	}
+	return 0;
+}
+
+int OSMessageQueue::Subscribe(int id, MSGHANDLER handler)
+{
+	if(id<0 || id>=MQ_MAX_IDS) {
+		return -1;
+	}
+	for(int idx=0;idx<MQ_MAX_SUBSCRIBERS;idx++) {
+		if(!subscribers[id][idx]) {
+			subscribers[id][idx]=handler;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+void OSMessageQueue::Dispatch(void)
+{
+	// Only what is queued now; anything posted by a handler waits for the
+	// next pass, as on the target.
+
+	unsigned int end=head;
+
+	while(tail!=end) {
+		int id=queue[tail].id;
+		void * context=queue[tail].context;
+
+		tail=(tail+1)%MQ_DEPTH;
+		for(int idx=0;idx<MQ_MAX_SUBSCRIBERS && subscribers[id][idx];idx++) {
+			subscribers[id][idx](context);
+		}
+	}
+}
+
+OSTaskManager::OSTaskManager()
+{
+	ntasks=0;
+	passes=0;
+}
+
+int OSTaskManager::RegisterTaskHandler(TASKHANDLER handler, void * context)
+{
+	if(ntasks>=TM_MAX_TASKS) {
+		return -1;
+	}
+	tasks[ntasks].handler=handler;
+	tasks[ntasks].context=context;
+	ntasks++;
+	return 0;
+}
+
+void OSTaskManager::RunOnce(void)
+{
+	for(int idx=0;idx<ntasks;idx++) {
+		tasks[idx].handler(tasks[idx].context);
+	}
+	passes++;
+}
+
+void OSKernel::Reset(void)
+{
+	MessageQueue=OSMessageQueue();
+	TaskManager=OSTaskManager();
+}
+
+void OSKernel::RunPass(void)
+{
+	TaskManager.RunOnce();
+	MessageQueue.Dispatch();
+}
+
+}
+
+//
+// Arduino core time functions, from simulated cycles
+
+unsigned long millis(void)
+{
+	return (unsigned long)(HALGetCycles()/(F_CPU/1000));
+}
+
+unsigned long micros(void)
+{
+	return (unsigned long)(HALGetCycles()/(F_CPU/1000000));
+}
+
+void delay(unsigned long ms)
+{
+	HALAdvance(ms*(F_CPU/1000));
+}
+
+void delayMicroseconds(unsigned int us)
+{
+	HALAdvance(us*(F_CPU/1000000));
+}
@@ -0,0 +1,119 @@
+///////////////////////////////////////////////////////////////////////////////
+/// KERNEL.H
+///
+/// Host build stand-in for the cooperative kernel. It provides the same
+/// Kernel::OS message queue, task manager and OSTimer interfaces the
+/// firmware uses, driven by simulated time rather than the hardware tick.
+///
+/// Messages posted are queued and dispatched to every subscriber once per
+/// pass of the task loop, after the tasks have run.
+///
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef KERNEL_H_
+#define KERNEL_H_
+
+#include "Arduino.h"
+
+namespace Kernel {
+
+typedef enum _MQOWNER {
+
+	MQ_OWNER_CALLER,
+	MQ_OWNER_MQ
+
+} MQOWNER;
+
+typedef enum _MQCONTEXT {
+
+	MQ_CONTEXT_TASK,
+	MQ_CONTEXT_INTERRUPT
+
+} MQCONTEXT;
+
+typedef void (*MSGHANDLER)(void * context);
+typedef void (*TASKHANDLER)(void * context);
+
+//
+// Non-blocking timer. Expires once the given number of milliseconds have
+// passed since it was last set.
+
+class OSTimer
+{
+public:
+	OSTimer(unsigned long ms) { Set(ms); }
+
+	void Set(unsigned long ms) { expiry=millis()+ms; }
+	bool isExpired(void) { return (long)(millis()-expiry)>=0; }
+
+private:
+	unsigned long expiry;
+};
+
+//
+// Message queue. 26 message IDs, as on the target.
+
+#define MQ_MAX_IDS			26
+#define MQ_MAX_SUBSCRIBERS	4
+#define MQ_DEPTH			32
+
+class OSMessageQueue
+{
+public:
+	OSMessageQueue();
+
+	int Post(int id, void * context, MQOWNER owner, MQCONTEXT ctx);
+	int Subscribe(int id, MSGHANDLER handler);
+	void Dispatch(void);
+
+	unsigned long posted;		// messages accepted
+	unsigned long dropped;		// messages lost because the queue was full
+	unsigned int highwater;		// deepest the queue has been
+
+private:
+	struct {
+		int		id;
+		void *	context;
+	} queue[MQ_DEPTH];
+	unsigned int head,tail;
+	MSGHANDLER subscribers[MQ_MAX_IDS][MQ_MAX_SUBSCRIBERS];
+};
+
+//
+// Task manager. Every registered task runs once per pass.
+
+#define TM_MAX_TASKS	12
+
+class OSTaskManager
+{
+public:
+	OSTaskManager();
+
+	int RegisterTaskHandler(TASKHANDLER handler, void * context);
+	void RunOnce(void);
+
+	unsigned long passes;
+
+private:
+	struct {
+		TASKHANDLER	handler;
+		void *		context;
+	} tasks[TM_MAX_TASKS];
+	int ntasks;
+};
+
+class OSKernel
+{
+public:
+	OSMessageQueue	MessageQueue;
+	OSTaskManager	TaskManager;
+
+	void Reset(void);
+	void RunPass(void);
+};
+
+extern OSKernel OS;
+
+}
+
+#endif
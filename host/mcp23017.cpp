@@ -0,0 +1,154 @@
+///////////////////////////////////////////////////////////////////////////////
+/// MCP23017.CPP
+///
+/// Model of the keypad port expander. See mcp23017.h.
+///
+//////////////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+#include "hal.h"
+#include "mcp23017.h"
+
+#define MCP_IODIRA		0x00
+#define MCP_IPOLA		0x02
+#define MCP_GPINTENA	0x04
+#define MCP_INTFA		0x0e
+#define MCP_INTCAPA		0x10
+#define MCP_GPIOA		0x12
+#define MCP_OLATA		0x14
+#define MCP_NREGS		0x16
+
+#define MCP_INT_PIN		0		// PC0
+
+static unsigned char regs[MCP_NREGS];
+static unsigned char pointer=0;
+static int addressed=0;				// next byte written is the register pointer
+static unsigned char keys[4];		// per row, bit per column pressed
+static unsigned char lastpins=0;	// port A pins at the last change check
+static unsigned long transfers=0;
+
+static HALTWIDEVICE dev;
+
+///////////////////////////////////////////////////////////////////////////////
+/// MCPPins
+///
+/// Port A pin levels: outputs from the latch, rows high unless a pressed
+/// key is on a selected column
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static unsigned char MCPPins(void)
+{
+	unsigned char pins=regs[MCP_OLATA]&~regs[MCP_IODIRA];
+	unsigned char selected=~pins&0x07&~regs[MCP_IODIRA];
+
+	for(int row=0;row<4;row++) {
+		if(!(keys[row]&selected)) {
+			pins|=(1<<(row+3));
+		}
+	}
+	return pins;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// MCPUpdate
+///
+/// Run the interrupt-on-change logic after anything that may move a pin,
+/// and drive INTA
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void MCPUpdate(void)
+{
+	unsigned char pins=MCPPins();
+	unsigned char changed=(pins^lastpins)&regs[MCP_GPINTENA];
+
+	if(changed && !regs[MCP_INTFA]) {
+		regs[MCP_INTFA]=changed;
+		regs[MCP_INTCAPA]=pins^regs[MCP_IPOLA];
+	}
+	lastpins=pins;
+	HALSetPin(PINC,MCP_INT_PIN,!regs[MCP_INTFA]);
+}
+
+static void MCPStart(void)
+{
+	addressed=1;
+	transfers++;
+}
+
+static void MCPWrite(unsigned char data)
+{
+	if(addressed) {
+		pointer=data%MCP_NREGS;
+		addressed=0;
+		return;
+	}
+	if(pointer==MCP_GPIOA) {
+		regs[MCP_OLATA]=data;		// writes to the port go to the latch
+	} else if(pointer!=MCP_INTFA && pointer!=MCP_INTCAPA) {
+		regs[pointer]=data;
+	}
+	pointer=(pointer+1)%MCP_NREGS;
+	MCPUpdate();
+}
+
+static unsigned char MCPRead(void)
+{
+	unsigned char val;
+
+	addressed=0;
+	switch(pointer) {
+
+		case MCP_GPIOA:
+			val=MCPPins()^(regs[MCP_IPOLA]&regs[MCP_IODIRA]);
+			regs[MCP_INTFA]=0;		// reading the port clears the interrupt
+			break;
+
+		case MCP_INTCAPA:
+			val=regs[MCP_INTCAPA];
+			regs[MCP_INTFA]=0;
+			break;
+
+		default:
+			val=regs[pointer];
+			break;
+	}
+	pointer=(pointer+1)%MCP_NREGS;
+	MCPUpdate();
+	return val;
+}
+
+void MCPInitialize(unsigned char addr)
+{
+	memset(regs,0,sizeof(regs));
+	memset(keys,0,sizeof(keys));
+	regs[MCP_IODIRA]=0xff;
+	regs[MCP_IODIRA+1]=0xff;
+	pointer=0;
+	addressed=0;
+	transfers=0;
+	lastpins=MCPPins();
+	HALSetPin(PINC,MCP_INT_PIN,1);
+
+	dev.addr=addr;
+	dev.start=MCPStart;
+	dev.write=MCPWrite;
+	dev.read=MCPRead;
+	HALAttachTWIDevice(&dev);
+}
+
+void MCPSetKey(unsigned char row, unsigned char col, int pressed)
+{
+	if(pressed) {
+		keys[row]|=(1<<col);
+	} else {
+		keys[row]&=~(1<<col);
+	}
+	MCPUpdate();
+}
+
+unsigned long MCPGetTransfers(void)
+{
+	return transfers;
+}
@@ -0,0 +1,62 @@
+///////////////////////////////////////////////////////////////////////////////
+/// MCP23017.H
+///
+/// Model of the keypad's MCP23017 port expander and the 4x3 key matrix
+/// behind it, for the host build. It sits on the simulated TWI bus and
+/// models what the keypad driver uses of port A: direction, polarity,
+/// output latch, interrupt-on-change against the previous value, and INTA
+/// (active low, on PC0). Registers are the IOCON.BANK=0 map, with the
+/// address pointer incrementing after each byte.
+///
+/// The matrix: columns on GPA0-2 (a column is selected by driving it low),
+/// rows on GPA3-6 pulled high. A pressed key pulls its row low while its
+/// column is selected.
+///
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef MCP23017_H_
+#define MCP23017_H_
+
+///////////////////////////////////////////////////////////////////////////////
+/// MCPInitialize
+///
+/// Attach the expander to the TWI bus at its power-on register state, all
+/// keys released
+///
+/// @context: HOST
+/// @param: unsigned char addr - address in the firmware's 8 bit form
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void MCPInitialize(unsigned char addr);
+
+///////////////////////////////////////////////////////////////////////////////
+/// MCPSetKey
+///
+/// Press or release a key
+///
+/// @context: HOST
+/// @param: unsigned char row - 0-3, on GPA3-6
+/// @param: unsigned char col - 0-2, on GPA0-2
+/// @param: int pressed - nonzero to press
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void MCPSetKey(unsigned char row, unsigned char col, int pressed);
+
+///////////////////////////////////////////////////////////////////////////////
+/// MCPGetTransfers
+///
+/// Number of transactions (STARTs) addressed to the expander so far
+///
+/// @context: HOST
+/// @param: none
+/// @return: unsigned long - count
+///
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned long MCPGetTransfers(void);
+
+#endif
@@ -0,0 +1,103 @@
+///////////////////////////////////////////////////////////////////////////////
+/// MOTOR.CPP
+///
+/// Discrete-time model of the DC motor and beam-breaker tacho. See motor.h.
+///
+//////////////////////////////////////////////////////////////////////////////
+
+#include <math.h>
+#include <stdlib.h>
+#include "hal.h"
+#include "motor.h"
+
+static MOTPARAMS params=MOT_DEFAULT_PARAMS;
+static double rps=0;			// shaft speed
+static double slots=0;			// shaft position, in tacho slots
+
+void MOTInitialize(const MOTPARAMS * p)
+{
+	params=*p;
+	rps=0;
+	slots=0;
+	srand(1);						// the same bounces every run
+	HALSetPin(PINC,3,0);
+}
+
+double MOTGetDuty(void)
+{
+	// COM0A1 set and PD6 an output - the PWM reaches the driver
+	if((TCCR0A.val&0b10000000) && (DDRD.val&0b01000000)) {
+		return OCR0A.val/255.0;
+	}
+	return 0;
+}
+
+double MOTGetRevsPerSec(void)
+{
+	return rps;
+}
+
+void MOTAdvance(unsigned long cycles)
+{
+	double dt=(double)cycles/F_CPU;
+	double duty=MOTGetDuty();
+	double target=(duty>params.stiction)?params.rpsmax*duty:0;
+	double rps0=rps;
+	double start=slots;
+	double travel;
+	unsigned long done=0;
+
+	// exact solution of the first order plant over the interval
+
+	rps=target+(rps0-target)*exp(-dt/params.tau);
+
+	// Position advanced by the integral of speed over the interval. The
+	// edges are placed assuming the speed varies linearly across it, which
+	// is ample for intervals much shorter than tau.
+
+	travel=(rps0+rps)*0.5*dt*params.ppr;
+	slots=start+travel;
+
+	if(travel>0) {
+		// Walk every edge between start and the new position. Rising edges
+		// sit on whole slots, falling edges a mark fraction later.
+
+		double edge=floor(start);
+
+		while(1) {
+			double rise=edge;
+			double fall=edge+params.mark;
+
+			if(rise>start && rise<=slots) {
+				unsigned long at=(unsigned long)((rise-start)/travel*cycles);
+				HALAdvance(at-done);
+				done=at;
+				HALSetPin(PINC,3,1);
+
+				// A bounce has to be over before the next edge
+				if(params.bounce>0 && rand()<params.bounce*RAND_MAX) {
+					unsigned long limit=(fall<=slots)?(unsigned long)((fall-start)/travel*cycles):cycles;
+
+					if(at+2*MOT_BOUNCE_CYCLES<limit) {
+						HALAdvance(MOT_BOUNCE_CYCLES);
+						HALSetPin(PINC,3,0);
+						HALAdvance(MOT_BOUNCE_CYCLES);
+						HALSetPin(PINC,3,1);
+						done=at+2*MOT_BOUNCE_CYCLES;
+					}
+				}
+			}
+			if(fall>start && fall<=slots) {
+				unsigned long at=(unsigned long)((fall-start)/travel*cycles);
+				HALAdvance(at-done);
+				done=at;
+				HALSetPin(PINC,3,0);
+			}
+			if(fall>=slots) {
+				break;
+			}
+			edge+=1.0;
+		}
+	}
+	HALAdvance(cycles-done);
+}
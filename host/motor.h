@@ -0,0 +1,93 @@
+///////////////////////////////////////////////////////////////////////////////
+/// MOTOR.H
+///
+/// Discrete-time model of the DC motor and beam-breaker tacho for the host
+/// build. The motor is driven from the Timer0 PWM (OCR0A on PD6) and turns
+/// its shaft position into beam-break edges on PC3, exactly where the
+/// firmware expects to see them.
+///
+/// The electrical time constant is ignored, giving a first order plant:
+///
+///   tau.dw/dt = rpsmax.duty - w		(duty above the stiction threshold)
+///
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef MOTOR_H_
+#define MOTOR_H_
+
+typedef struct _MOTPARAMS {
+
+	double	rpsmax;			// steady state RPS at full duty
+	double	tau;			// mechanical time constant, seconds
+	double	stiction;		// duty (0..1) below which the motor does not turn
+	double	mark;			// fraction of each slot for which PC3 is high
+	unsigned int ppr;		// beam-break pulses per revolution
+	double	bounce;			// chance (0..1) that a rising edge bounces
+
+} MOTPARAMS;
+
+//
+// Defaults: 3 pulses per rev matches REV_PULSES_PER_REV in revcount.h.
+// A bouncing edge drops and rises again, MOT_BOUNCE_CYCLES apart, just
+// after it first rises, so the firmware sees two extra edges.
+
+#define MOT_DEFAULT_PARAMS	{ 350.0, 0.25, 0.04, 0.5, 3, 0.0 }
+#define MOT_BOUNCE_CYCLES	160
+
+///////////////////////////////////////////////////////////////////////////////
+/// MOTInitialize
+///
+/// Set the model parameters and put the motor at rest with PC3 low
+///
+/// @context: HOST
+/// @param: const MOTPARAMS * params - model parameters
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void MOTInitialize(const MOTPARAMS * params);
+
+///////////////////////////////////////////////////////////////////////////////
+/// MOTAdvance
+///
+/// Advance the motor and the HAL together by the given number of CPU cycles.
+/// The duty is sampled at the start of the interval. Each beam-break edge is
+/// placed on PC3 at the cycle it occurs, so interrupts and timer reads see
+/// it at the right time.
+///
+/// @context: HOST
+/// @param: unsigned long cycles - CPU cycles to advance
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void MOTAdvance(unsigned long cycles);
+
+///////////////////////////////////////////////////////////////////////////////
+/// MOTGetRevsPerSec
+///
+/// The true shaft speed, for measuring loop quality
+///
+/// @context: HOST
+/// @param: none
+/// @return: double - revs per second
+///
+///////////////////////////////////////////////////////////////////////////////
+
+double MOTGetRevsPerSec(void);
+
+///////////////////////////////////////////////////////////////////////////////
+/// MOTGetDuty
+///
+/// The duty the motor currently sees: OCR0A/255 when the PWM output is
+/// enabled on PD6, otherwise zero
+///
+/// @context: HOST
+/// @param: none
+/// @return: double - duty, 0..1
+///
+///////////////////////////////////////////////////////////////////////////////
+
+double MOTGetDuty(void);
+
+#endif
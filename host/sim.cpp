@@ -0,0 +1,457 @@
+///////////////////////////////////////////////////////////////////////////////
+/// SIM.CPP
+///
+/// Host (Linux) closed loop simulator. The firmware modules are built
+/// unchanged against the HAL shim and kernel stand-in in this directory and
+/// run against the motor model, much faster than real time.
+///
+/// Build from the sketch directory, all on one line (the -fpermissive is
+/// for the firmware's void * <-> int casts, which are lossy with 64 bit
+/// host pointers but are never used beyond 16 bits):
+///
+///   g++ -std=gnu++11 -O2 -fpermissive -Wall -Ihost -o closedloop-sim
+///       host/*.cpp control.cpp revcount.cpp pinchange.cpp pwm.cpp
+///       encoder.cpp event.cpp iic.cpp leddriver.cpp ssegdriver.cpp fmt.cpp
+///       keypad.cpp display.cpp uart.cpp prf.cpp sched.cpp timer.cpp
+///       msgbus.cpp tel.cpp tune.cpp traj.cpp
+///
+/// Add -DPRF_ENABLE to build the profiler in; its dump is printed at the
+/// end of the run. Firmware code takes no simulated time, so only the run
+/// counts are meaningful on the host, not the durations.
+///
+/// Add -DTEL_ENABLE to build the telemetry recorder in, and use -tel to
+/// save what it sends. host/tools/teldecode.cpp turns the file into CSV.
+///
+/// Usage:
+///
+///   closedloop-sim [-t seconds] [-p pass_us] [-csv file] [-bounce p]
+///                  [-tune seconds] [-tel file [-trig]]
+///
+///   -t    simulated run time (default 100s)
+///   -p    task loop pass interval in microseconds (default 1000)
+///   -csv  write a trace of demand, true speed and duty every 10ms
+///   -bounce make each tacho rising edge bounce with probability p, to
+///         exercise the glitch filter
+///   -tune start the relay auto-tuner at this time, as the keypad's * does;
+///         the gains it finds are printed, and used for the rest of the run
+///   -tel  write the serial port output to a file, streaming telemetry
+///   -trig instead of streaming, arm a triggered capture shortly before
+///         each demand step, so every step is captured
+///
+/// The demand is stepped through a fixed schedule from the keypad message
+/// (MSGKEYPADRPS), and each step is scored for loop quality. The keypad
+/// runs against the port expander model with no keys pressed. The display
+/// module runs against a model of the LCD, which after every pass is
+/// compared with what the display code has drawn: the panel should catch
+/// up within a few passes of each change. How far behind it fell, and the
+/// bytes sent to the LCD, are reported.
+///
+//////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "kernel.h"
+#include "motor.h"
+#include "mcp23017.h"
+#include "LiquidCrystal_I2C.h"
+#include "../common.h"
+#include "../control.h"
+#include "../iic.h"
+#include "../leddriver.h"
+#include "../ssegdriver.h"
+#include "../display.h"
+#include "../revcount.h"
+#include "../pwm.h"
+#include "../pinchange.h"
+#include "../encoder.h"
+#include "../keypad.h"
+#include "../event.h"
+#include "../msgbus.h"
+#include "../sched.h"
+#include "../timer.h"
+#include "../uart.h"
+#include "../prf.h"
+#include "../tel.h"
+#include "../tune.h"
+#include "../traj.h"
+#include "../topics.h"
+
+//
+// The demand schedule. Each entry holds for SIM_STEP_SECONDS, and the
+// schedule repeats for long runs.
+
+#define SIM_STEP_SECONDS	20
+
+static const unsigned int schedule[]={ 100, 250, 50, 300, RPS_MIN, 180 };
+
+#define SIM_NSTEPS	(sizeof(schedule)/sizeof(schedule[0]))
+
+//
+// With -trig, how long before each step the capture is armed. It should
+// be long enough for the ring to fill with pre-trigger history.
+
+#define SIM_ARM_SECONDS		5
+
+//
+// Loop quality, per schedule entry
+
+typedef struct _SIMSTEPSTATS {
+
+	unsigned int	from;			// demand before the step
+	unsigned int	to;				// demand after the step
+	double		iae;			// integral of |demand - speed|, rev
+	double		peak;			// furthest excursion beyond the demand, RPS
+	double		settle;			// time to stay within 5% of demand, s
+	double		sserr;			// mean error over the last 2s of the step, RPS
+	double		sumerr;
+	unsigned long	nsserr;
+	int		settled;
+
+} SIMSTEPSTATS;
+
+//
+// The display module's LCD
+
+extern LiquidCrystal_I2C lcd;
+
+///////////////////////////////////////////////////////////////////////////////
+/// SIMUserInit
+///
+/// The host equivalent of UserInit in closedloop.ino
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void SIMUserInit(void)
+{
+	EVTInitialize();
+	MsgInitialize();
+	SCHInitialize();
+	TMRInitialize();
+	IICInitialize();
+	MCPInitialize(KEY_ADDR_IIC);
+	LEDInitializeDriver();
+	SSEGInitializeDriver();
+	DISPInitialize();
+	PINInitialize();
+	REVInitialize();
+	PWMInitialize();
+	KEYInitializeKeypad();
+	ENCInitialize();
+	CONTROLInitialize();
+	TUNEInitialize();
+	TRAJInitialize();
+#if defined(PRF_ENABLE) || defined(TEL_ENABLE)
+	UARTInitialize();
+#endif
+#ifdef PRF_ENABLE
+	PRFInitialize();
+#endif
+#ifdef TEL_ENABLE
+	TELInitialize();
+#endif
+}
+
+#if defined(PRF_ENABLE) || defined(TEL_ENABLE)
+static FILE * telfile=NULL;
+
+///////////////////////////////////////////////////////////////////////////////
+/// SIMUartSink
+///
+/// Save what the firmware sends on the serial port to the -tel file, or
+/// print it if there is none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void SIMUartSink(unsigned char c)
+{
+	if(telfile) {
+		fputc(c,telfile);
+	} else if(c!='\r') {
+		putchar(c);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// SIMSerialCommand
+///
+/// Send the firmware a command character, and run long enough for it to
+/// be acted on and anything it sent to reach the line
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void SIMSerialCommand(char c, double seconds, unsigned long passcycles)
+{
+	unsigned long long end=HALGetCycles()+(unsigned long long)(seconds*F_CPU);
+
+	HALUartReceive(c);
+	while(HALGetCycles()<end) {
+		Kernel::OS.RunPass();
+		MOTAdvance(passcycles);
+	}
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// SIMScoreSample
+///
+/// Accumulate loop quality figures for the current step
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void SIMScoreSample(SIMSTEPSTATS * st, double t, double dt, double speed)
+{
+	double err=(double)st->to-speed;
+	double beyond=(st->to>=st->from)?-err:err;
+
+	st->iae+=fabs(err)*dt;
+	if(beyond>st->peak) {
+		st->peak=beyond;
+	}
+	if(fabs(err)>0.05*st->to) {
+		st->settled=0;
+	} else if(!st->settled) {
+		st->settled=1;
+		st->settle=t;
+	}
+	if(t>=SIM_STEP_SECONDS-2) {
+		st->sumerr+=err;
+		st->nsserr++;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// SIMPanelDiffers
+///
+/// Number of cells where the LCD model does not show what the display
+/// module has drawn
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static unsigned int SIMPanelDiffers(void)
+{
+	const char * shadow=DISPGetShadow();
+	unsigned int cells=0;
+
+	for(unsigned char row=0;row<DISP_ROWS;row++) {
+		for(unsigned char col=0;col<DISP_COLS;col++) {
+			if(lcd.cell(col,row)!=shadow[row*DISP_COLS+col]) {
+				cells++;
+			}
+		}
+	}
+	return cells;
+}
+
+int main(int argc, char * argv[])
+{
+	double seconds=100;
+	unsigned long passcycles=F_CPU/1000;
+	FILE * csv=NULL;
+	MOTPARAMS motor=MOT_DEFAULT_PARAMS;
+	SIMSTEPSTATS steps[SIM_NSTEPS];
+	struct timespec w0,w1;
+	unsigned long long endcycles;
+	unsigned long npass=0;
+	unsigned long lcdbehind=0;		// passes the panel was behind the shadow
+	unsigned long lcdrun=0;
+	unsigned long lcdmaxrun=0;
+	unsigned int demand=0;
+	int step=-1;
+	double tuneat=-1;
+#ifdef TEL_ENABLE
+	int trig=0;
+	int armed=0;
+#endif
+
+	for(int idx=1;idx<argc;idx++) {
+		if(!strcmp(argv[idx],"-t") && idx+1<argc) {
+			seconds=atof(argv[++idx]);
+		} else if(!strcmp(argv[idx],"-p") && idx+1<argc) {
+			passcycles=(unsigned long)(atof(argv[++idx])*(F_CPU/1000000));
+		} else if(!strcmp(argv[idx],"-csv") && idx+1<argc) {
+			csv=fopen(argv[++idx],"w");
+			if(!csv) {
+				perror(argv[idx]);
+				return 1;
+			}
+			fprintf(csv,"time,demand,rps,duty\n");
+		} else if(!strcmp(argv[idx],"-bounce") && idx+1<argc) {
+			motor.bounce=atof(argv[++idx]);
+		} else if(!strcmp(argv[idx],"-tune") && idx+1<argc) {
+			tuneat=atof(argv[++idx]);
+#ifdef TEL_ENABLE
+		} else if(!strcmp(argv[idx],"-tel") && idx+1<argc) {
+			telfile=fopen(argv[++idx],"wb");
+			if(!telfile) {
+				perror(argv[idx]);
+				return 1;
+			}
+		} else if(!strcmp(argv[idx],"-trig")) {
+			trig=1;
+#endif
+		} else {
+			fprintf(stderr,"usage: %s [-t seconds] [-p pass_us] [-csv file] [-bounce p] [-tune seconds] [-tel file [-trig]]\n",argv[0]);
+			return 1;
+		}
+	}
+	if(!passcycles) {
+		passcycles=1;
+	}
+
+	memset(steps,0,sizeof(steps));
+
+	HALInitialize();
+	Kernel::OS.Reset();
+	MOTInitialize(&motor);
+	SIMUserInit();
+#if defined(PRF_ENABLE) || defined(TEL_ENABLE)
+	HALUartSetSink(SIMUartSink);
+#endif
+#ifdef TEL_ENABLE
+	if(telfile && !trig) {
+		HALUartReceive('s');
+	}
+#endif
+
+	clock_gettime(CLOCK_MONOTONIC,&w0);
+	endcycles=(unsigned long long)(seconds*F_CPU);
+
+	while(HALGetCycles()<endcycles) {
+		double t=(double)HALGetCycles()/F_CPU;
+		int cur=(int)(t/SIM_STEP_SECONDS);
+
+		// Step the demand as the keypad would
+
+		if(cur!=step) {
+			unsigned int next=schedule[cur%SIM_NSTEPS];
+
+			if(step>=0 && step<(int)SIM_NSTEPS) {
+				steps[step].sserr=steps[step].nsserr?steps[step].sumerr/steps[step].nsserr:0;
+			}
+			step=cur;
+			if(step<(int)SIM_NSTEPS) {
+				steps[step].from=demand;
+				steps[step].to=next;
+			}
+			demand=next;
+			MsgPost(MSGKEYPADRPS{demand});
+		}
+
+		if(tuneat>=0 && t>=tuneat) {
+			MsgPost(MSGAUTOTUNE{1});
+			tuneat=-1;
+		}
+
+#ifdef TEL_ENABLE
+		if(telfile && trig && (int)((t+SIM_ARM_SECONDS)/SIM_STEP_SECONDS)!=armed) {
+			armed=(int)((t+SIM_ARM_SECONDS)/SIM_STEP_SECONDS);
+			HALUartReceive('t');
+		}
+#endif
+
+		// One pass of the task loop, then let the hardware run until the
+		// next one. Only the first pass through the schedule is scored.
+
+		Kernel::OS.RunPass();
+		npass++;
+		if(SIMPanelDiffers()) {
+			lcdbehind++;
+			if(++lcdrun>lcdmaxrun) {
+				lcdmaxrun=lcdrun;
+			}
+		} else {
+			lcdrun=0;
+		}
+		MOTAdvance(passcycles);
+
+		if(step<(int)SIM_NSTEPS) {
+			SIMScoreSample(&steps[step],t-step*SIM_STEP_SECONDS,(double)passcycles/F_CPU,MOTGetRevsPerSec());
+		}
+		if(csv && (npass%(F_CPU/100/passcycles?F_CPU/100/passcycles:1))==0) {
+			fprintf(csv,"%.3f,%u,%.2f,%.3f\n",t,demand,MOTGetRevsPerSec(),MOTGetDuty());
+		}
+	}
+	if(step>=0 && step<(int)SIM_NSTEPS) {
+		steps[step].sserr=steps[step].nsserr?steps[step].sumerr/steps[step].nsserr:0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC,&w1);
+
+	double wall=(w1.tv_sec-w0.tv_sec)+(w1.tv_nsec-w0.tv_nsec)*1e-9;
+	double simt=(double)HALGetCycles()/F_CPU;
+
+	printf("Loop quality (first %u steps, %us each)\n",(unsigned int)SIM_NSTEPS,SIM_STEP_SECONDS);
+	printf("  step        IAE(rev)  peak(RPS)  settle(s)  sserr(RPS)\n");
+	for(unsigned int idx=0;idx<SIM_NSTEPS && idx<=(unsigned int)step;idx++) {
+		char settle[16];
+
+		if(steps[idx].settled) {
+			snprintf(settle,sizeof(settle),"%9.2f",steps[idx].settle);
+		} else {
+			snprintf(settle,sizeof(settle),"%9s","never");
+		}
+		printf("  %3u->%3u  %9.1f  %9.1f  %s  %10.2f\n",steps[idx].from,steps[idx].to,
+			steps[idx].iae,steps[idx].peak,settle,steps[idx].sserr);
+	}
+
+	TUNERESULT tr;
+	double a1,a0;
+
+	CTRLGetGains(&a1,&a0);
+	printf("PI gains a1=%.4f a0=%.4f",a1,a0);
+	if(!TUNEGetResult(&tr)) {
+		printf(" from auto-tune: Ku=%.3f Pu=%.3fs Kp=%.3f Ti=%.3fs",tr.ku,tr.pu,tr.kp,tr.ti);
+	}
+	printf("\n");
+
+	printf("CPU budget\n");
+	static const char * vecnames[HAL_VEC_COUNT]={"PCINT1","TIMER2_COMPA","TIMER1_COMPA","TIMER0_COMPB","USART_UDRE","TWI"};
+	for(int idx=0;idx<HAL_VEC_COUNT;idx++) {
+		const HALVECSTATS * vs=HALGetVectorStats((HALVECTOR)idx);
+
+		printf("  %-14s %10lu calls  %8.1f /s  %8.1f host ns/call\n",vecnames[idx],vs->calls,
+			vs->calls/simt,vs->calls?(double)vs->hostns/vs->calls:0.0);
+	}
+	printf("  task passes    %10lu\n",Kernel::OS.TaskManager.passes);
+	printf("  keypad I2C     %10lu transactions\n",MCPGetTransfers());
+	printf("  LCD            %10lu bytes     %8.1f /s  (%lu characters, %lu commands)\n",
+		lcd.dataBytes()+lcd.commandBytes(),(lcd.dataBytes()+lcd.commandBytes())/simt,
+		lcd.dataBytes(),lcd.commandBytes());
+	printf("  LCD panel      %10lu passes behind the display, at most %lu in a row; %s at the end\n",
+		lcdbehind,lcdmaxrun,SIMPanelDiffers()?"DIFFERENT":"the same");
+	printf("  ISR events     %10u dropped, ring high water %u\n",EVTGetOverflows(),EVTGetHighWater());
+	printf("  tacho glitches %10u dropped\n",REVGetGlitches());
+	printf("  pin handlers  ");
+	for(PINHANDLE pin=0;pin<PIN_MAX_HANDLERS;pin++) {
+		printf(" %u",PINGetCount(pin));
+	}
+	printf(" calls, by registration (16 bit)\n");
+	printf("Scheduled tasks (run order)\n");
+	printf("  period(ms)  prio        runs  overruns  max late(ms)\n");
+	for(unsigned char idx=0;idx<SCHGetTaskCount();idx++) {
+		SCHSTATS ss;
+
+		SCHGetStats(idx,&ss);
+		printf("  %10u  %4u  %10lu  %8u  %12u\n",ss.period,ss.priority,ss.runs,ss.overruns,ss.maxlate);
+	}
+#ifdef TEL_ENABLE
+	if(telfile) {
+		SIMSerialCommand('x',0.1,passcycles);
+		fclose(telfile);
+		telfile=NULL;
+	}
+#endif
+#ifdef PRF_ENABLE
+	printf("Profile\n");
+	SIMSerialCommand('p',0.5,passcycles);
+#endif
+	printf("Simulated %.1fs in %.3fs wall (%.0fx real time)\n",simt,wall,wall>0?simt/wall:0.0);
+
+	if(csv) {
+		fclose(csv);
+	}
+	return 0;
+}
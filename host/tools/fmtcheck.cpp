@@ -0,0 +1,132 @@
+///////////////////////////////////////////////////////////////////////////////
+/// FMTCHECK.CPP
+///
+/// Check the allocation-free formatters in fmt.h against the C library.
+/// FMTUnsigned and FMTSigned are compared with snprintf("%0*ld") for every
+/// 16 bit value at widths 0-7, FMTFixed with snprintf("%.*f") over a range
+/// of Q4 values at 0-4 places, and FMTParseUnsigned with a few edge cases.
+///
+/// FMTFixed rounds exact halves away from zero, where the C library rounds
+/// them to even, so those are not counted as differences; nor is the C
+/// library's "-0" for a small negative value that rounds to zero, which
+/// FMTFixed prints without the sign.
+///
+/// Build from the sketch directory:
+///
+///   g++ -O2 -Wall -Ihost -o fmtcheck host/tools/fmtcheck.cpp fmt.cpp
+///
+/// Usage:
+///
+///   fmtcheck
+///
+/// prints the first few differences found, if any, and exits nonzero if
+/// there were any.
+///
+//////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "../../fmt.h"
+
+#define FC_SHOW		10		// differences printed before going quiet
+
+static unsigned long fcbad=0;
+
+///////////////////////////////////////////////////////////////////////////////
+/// FCCompare
+///
+/// Count, and show the first few of, the cases where the formatter and
+/// the reference disagree
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void FCCompare(const char * what, long value, int arg, const char * got, const char * want)
+{
+	if(strcmp(got,want)) {
+		if(fcbad++<FC_SHOW) {
+			printf("%s %ld,%d: got '%s' want '%s'\n",what,value,arg,got,want);
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// FCNegativeZero
+///
+/// Drop the sign from a C library result that has nothing but zeros in it
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void FCNegativeZero(char * str)
+{
+	if(str[0]=='-' && strspn(str+1,"0.")==strlen(str+1)) {
+		memmove(str,str+1,strlen(str));
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// FCParse
+///
+/// One FMTParseUnsigned case
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void FCParse(const char * str, unsigned char maxdigits, unsigned char wantn, unsigned int wantv)
+{
+	unsigned int value=0;
+	unsigned char n=FMTParseUnsigned(str,maxdigits,&value);
+
+	if(n!=wantn || value!=wantv) {
+		if(fcbad++<FC_SHOW) {
+			printf("P '%s',%d: got %d digits %u want %d digits %u\n",str,maxdigits,n,value,wantn,wantv);
+		}
+	}
+}
+
+int main(void)
+{
+	char got[32];
+	char want[32];
+
+	for(long v=0;v<=65535;v++) {
+		for(int w=0;w<8;w++) {
+			FMTUnsigned(got,(unsigned int)v,w);
+			snprintf(want,sizeof(want),"%0*ld",w,v);
+			FCCompare("U",v,w,got,want);
+		}
+	}
+	printf("FMTUnsigned: 0-65535, widths 0-7\n");
+
+	for(long v=-32768;v<=32767;v++) {
+		for(int w=0;w<8;w++) {
+			FMTSigned(got,(int)v,w);
+			snprintf(want,sizeof(want),"%0*ld",w,v);
+			FCCompare("S",v,w,got,want);
+		}
+	}
+	printf("FMTSigned: -32768-32767, widths 0-7\n");
+
+	for(long v=-100000;v<=100000;v++) {
+		for(int d=0;d<=4;d++) {
+			double x=v/16.0*pow(10,d);
+
+			FMTFixed(got,v,4,d,0);
+			snprintf(want,sizeof(want),"%.*f",d,v/16.0);
+			FCNegativeZero(want);
+			if(fabs(fabs(x-trunc(x))-0.5)>1e-9) {
+				FCCompare("F",v,d,got,want);
+			}
+		}
+	}
+	printf("FMTFixed: Q4 -6250-6250, 0-4 places\n");
+
+	FCParse("0251x",3,3,25);
+	FCParse("251",3,3,251);
+	FCParse("x",3,0,0);
+	FCParse("65535",5,5,65535);
+	FCParse("99999",5,5,65535);
+	printf("FMTParseUnsigned: edge cases\n");
+
+	printf("%lu differences\n",fcbad);
+	return fcbad?1:0;
+}
@@ -0,0 +1,160 @@
+///////////////////////////////////////////////////////////////////////////////
+/// KEYCHECK.CPP
+///
+/// Host check for the interrupt driven keypad scan. The keypad driver is
+/// built unchanged with the event ring, scheduler and IIC driver, against
+/// the HAL shim and the MCP23017 model, and each of the twelve keys is
+/// pressed and released in turn. For every key the check looks for one
+/// press of the right value, one release, and counts the I2C transactions
+/// the press and the release cost. It also counts the transactions over a
+/// second with no key touched, which should be none.
+///
+/// Build from the sketch directory, all on one line:
+///
+///   g++ -std=gnu++11 -O2 -fpermissive -Wall -Ihost -o keycheck
+///       host/tools/keycheck.cpp host/hal.cpp host/kernel.cpp
+///       host/mcp23017.cpp keypad.cpp iic.cpp event.cpp pinchange.cpp
+///       sched.cpp timer.cpp msgbus.cpp
+///
+/// Usage:
+///
+///   keycheck
+///
+/// prints a line per key and exits nonzero if any key was missed, seen
+/// twice, decoded wrongly, or the idle keypad used the bus.
+///
+//////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include "kernel.h"
+#include "mcp23017.h"
+#include "../../common.h"
+#include "../../keypad.h"
+#include "../../iic.h"
+#include "../../event.h"
+#include "../../pinchange.h"
+#include "../../sched.h"
+#include "../../topics.h"
+
+#define KC_PASS_CYCLES	16000	// one task pass a millisecond
+#define KC_HOLD_MS		500		// how long each key is held
+#define KC_GAP_MS		300		// and the wait after its release
+#define KC_RELEASED		0x0c	// what the keypad sends the 7-seg on a release
+
+typedef struct _KCKEY {
+	unsigned char row;
+	unsigned char col;
+	unsigned char value;
+	const char * legend;
+} KCKEY;
+
+// The driver's key map, by row and column on the expander (see mcp23017.h).
+// * and # are sent as 0x0a and 0x0b.
+
+static const KCKEY kckeys[]={
+	{3,2,1,"1"},{3,1,2,"2"},{3,0,3,"3"},
+	{2,2,4,"4"},{2,1,5,"5"},{2,0,6,"6"},
+	{1,2,7,"7"},{1,1,8,"8"},{1,0,9,"9"},
+	{0,2,0x0a,"*"},{0,1,0,"0"},{0,0,0x0b,"#"}
+};
+
+static unsigned int kcpresses=0;
+static unsigned char kclastkey=0xff;
+static unsigned int kcreleases=0;
+
+///////////////////////////////////////////////////////////////////////////////
+/// Subscribers
+///
+/// Stand in for the display and the 7-seg, which are what the routes in
+/// topics.h deliver key presses and releases to
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void DISPKeyPressed(const MSGKEYPRESSED & msg)
+{
+	kcpresses++;
+	kclastkey=msg.key;
+}
+
+void SSEGControlMessageHandler(const MSG7SEG & msg)
+{
+	if(msg.glyph==KC_RELEASED) {
+		kcreleases++;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// KCRun
+///
+/// Run the task loop for a number of milliseconds
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void KCRun(unsigned int ms)
+{
+	while(ms--) {
+		Kernel::OS.RunPass();
+		HALAdvance(KC_PASS_CYCLES);
+	}
+}
+
+int main(void)
+{
+	unsigned long t0, idle, press, release;
+	int bad=0;
+
+	HALInitialize();
+	Kernel::OS.Reset();
+	EVTInitialize();
+	SCHInitialize();
+	IICInitialize();
+	MCPInitialize(KEY_ADDR_IIC);
+	PINInitialize();
+	KEYInitializeKeypad();
+	sei();
+
+	KCRun(100);
+	t0=MCPGetTransfers();
+	KCRun(1000);
+	idle=MCPGetTransfers()-t0;
+	printf("idle: %lu transactions in 1s\n",idle);
+	if(idle) {
+		bad++;
+	}
+
+	for(unsigned int k=0;k<sizeof(kckeys)/sizeof(kckeys[0]);k++) {
+		const KCKEY * key=&kckeys[k];
+
+		kcpresses=kcreleases=0;
+		kclastkey=0xff;
+
+		t0=MCPGetTransfers();
+		MCPSetKey(key->row,key->col,1);
+		KCRun(KC_HOLD_MS);
+		press=MCPGetTransfers()-t0;
+
+		t0=MCPGetTransfers();
+		MCPSetKey(key->row,key->col,0);
+		KCRun(KC_GAP_MS);
+		release=MCPGetTransfers()-t0;
+
+		printf("key %s: pressed %u (value 0x%02x) released %u, %lu+%lu transactions",
+			key->legend,kcpresses,kclastkey,kcreleases,press,release);
+		if(kcpresses!=1 || kclastkey!=key->value || kcreleases!=1) {
+			printf(" - want value 0x%02x once",key->value);
+			bad++;
+		}
+		printf("\n");
+	}
+
+	t0=MCPGetTransfers();
+	KCRun(1000);
+	idle=MCPGetTransfers()-t0;
+	printf("idle: %lu transactions in 1s\n",idle);
+	if(idle) {
+		bad++;
+	}
+
+	printf("%d failures\n",bad);
+	return bad?1:0;
+}
@@ -0,0 +1,258 @@
+///////////////////////////////////////////////////////////////////////////////
+/// PINCHECK.CPP
+///
+/// Host check for the pin change dispatch table (pinchange.h). The encoder
+/// and keypad drivers are built unchanged against the HAL shim and the
+/// MCP23017 model, with a probe on the tacho pin (PC3, rising edges) in
+/// place of the rev counter, registered first as the rev counter is. The
+/// check then drives each source in turn, and after each step compares
+/// what the three entries' PINGetCount counts went up by with the edges
+/// that entry asked for:
+///
+///   - tacho pulses reach the probe once per rising edge and nothing else
+///   - encoder movement reaches the encoder once per edge on either
+///     channel, and is decoded to the right detents
+///   - a key press and release reach the keypad on INTA's falling edges,
+///     and the key is delivered
+///   - edges on the tacho and encoder pins inside one interrupt reach
+///     both handlers from the one ISR call
+///   - both encoder channels changing at once is counted as illegal
+///
+/// Build from the sketch directory, all on one line:
+///
+///   g++ -std=gnu++11 -O2 -fpermissive -Wall -Ihost -o pincheck
+///       host/tools/pincheck.cpp host/hal.cpp host/kernel.cpp
+///       host/mcp23017.cpp encoder.cpp keypad.cpp iic.cpp event.cpp
+///       pinchange.cpp sched.cpp timer.cpp msgbus.cpp
+///
+/// Usage:
+///
+///   pincheck
+///
+/// prints a line per step and exits nonzero if any step went wrong.
+///
+//////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include "kernel.h"
+#include "mcp23017.h"
+#include "../../common.h"
+#include "../../encoder.h"
+#include "../../keypad.h"
+#include "../../iic.h"
+#include "../../event.h"
+#include "../../pinchange.h"
+#include "../../sched.h"
+#include "../../topics.h"
+
+#define PC_PASS_CYCLES	16000	// one task pass a millisecond
+#define PC_TACHO_BIT	3		// PC3
+#define PC_ENCA_BIT		1		// PC1
+#define PC_ENCB_BIT		2		// PC2
+
+//
+// Table entries, named by the order they are registered in below
+
+#define PC_ENTRIES		3
+
+static const char * pcnames[PC_ENTRIES]={"tacho","keypad","encoder"};
+static unsigned int pclast[PC_ENTRIES];
+static unsigned int pcprobe=0;
+static unsigned int pckeys=0;
+static int pcenc=0;			// encoder state, A<<1|B
+static int pcbad=0;
+
+///////////////////////////////////////////////////////////////////////////////
+/// Subscribers
+///
+/// Stand in for the display and the 7-seg, which are what the routes in
+/// topics.h deliver key presses to
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void DISPKeyPressed(const MSGKEYPRESSED & msg)
+{
+	pckeys++;
+}
+
+void SSEGControlMessageHandler(const MSG7SEG & msg)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// PCProbe
+///
+/// The tacho pin's handler: count the calls and make sure it only sees
+/// the pin high
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void PCProbe(unsigned char pins)
+{
+	pcprobe++;
+	if(!(pins&(1<<PC_TACHO_BIT))) {
+		printf("  tacho handler called with the pin low\n");
+		pcbad++;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// PCRun
+///
+/// Run the task loop for a number of milliseconds
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void PCRun(unsigned int ms)
+{
+	while(ms--) {
+		Kernel::OS.RunPass();
+		HALAdvance(PC_PASS_CYCLES);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// PCStep
+///
+/// Move the encoder one quadrature count, clockwise if dir is positive
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void PCStep(int dir)
+{
+	static const int seq[4]={0,2,3,1};
+	int idx=0;
+
+	while(seq[idx]!=pcenc) {
+		idx++;
+	}
+	pcenc=seq[(idx+dir+4)%4];
+	HALSetPin(PINC,PC_ENCA_BIT,pcenc&2);
+	HALSetPin(PINC,PC_ENCB_BIT,pcenc&1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// PCExpect
+///
+/// Compare each entry's count since the last call with what was expected;
+/// a negative expectation means "at least one"
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void PCExpect(const char * what, int probe, int keypad, int encoder)
+{
+	int want[PC_ENTRIES]={probe,keypad,encoder};
+	int ok=1;
+
+	printf("%s: calls",what);
+	for(PINHANDLE pin=0;pin<PC_ENTRIES;pin++) {
+		unsigned int count=PINGetCount(pin);
+		int got=(int)(count-pclast[pin]);
+
+		pclast[pin]=count;
+		printf(" %s %d",pcnames[pin],got);
+		if(want[pin]<0 ? got<1 : got!=want[pin]) {
+			ok=0;
+		}
+	}
+	if(!ok) {
+		printf(" - want %d %d %d",probe,keypad,encoder);
+		pcbad++;
+	}
+	printf("\n");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// PCCheck
+///
+/// Report a value, and count it as a failure if it is not as expected
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void PCCheck(const char * what, int got, int want)
+{
+	printf("  %s %d",what,got);
+	if(got!=want) {
+		printf(" - want %d",want);
+		pcbad++;
+	}
+	printf("\n");
+}
+
+int main(void)
+{
+	int steps;
+
+	HALInitialize();
+	Kernel::OS.Reset();
+	EVTInitialize();
+	SCHInitialize();
+	IICInitialize();
+	MCPInitialize(KEY_ADDR_IIC);
+	PINInitialize();
+	PINAddHandler(1<<PC_TACHO_BIT,PIN_EDGE_RISING,PCProbe);
+	KEYInitializeKeypad();
+	ENCInitialize();
+	sei();
+	PCRun(100);
+	PCExpect("start",0,0,0);
+
+	for(int pulse=0;pulse<10;pulse++) {
+		HALSetPin(PINC,PC_TACHO_BIT,1);
+		HALAdvance(PC_PASS_CYCLES);
+		HALSetPin(PINC,PC_TACHO_BIT,0);
+		HALAdvance(PC_PASS_CYCLES);
+	}
+	PCExpect("10 tacho pulses",10,0,0);
+	PCCheck("probe saw",pcprobe,10);
+
+	for(int count=0;count<3*ENC_COUNTS_PER_DETENT;count++) {
+		PCStep(1);
+	}
+	PCRun(200);
+	PCExpect("3 detents clockwise",0,0,3*ENC_COUNTS_PER_DETENT);
+	steps=ENCGetSteps();
+	PCCheck("steps",steps,3);
+
+	PCRun(200);
+	for(int count=0;count<2*ENC_COUNTS_PER_DETENT;count++) {
+		PCStep(-1);
+	}
+	PCRun(200);
+	PCExpect("2 detents anticlockwise",0,0,2*ENC_COUNTS_PER_DETENT);
+	steps=ENCGetSteps();
+	PCCheck("steps",steps,-2);
+
+	pckeys=0;
+	MCPSetKey(2,1,1);
+	PCRun(500);
+	MCPSetKey(2,1,0);
+	PCRun(300);
+	PCExpect("key press and release",0,-1,0);
+	PCCheck("keys delivered",pckeys,1);
+
+	// The tacho rising and an encoder channel moving inside one interrupt:
+	// the ISR samples the port once and must call both
+
+	PCRun(200);
+	pcprobe=0;
+	cli();
+	HALSetPin(PINC,PC_TACHO_BIT,1);
+	pcenc^=2;
+	HALSetPin(PINC,PC_ENCA_BIT,pcenc&2);
+	sei();
+	HALSetPin(PINC,PC_TACHO_BIT,0);
+	PCExpect("tacho and encoder together",1,0,1);
+	PCCheck("probe saw",pcprobe,1);
+
+	cli();
+	pcenc^=3;
+	HALSetPin(PINC,PC_ENCA_BIT,pcenc&2);
+	HALSetPin(PINC,PC_ENCB_BIT,pcenc&1);
+	sei();
+	PCExpect("both encoder channels together",0,0,1);
+	PCCheck("illegal",(int)ENCGetIllegal(),1);
+
+	printf("%d failures\n",pcbad);
+	return pcbad?1:0;
+}
@@ -0,0 +1,182 @@
+///////////////////////////////////////////////////////////////////////////////
+/// TELDECODE.CPP
+///
+/// Decode what the telemetry recorder (tel.h) sent on the serial port into
+/// CSV. The input is the raw byte stream, as saved by a terminal program
+/// or by the simulator's -tel option. Anything that is not a good frame is
+/// skipped, so a capture that starts mid-frame or has the profiler's text
+/// in it decodes cleanly.
+///
+/// Build from the sketch directory:
+///
+///   g++ -O2 -o teldecode host/tools/teldecode.cpp
+///
+/// Usage:
+///
+///   teldecode [file] > trace.csv
+///
+/// reads the file (or standard input) and writes one line per sample:
+///
+///   capture,seq,trigger,demand,actual,error,state,duty
+///
+/// capture is 0 for streamed samples and counts up from 1 for triggered
+/// captures; trigger is 1 on a capture's trigger sample. Speeds are in RPS
+/// and the controller state in duty units. Gaps in the sequence numbers
+/// (samples the line could not keep up with) and bad frames are counted
+/// on standard error.
+///
+//////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "../../tel.h"
+#include "../../control.h"
+
+///////////////////////////////////////////////////////////////////////////////
+/// TDCrc
+///
+/// CRC-8, polynomial 0x07, as the recorder computes it
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static unsigned char TDCrc(const unsigned char * buf, unsigned int len)
+{
+	unsigned char crc=0;
+
+	while(len--) {
+		crc^=*buf++;
+		for(int bit=0;bit<8;bit++) {
+			crc=(crc&0x80)?(unsigned char)((crc<<1)^0x07):(unsigned char)(crc<<1);
+		}
+	}
+	return crc;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// TDGet16 / TDGet32
+///
+/// Little endian fields
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static uint16_t TDGet16(const unsigned char * p)
+{
+	return (uint16_t)(p[0]|(p[1]<<8));
+}
+
+static uint32_t TDGet32(const unsigned char * p)
+{
+	return (uint32_t)TDGet16(p)|((uint32_t)TDGet16(p+2)<<16);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// TDReadAll
+///
+/// Read the whole input into memory. Captures are small.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static unsigned char * TDReadAll(FILE * in, size_t * len)
+{
+	size_t size=4096;
+	unsigned char * buf=(unsigned char *)malloc(size);
+	size_t n;
+
+	*len=0;
+	while(buf && (n=fread(buf+*len,1,size-*len,in))>0) {
+		*len+=n;
+		if(*len==size) {
+			size*=2;
+			buf=(unsigned char *)realloc(buf,size);
+		}
+	}
+	return buf;
+}
+
+int main(int argc, char * argv[])
+{
+	FILE * in=stdin;
+	unsigned char * buf;
+	size_t len;
+	size_t pos=0;
+	unsigned long samples=0, bad=0, lost=0;
+	unsigned int capture=0;
+	uint16_t trigseq=0;
+	uint16_t lastseq=0;
+	int haveseq=0;
+
+	if(argc>2) {
+		fprintf(stderr,"usage: %s [file]\n",argv[0]);
+		return 1;
+	}
+	if(argc==2) {
+		in=fopen(argv[1],"rb");
+		if(!in) {
+			perror(argv[1]);
+			return 1;
+		}
+	}
+	buf=TDReadAll(in,&len);
+	if(in!=stdin) {
+		fclose(in);
+	}
+	if(!buf) {
+		fprintf(stderr,"out of memory\n");
+		return 1;
+	}
+
+	printf("capture,seq,trigger,demand,actual,error,state,duty\n");
+
+	// A frame is only taken if its sync, length and CRC all check out;
+	// otherwise we move on a byte and look again, so a damaged frame can
+	// not hide a good one that starts inside it.
+
+	while(pos+TEL_FRAME_OVERHEAD<=len) {
+		const unsigned char * f=&buf[pos];
+		unsigned int flen=f[3];
+
+		if(f[0]!=TEL_SYNC0 || f[1]!=TEL_SYNC1) {
+			pos++;
+			continue;
+		}
+		if(flen>TEL_SAMPLE_LEN || pos+flen+TEL_FRAME_OVERHEAD>len ||
+			TDCrc(&f[2],flen+2)!=f[flen+4]) {
+			bad++;
+			pos++;
+			continue;
+		}
+		pos+=flen+TEL_FRAME_OVERHEAD;
+
+		const unsigned char * p=&f[4];
+
+		if(f[2]==TEL_FRAME_CAPTURE && flen==TEL_CAPTURE_LEN) {
+			capture++;
+			trigseq=TDGet16(p);
+			haveseq=0;
+		} else if(f[2]==TEL_FRAME_SAMPLE && flen==TEL_SAMPLE_LEN) {
+			uint16_t seq=TDGet16(p);
+
+			if(haveseq && (uint16_t)(seq-lastseq)!=1) {
+				lost+=(uint16_t)(seq-lastseq-1);
+			}
+			lastseq=seq;
+			haveseq=1;
+			samples++;
+
+			printf("%u,%u,%d,%.4f,%.4f,%.4f,%.4f,%u\n",capture,seq,(capture && seq==trigseq)?1:0,
+				(int16_t)TDGet16(p+2)/(double)(1<<CTRL_RPS_FRAC),
+				(int16_t)TDGet16(p+4)/(double)(1<<CTRL_RPS_FRAC),
+				(int16_t)TDGet16(p+6)/(double)(1<<CTRL_RPS_FRAC),
+				(int32_t)TDGet32(p+8)/(double)(1L<<CTRL_OUT_FRAC),
+				p[12]);
+		} else {
+			bad++;
+		}
+	}
+
+	fprintf(stderr,"%lu samples, %u captures, %lu samples lost, %lu bad frames\n",samples,capture,lost,bad);
+
+	free(buf);
+	return 0;
+}
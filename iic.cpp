@@ -1,123 +1,566 @@
-///////////////////////////////////////////////////////////////////////////////
-/// IIC.CPP
-///
-/// IIC peripheral driver for ATMega328p
-///
-/// Dr J A Gow / Dr M A Oliver 2022
-///
-///////////////////////////////////////////////////////////////////////////////
-
-#include <Arduino.h>
-#include "iic.h"
-
-///////////////////////////////////////////////////////////////////////////////
-/// IICInitialize
-///
-/// Initialize the IIC subsystem
-///
-/// @scope: EXPORTED
-/// @context: TASK
-/// @param: NONE
-/// @return: NONE
-///
-///////////////////////////////////////////////////////////////////////////////
-
-void IICInitialize(void)
-{
-	TWBR=20;		// set bit rate and prescaler
-	TWSR=0x10;
-}
-
-///////////////////////////////////////////////////////////////////////////////
-/// IICWrite
-///
-/// Write a string of data bytes to the IIC address
-///
-/// @scope: INTERNAL
-/// @context: TASK
-/// @param: addr - unsigned char. Address. Top 7 bits used
-/// @param: dbyte - pointer to unsigned char. Data to send
-/// @param: nToSend - number of bytes to send.
-///
-///////////////////////////////////////////////////////////////////////////////
-
-int IICWrite(unsigned char addr,unsigned char * dbytes, unsigned int nToSend)
-{
-	int rc=0;
-	// This is out of the data sheet!
-	// Polled I2C write transfer
-
-	TWCR = (1<<TWINT)|(1<<TWEN)|(1<<TWSTA);	// send start bit
-
-	while(!(TWCR&(1<<TWINT)));			// wait for ack
-	if(TWSR&0x08) {	// start bit set
-		// send the address, with W bit set to zero
-		TWDR=addr&0xf7;					// load address
-		TWCR = (1<<TWINT)|(1<<TWEN); 	// whang it in
-		while(!(TWCR&(1<<TWINT)));		// wait for complete
-		if((TWSR&0xf8)==0x18) {			// check addr ack received
-			for(int idx=0;(idx<nToSend);idx++) {
-				TWDR=*(dbytes+idx);			// load byte
-				TWCR=(1<<TWINT)|(1<<TWEN);	// whang it in
-				while(!(TWCR&(1<<TWINT)));	// wait for complete
-				if((TWSR&0xf8)!=0x28) {		// check for data ack received
-					rc=-2;
-					break;
-				}
-			}
-		}
-		TWCR=(1<<TWINT)|(1<<TWEN)|(1<<TWSTO);	// send stop bit
-		while(TWCR&(1<<TWSTO)); // wait for it to be cleared
-	} else {
-		rc=-1;
-	}
-	return rc;
-}
-
-///////////////////////////////////////////////////////////////////////////////
-/// IICRead
-///
-/// Read multiple bytes of data from the IIC address
-///
-/// @scope: EXPORTED
-/// @context: TASK
-/// @param: addr - unsigned char. Address. Top 7 bits used
-/// @param: dbytes - unsigned char * Pointer to buffer big enough to receive
-///                  data
-/// @param: nToRecv - number of bytes to receive
-///
-///////////////////////////////////////////////////////////////////////////////
-
-int IICRead(unsigned char addr,unsigned char * dbytes, unsigned int nToRecv)
-{
-	int rc=0;
-	// This is out of the data sheet!
-	// Polled I2C read transfer
-
-	TWCR = (1<<TWINT)|(1<<TWEN)|(1<<TWSTA);	// send start bit
-	while(!(TWCR&(1<<TWINT)));			// wait for ack
-	if(TWSR&0x08) {	// start bit set
-		// send the address, with W bit set to 1
-		TWDR=addr|0x01;					// load address
-		TWCR = (1<<TWINT)|(1<<TWEN); 	// whang it in
-		while(!(TWCR&(1<<TWINT)));		// wait for complete
-		if((TWSR&0xf8)==0x40) {			// check addr ack received
-			for(int idx=0;(idx<nToRecv);idx++) {
-				// check if we need ack before receiving.
-				TWCR=(idx==(nToRecv-1))?(1<<TWINT)|(1<<TWEN):(1<<TWINT)|(1<<TWEN)|(1<<TWEA);
-				while(!(TWCR&(1<<TWINT)));	// wait for ready
-				if(((TWSR&0xf8)==0x50)||((TWSR&0xf8)==0x58)) {		// check for data ack received
-					*(dbytes+idx)=TWDR;		// load byte
-				} else {
-					rc=-2;
-					break;
-				}
-			}
-		}
-		TWCR=(1<<TWINT)|(1<<TWEN)|(1<<TWSTO);	// send stop bit
-		while(TWCR&(1<<TWSTO)); // wait for it to be cleared
-	} else {
-		rc=-1;
-	}
-	return rc;
-}
+///////////////////////////////////////////////////////////////////////////////
+/// IIC.CPP
+///
+/// IIC peripheral driver for ATMega328p
+///
+/// Transfers are held in a ring of pointers to caller-owned descriptors:
+///
+///   qtail .. qactive   complete, callback not yet run (task side)
+///   qactive            in progress on the bus (engine side)
+///   qactive .. qhead   waiting
+///
+/// The engine only ever moves qactive and the task side only ever moves
+/// qtail and qhead, so each index has a single writer.
+///
+/// Dr J A Gow / Dr M A Oliver 2022
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#include <Arduino.h>
+#include <kernel.h>
+#include "iic.h"
+#include "prf.h"
+
+//
+// TWCR commands. The interrupt enable is only set when the engine runs
+// from the TWI vector.
+
+#ifdef IIC_USE_TWI_ISR
+#define IIC_TWIE		(1<<TWIE)
+#else
+#define IIC_TWIE		0
+#endif
+
+#define IIC_CMD_START	((1<<TWINT)|(1<<TWEN)|(1<<TWSTA)|IIC_TWIE)
+#define IIC_CMD_NEXT	((1<<TWINT)|(1<<TWEN)|IIC_TWIE)
+#define IIC_CMD_ACK		((1<<TWINT)|(1<<TWEN)|(1<<TWEA)|IIC_TWIE)
+#define IIC_CMD_STOP	((1<<TWINT)|(1<<TWEN)|(1<<TWSTO))
+
+//
+// Bus pins, for recovery
+
+#define IIC_SDA			0b00010000		// PC4
+#define IIC_SCL			0b00100000		// PC5
+
+//
+// Module variables. Those marked volatile are shared with the TWI ISR.
+
+static IICTRANSFER * queue[IIC_QUEUE_LEN];
+static volatile unsigned char qhead=0;
+static volatile unsigned char qactive=0;
+static unsigned char qtail=0;
+
+static IICTRANSFER * volatile cur=NULL;		// transfer on the bus
+static unsigned int curidx;					// byte index within the current phase
+static unsigned char curreading;			// nonzero in the read phase
+static volatile unsigned long curstarted;	// millis() when it started
+static volatile unsigned char curwaiting=0;	// START held back for a STOP
+
+void IICTask(void * context);
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICRecoverBus
+///
+/// With the TWI disabled, clock SCL by hand until a slave that was left
+/// mid-byte lets go of SDA, then send a STOP. Lines are driven open-drain
+/// (output low or input, relying on the bus pull-ups).
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: NONE
+/// @return: int - nonzero if SDA is free afterwards
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static int IICRecoverBus(void)
+{
+	PORTC &= ~(IIC_SDA|IIC_SCL);
+	DDRC &= ~(IIC_SDA|IIC_SCL);
+
+	for(int idx=0;(idx<9) && !(PINC&IIC_SDA);idx++) {
+		DDRC |= IIC_SCL;		// SCL low
+		delayMicroseconds(5);
+		DDRC &= ~IIC_SCL;		// SCL released
+		delayMicroseconds(5);
+	}
+
+	// STOP: SDA rising while SCL is high
+	DDRC |= IIC_SDA;
+	delayMicroseconds(5);
+	DDRC &= ~IIC_SDA;
+	delayMicroseconds(5);
+
+	return (PINC&IIC_SDA)?1:0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICFinish
+///
+/// Complete the current transfer and start the next one, if any. With a
+/// STOP pending, the next START is chained onto it (TWSTO and TWSTA together
+/// send a STOP then a START).
+///
+/// @scope: INTERNAL
+/// @context: INTERRUPT (or with interrupts disabled)
+/// @param: int status - final status
+/// @param: unsigned char stop - nonzero to send a STOP
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void IICFinish(int status, unsigned char stop)
+{
+	cur->status=status;
+	curwaiting=0;
+	qactive=(qactive+1)%IIC_QUEUE_LEN;
+	cur=(qactive!=qhead)?queue[qactive]:NULL;
+
+	if(cur) {
+		curstarted=millis();
+		TWCR=stop?(IIC_CMD_STOP|(1<<TWSTA)|IIC_TWIE):IIC_CMD_START;
+	} else if(stop) {
+		TWCR=IIC_CMD_STOP;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICStep
+///
+/// Advance the current transfer by one bus event. Called with TWINT set,
+/// either from the TWI ISR or by polling. The status codes are out of the
+/// data sheet.
+///
+/// @scope: INTERNAL
+/// @context: INTERRUPT (or with interrupts disabled)
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void IICStep(void)
+{
+	IICTRANSFER * xfer=cur;
+
+	if(!xfer) {
+		return;
+	}
+
+	switch(TWSR&0xf8) {
+
+		case 0x08:		// START sent
+		case 0x10:		// repeated START sent
+			if((TWSR&0xf8)==0x08) {
+				curreading=(xfer->ntx==0 && xfer->nrx!=0);
+			}
+			curidx=0;
+			TWDR=curreading?(xfer->addr|0x01):(xfer->addr&0xfe);
+			TWCR=IIC_CMD_NEXT;
+			break;
+
+		case 0x18:		// SLA+W acked
+		case 0x28:		// data acked
+			if(curidx<xfer->ntx) {
+				TWDR=xfer->txbuf[curidx++];
+				TWCR=IIC_CMD_NEXT;
+			} else if(xfer->nrx) {
+				curreading=1;
+				TWCR=IIC_CMD_START;		// repeated START into the read phase
+			} else {
+				IICFinish(IIC_OK,1);
+			}
+			break;
+
+		case 0x40:		// SLA+R acked. NACK the byte if it is the only one
+			TWCR=(xfer->nrx>1)?IIC_CMD_ACK:IIC_CMD_NEXT;
+			break;
+
+		case 0x50:		// data received, acked
+			xfer->rxbuf[curidx++]=TWDR;
+			TWCR=(curidx<xfer->nrx-1)?IIC_CMD_ACK:IIC_CMD_NEXT;
+			break;
+
+		case 0x58:		// last byte received, nacked
+			xfer->rxbuf[curidx++]=TWDR;
+			IICFinish(IIC_OK,1);
+			break;
+
+		case 0x20:		// SLA+W nacked
+		case 0x30:		// data nacked
+		case 0x48:		// SLA+R nacked
+			IICFinish(IIC_ERR_NACK,1);
+			break;
+
+		case 0x38:		// arbitration lost. Release the bus, no STOP
+			TWCR=(1<<TWINT)|(1<<TWEN);
+			IICFinish(IIC_ERR_BUS,0);
+			break;
+
+		default:		// bus error
+			IICFinish(IIC_ERR_BUS,1);
+			break;
+	}
+}
+
+#ifdef IIC_USE_TWI_ISR
+
+///////////////////////////////////////////////////////////////////////////////
+/// ISR - TWI
+///
+/// One bus event has completed
+///
+/// @context: INTERRUPT
+/// @scope: INTERNAL
+///
+///////////////////////////////////////////////////////////////////////////////
+
+ISR(TWI_vect)
+{
+	PRF_SCOPE(PRF_ISR_TWI);
+
+	IICStep();
+}
+
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICCheckTimeout
+///
+/// Fail the current transfer if it has been on the bus too long, reset the
+/// TWI and recover the bus, then carry on with the queue.
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void IICCheckTimeout(void)
+{
+	unsigned char sreg=SREG;
+	cli();
+
+	if(cur && (millis()-curstarted)>IIC_TIMEOUT_MS) {
+		TWCR=0;					// disable the TWI. This also stops its interrupt
+		SREG=sreg;
+		IICRecoverBus();
+		cli();
+		TWCR=(1<<TWEN);
+		IICFinish(IIC_ERR_TIMEOUT,0);
+	}
+	SREG=sreg;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICRun
+///
+/// Do everything the task side of the engine needs to do: step the engine
+/// if it is polled, check for a timeout and run completion callbacks.
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void IICRun(void)
+{
+	// A transfer submitted while the last STOP was still going out is
+	// started once the STOP has gone. If it never goes, the timeout fails
+	// the transfer and resets the TWI.
+
+	unsigned char sreg=SREG;
+	cli();
+	if(curwaiting && !(TWCR&(1<<TWSTO))) {
+		curwaiting=0;
+		TWCR=IIC_CMD_START;
+	}
+	SREG=sreg;
+
+#ifndef IIC_USE_TWI_ISR
+	if(cur && !curwaiting && (TWCR&(1<<TWINT))) {
+		IICStep();
+	}
+#endif
+
+	IICCheckTimeout();
+
+	// Run callbacks for anything complete, in order. The descriptor may be
+	// reused or go out of scope once the callback has run.
+
+	while(qtail!=qactive) {
+		IICTRANSFER * xfer=queue[qtail];
+
+		qtail=(qtail+1)%IIC_QUEUE_LEN;
+		if(xfer->callback) {
+			xfer->callback(xfer->status,xfer->context);
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICInitialize
+///
+/// Initialize the IIC subsystem, clear a stuck bus if needed and register
+/// the IIC task
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void IICInitialize(void)
+{
+	// A reset part way through a read can leave a slave holding SDA low
+
+	TWCR=0;
+	IICRecoverBus();
+
+	TWBR=20;		// set bit rate and prescaler
+	TWSR=0x10;
+	TWCR=(1<<TWEN);
+
+	Kernel::OS.TaskManager.RegisterTaskHandler(IICTask,(void *)NULL);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICTask
+///
+/// Task side of the transfer engine
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: void * context - unused
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void IICTask(void * context)
+{
+	PRF_SCOPE(PRF_TASK_IIC);
+
+	IICRun();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICSubmit
+///
+/// Queue a transfer. The caller fills in the descriptor (or uses one of the
+/// IICQueue helpers below). It runs after everything already queued.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: IICTRANSFER * xfer - the transfer. Must stay in scope until done
+/// @return: int - IIC_PENDING if queued, IIC_ERR_FULL if not
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int IICSubmit(IICTRANSFER * xfer)
+{
+	unsigned char next=(qhead+1)%IIC_QUEUE_LEN;
+
+	if(next==qtail) {
+		return IIC_ERR_FULL;
+	}
+	xfer->status=IIC_PENDING;
+
+	unsigned char sreg=SREG;
+	cli();
+
+	queue[qhead]=xfer;
+	qhead=next;
+	if(!cur) {
+		// The engine is idle, so kick it. If a STOP from the last transfer
+		// is still going out, leave the START to IICRun.
+		cur=xfer;
+		curstarted=millis();
+		if(TWCR&(1<<TWSTO)) {
+			curwaiting=1;
+		} else {
+			TWCR=IIC_CMD_START;
+		}
+	}
+	SREG=sreg;
+
+	return IIC_PENDING;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICQueueWrite / IICQueueRead / IICQueueWriteRead
+///
+/// Fill in a transfer descriptor and queue it. IICQueueWriteRead writes
+/// then reads with a repeated START between, so nothing else can use the
+/// bus in the middle (a register pointer write followed by a read, say).
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: xfer - descriptor to fill in. Must stay in scope until done
+/// @param: addr - unsigned char. Address. Top 7 bits used
+/// @param: txbuf, ntx - bytes to write
+/// @param: rxbuf, nrx - buffer for bytes read
+/// @param: callback, context - completion callback (may be NULL)
+/// @return: int - IIC_PENDING if queued, IIC_ERR_FULL if not
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int IICQueueWriteRead(IICTRANSFER * xfer, unsigned char addr, unsigned char * txbuf, unsigned int ntx,
+					unsigned char * rxbuf, unsigned int nrx, IICCALLBACK callback, void * context)
+{
+	xfer->addr=addr;
+	xfer->txbuf=txbuf;
+	xfer->ntx=ntx;
+	xfer->rxbuf=rxbuf;
+	xfer->nrx=nrx;
+	xfer->callback=callback;
+	xfer->context=context;
+	return IICSubmit(xfer);
+}
+
+int IICQueueWrite(IICTRANSFER * xfer, unsigned char addr, unsigned char * txbuf, unsigned int ntx, IICCALLBACK callback, void * context)
+{
+	return IICQueueWriteRead(xfer,addr,txbuf,ntx,NULL,0,callback,context);
+}
+
+int IICQueueRead(IICTRANSFER * xfer, unsigned char addr, unsigned char * rxbuf, unsigned int nrx, IICCALLBACK callback, void * context)
+{
+	return IICQueueWriteRead(xfer,addr,NULL,0,rxbuf,nrx,callback,context);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICWait
+///
+/// Block until a queued transfer completes. Callbacks of transfers queued
+/// before it are run from here.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: IICTRANSFER * xfer - a queued transfer
+/// @return: int - final status of the transfer
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int IICWait(IICTRANSFER * xfer)
+{
+	while(xfer->status==IIC_PENDING) {
+		IICRun();
+	}
+	// make sure it is off the ring before the caller's descriptor goes
+	IICRun();
+	return xfer->status;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICIsIdle
+///
+/// Returns nonzero if no transfer is queued or in progress. Code driving the
+/// TWI through another library (Wire) must check this first.
+///
+/// @scope: EXPORTED
+/// @context: ANY
+/// @param: NONE
+/// @return: int - nonzero if idle
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int IICIsIdle(void)
+{
+	return (cur==NULL) && !(TWCR&(1<<TWSTO));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICWrite
+///
+/// Write a string of data bytes to the IIC address. Blocks until done.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: addr - unsigned char. Address. Top 7 bits used
+/// @param: dbyte - pointer to unsigned char. Data to send
+/// @param: nToSend - number of bytes to send.
+/// @return: int - IIC_OK or an IIC_ERR code
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int IICWrite(unsigned char addr,unsigned char * dbytes, unsigned int nToSend)
+{
+	IICTRANSFER xfer;
+
+	while(IICQueueWrite(&xfer,addr,dbytes,nToSend,NULL,NULL)==IIC_ERR_FULL) {
+		IICRun();
+	}
+	return IICWait(&xfer);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICRead
+///
+/// Read multiple bytes of data from the IIC address. Blocks until done.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: addr - unsigned char. Address. Top 7 bits used
+/// @param: dbytes - unsigned char * Pointer to buffer big enough to receive
+///                  data
+/// @param: nToRecv - number of bytes to receive
+/// @return: int - IIC_OK or an IIC_ERR code
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int IICRead(unsigned char addr,unsigned char * dbytes, unsigned int nToRecv)
+{
+	IICTRANSFER xfer;
+
+	while(IICQueueRead(&xfer,addr,dbytes,nToRecv,NULL,NULL)==IIC_ERR_FULL) {
+		IICRun();
+	}
+	return IICWait(&xfer);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICWriteRead
+///
+/// Write, then read, in one transaction with a repeated START between.
+/// Blocks until done.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: addr - unsigned char. Address. Top 7 bits used
+/// @param: txbuf, ntx - bytes to write
+/// @param: rxbuf, nrx - buffer for bytes read
+/// @return: int - IIC_OK or an IIC_ERR code
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int IICWriteRead(unsigned char addr, unsigned char * txbuf, unsigned int ntx, unsigned char * rxbuf, unsigned int nrx)
+{
+	IICTRANSFER xfer;
+
+	while(IICQueueWriteRead(&xfer,addr,txbuf,ntx,rxbuf,nrx,NULL,NULL)==IIC_ERR_FULL) {
+		IICRun();
+	}
+	return IICWait(&xfer);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICReadRegs
+///
+/// Read a run of consecutive registers: the register pointer write, a
+/// repeated START and a burst read, all one transaction. Blocks until done.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: addr - unsigned char. Address. Top 7 bits used
+/// @param: reg - unsigned char. First register
+/// @param: dbytes - buffer for the register values
+/// @param: nregs - number of registers to read
+/// @return: int - IIC_OK or an IIC_ERR code
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int IICReadRegs(unsigned char addr, unsigned char reg, unsigned char * dbytes, unsigned int nregs)
+{
+	return IICWriteRead(addr,&reg,1,dbytes,nregs);
+}
@@ -1,61 +1,222 @@
-///////////////////////////////////////////////////////////////////////////////
-/// IIC.H
-///
-/// IIC peripheral driver for ATMega328p
-///
-/// Dr J A Gow / Dr M A Oliver 2022
-///
-///////////////////////////////////////////////////////////////////////////////
-
-#ifndef _IIC_H_
-#define _IIC_H_
-
-//
-// Exported functions
-
-///////////////////////////////////////////////////////////////////////////////
-/// IICInitialize
-///
-/// Initialize the IIC subsystem
-///
-/// @scope: EXPORTED
-/// @context: TASK
-/// @param: NONE
-/// @return: NONE
-///
-///////////////////////////////////////////////////////////////////////////////
-
-void IICInitialize(void);
-
-///////////////////////////////////////////////////////////////////////////////
-/// IICWrite
-///
-/// Write a string of data bytes to the IIC address
-///
-/// @scope: INTERNAL
-/// @context: TASK
-/// @param: addr - unsigned char. Address. Top 7 bits used
-/// @param: dbyte - pointer to unsigned char. Data to send
-/// @param: nToSend - number of bytes to send.
-///
-///////////////////////////////////////////////////////////////////////////////
-
-int IICWrite(unsigned char addr,unsigned char * dbytes, unsigned int nToSend);
-
-///////////////////////////////////////////////////////////////////////////////
-/// IICRead
-///
-/// Read multiple bytes of data from the IIC address
-///
-/// @scope: INTERNAL
-/// @context: TASK
-/// @param: addr - unsigned char. Address. Top 7 bits used
-/// @param: dbytes - unsigned char * Pointer to buffer big enough to receive
-///                  data
-/// @param: nToRecv - number of bytes to receive
-///
-///////////////////////////////////////////////////////////////////////////////
-
-int IICRead(unsigned char addr,unsigned char * dbytes, unsigned int nToRecv);
-
-#endif
+///////////////////////////////////////////////////////////////////////////////
+/// IIC.H
+///
+/// IIC peripheral driver for ATMega328p
+///
+/// Transfers are queued and run by a state machine driven from the TWI
+/// interrupt (or, if IIC_USE_TWI_ISR is not defined, from a task that polls
+/// TWINT). Callers either poll the status in their transfer descriptor or
+/// get a callback in task context when it completes. IICWrite, IICRead,
+/// IICWriteRead and IICReadRegs are blocking wrappers over the queue.
+///
+/// Dr J A Gow / Dr M A Oliver 2022
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _IIC_H_
+#define _IIC_H_
+
+//
+// Define to run the engine from ISR(TWI_vect). This must stay undefined
+// while anything links the Arduino Wire library (the LiquidCrystal_I2C
+// display does), as Wire owns the TWI vector. The engine is then stepped
+// from IICTask instead: still non-blocking, but one bus event per task pass.
+
+//#define IIC_USE_TWI_ISR
+
+//
+// Queue depth (transfers in flight or awaiting their callback), and the
+// time a transfer may take before the bus is reset and it is failed.
+
+#define IIC_QUEUE_LEN		8
+#define IIC_TIMEOUT_MS		5
+
+//
+// Transfer status. The original blocking return codes are kept.
+
+#define IIC_PENDING			1		// queued or in progress
+#define IIC_OK				0
+#define IIC_ERR_START		-1		// start condition could not be sent
+#define IIC_ERR_NACK		-2		// address or data not acknowledged
+#define IIC_ERR_TIMEOUT		-3		// gave up, bus was reset
+#define IIC_ERR_BUS			-4		// bus error or arbitration lost
+#define IIC_ERR_FULL		-5		// queue full, transfer not accepted
+
+typedef void (*IICCALLBACK)(int status, void * context);
+
+//
+// A transfer. This is owned by the caller and must stay in scope until the
+// status is no longer IIC_PENDING. Either phase may be empty: ntx bytes are
+// written, then if nrx is nonzero a (repeated) START is issued and nrx
+// bytes are read, all in one transaction.
+
+typedef struct _IICTRANSFER {
+
+	unsigned char		addr;		// address, top 7 bits used
+	unsigned char *		txbuf;
+	unsigned int		ntx;
+	unsigned char *		rxbuf;
+	unsigned int		nrx;
+	IICCALLBACK			callback;	// may be NULL
+	void *				context;	// passed to callback
+	volatile int		status;		// IIC_PENDING until complete
+
+} IICTRANSFER;
+
+//
+// Exported functions
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICInitialize
+///
+/// Initialize the IIC subsystem, clear a stuck bus if needed and register
+/// the IIC task
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void IICInitialize(void);
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICSubmit
+///
+/// Queue a transfer. The caller fills in the descriptor (or uses one of the
+/// IICQueue helpers below). It runs after everything already queued.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: IICTRANSFER * xfer - the transfer. Must stay in scope until done
+/// @return: int - IIC_PENDING if queued, IIC_ERR_FULL if not
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int IICSubmit(IICTRANSFER * xfer);
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICQueueWrite / IICQueueRead / IICQueueWriteRead
+///
+/// Fill in a transfer descriptor and queue it. IICQueueWriteRead writes
+/// then reads with a repeated START between, so nothing else can use the
+/// bus in the middle (a register pointer write followed by a read, say).
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: xfer - descriptor to fill in. Must stay in scope until done
+/// @param: addr - unsigned char. Address. Top 7 bits used
+/// @param: txbuf, ntx - bytes to write
+/// @param: rxbuf, nrx - buffer for bytes read
+/// @param: callback, context - completion callback (may be NULL)
+/// @return: int - IIC_PENDING if queued, IIC_ERR_FULL if not
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int IICQueueWrite(IICTRANSFER * xfer, unsigned char addr, unsigned char * txbuf, unsigned int ntx, IICCALLBACK callback, void * context);
+int IICQueueRead(IICTRANSFER * xfer, unsigned char addr, unsigned char * rxbuf, unsigned int nrx, IICCALLBACK callback, void * context);
+int IICQueueWriteRead(IICTRANSFER * xfer, unsigned char addr, unsigned char * txbuf, unsigned int ntx,
+					unsigned char * rxbuf, unsigned int nrx, IICCALLBACK callback, void * context);
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICWait
+///
+/// Block until a queued transfer completes. Callbacks of transfers queued
+/// before it are run from here.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: IICTRANSFER * xfer - a queued transfer
+/// @return: int - final status of the transfer
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int IICWait(IICTRANSFER * xfer);
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICIsIdle
+///
+/// Returns nonzero if no transfer is queued or in progress. Code driving the
+/// TWI through another library (Wire) must check this first.
+///
+/// @scope: EXPORTED
+/// @context: ANY
+/// @param: NONE
+/// @return: int - nonzero if idle
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int IICIsIdle(void);
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICWrite
+///
+/// Write a string of data bytes to the IIC address. Blocks until done.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: addr - unsigned char. Address. Top 7 bits used
+/// @param: dbyte - pointer to unsigned char. Data to send
+/// @param: nToSend - number of bytes to send.
+/// @return: int - IIC_OK or an IIC_ERR code
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int IICWrite(unsigned char addr,unsigned char * dbytes, unsigned int nToSend);
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICRead
+///
+/// Read multiple bytes of data from the IIC address. Blocks until done.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: addr - unsigned char. Address. Top 7 bits used
+/// @param: dbytes - unsigned char * Pointer to buffer big enough to receive
+///                  data
+/// @param: nToRecv - number of bytes to receive
+/// @return: int - IIC_OK or an IIC_ERR code
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int IICRead(unsigned char addr,unsigned char * dbytes, unsigned int nToRecv);
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICWriteRead
+///
+/// Write, then read, in one transaction with a repeated START between, so
+/// nothing else can use the bus in the middle. Blocks until done.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: addr - unsigned char. Address. Top 7 bits used
+/// @param: txbuf, ntx - bytes to write
+/// @param: rxbuf, nrx - buffer for bytes read
+/// @return: int - IIC_OK or an IIC_ERR code
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int IICWriteRead(unsigned char addr, unsigned char * txbuf, unsigned int ntx, unsigned char * rxbuf, unsigned int nrx);
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICReadRegs
+///
+/// Read 'nregs' consecutive registers starting at 'reg', for devices that
+/// auto-increment their register pointer (the MCP23017 in its default
+/// IOCON.SEQOP mode: GPIOA and GPIOB, or INTFA through INTCAPA, in one go).
+/// One transaction. Blocks until done.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: addr - unsigned char. Address. Top 7 bits used
+/// @param: reg - unsigned char. First register
+/// @param: dbytes - buffer for the register values
+/// @param: nregs - number of registers to read
+/// @return: int - IIC_OK or an IIC_ERR code
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int IICReadRegs(unsigned char addr, unsigned char reg, unsigned char * dbytes, unsigned int nregs);
+
+#endif
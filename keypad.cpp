@@ -1,178 +1,357 @@
-///////////////////////////////////////////////////////////////////////////////
-/// KEYPAD.CPP
-///
-/// Keyboard module
-///
-/// Dr J A Gow / Dr M A Oliver 2022
-///
-//////////////////////////////////////////////////////////////////////////////
-
-#include "common.h"
-#include "keypad.h"
-#include "kernel.h"
-#include "iic.h"
-
-#define KEY_ADDR_IIC	0x40
-
-//
-// This enum defines the states used by the state machine
-
-typedef enum _KEYSTATE {
-
-	KEY_IDLE,
-	KEY_PRESSDETECTED,
-	KEY_PRESSED,
-	KEY_RELEASEDETECTED
-
-} KEYSTATE;
-
-// The single task timer used in this module
-
-static Kernel::OSTimer KeyTimer(10);
-//
-// Forward definition of keypad task handler
-
-void KEYTaskHandler(void * context);
-
-//
-// Exported functions
-
-///////////////////////////////////////////////////////////////////////////////
-/// KEYInitializeKeypad
-///
-/// This is called once at system startup. It initializes the keypad driver.
-/// This module is the only place where hardware related to the keypad is
-/// directly accessed, so here is where we set the IO parameters. We then
-/// register the message handler so it picks up the messages posted from
-/// the control application
-///
-///////////////////////////////////////////////////////////////////////////////
-
-void KEYInitializeKeypad(void)
-{
-	unsigned char iicreg[2]; // space to put our required I2C data in.
-
-	// Configure the port expander. We want GPIA0,1 and 2 as outputs
-	// We also need GPIA3-7 as inputs. We can then usefully construct
-	// these into a byte we only need to read once.
-
-	iicreg[0]=0x00;		// IODIRA
-	iicreg[1]=0xf8;		// bottom 3 pins output
-	IICWrite(KEY_ADDR_IIC,iicreg,2);
-
-	// Now, to start with we want only the LSB low (remember
-	// keypad has reverse logic because unfortunately the hardware designer
-	// slipped up and pulled EVERYTHING high. If you design hardware, be
-	// sympathetic to your firmware designers!
-
-	iicreg[0]=0x12;		// GPIOA
-	iicreg[1]=0x06;		// bottommost bit zero
-	IICWrite(KEY_ADDR_IIC,iicreg,2);
-
-	// Now, because the hardware designer pulled everything
-	// high and used inverse logic, we set the relevant bits in
-	// the IPOLA register to put it back to rights
-
-	iicreg[0]=0x02;
-	iicreg[1]=0b01111000;
-	IICWrite(KEY_ADDR_IIC,iicreg,2);
-
-	// Register the task handler. We do not need to pass any context
-	// as in this module, our timer is declared with the scope limited
-	// to this module
-  Kernel::OS.TaskManager.RegisterTaskHandler(KEYTaskHandler,(void *)NULL);
-}
-
-//////////////////////////////////////////////////////////////////////////////
-/// KEYTaskHandler
-///
-/// This is our main task handler for the keypad. It does this in a polled
-/// mode. It simply uses a delay and a state machine to debounce, with a map
-/// to translate keys to values
-///
-/// The 'context' parameter is unused in this function
-///
-//////////////////////////////////////////////////////////////////////////////
-
-void KEYTaskHandler(void * context)
-{
-	unsigned char matrix;					        
-	unsigned char iicreg[2];				      // IIC data buffer
-	static unsigned char lastpressed;		  // needs to be remembered across calls to KEYTaskHandler
-	static KEYSTATE keystate = KEY_IDLE;	// needs to hold state across calls to KEYTaskHandler
-  static unsigned int numberToDisplay;
-  static unsigned int lastValueDisplayed;
-	
-  
-  // The first thing we need to do is read back the port value
-	// We can't use IIC repeat starts here because we don't know if anything
-	// else will want to use I2C in the meantime, between calls to this task
-  // Following this operation, the value of Port A will be stored in the variable 'matrix'
-	iicreg[0]=0x12;						        // GPIOA register address
-	IICWrite(KEY_ADDR_IIC,iicreg,1);	// write the address.
-	IICRead(KEY_ADDR_IIC,&matrix,1);	// read the value
-    
-  switch (lastpressed) {            // A switch case system to represent the different keypad buttons and expected output                       
-                        case 0b01000110:numberToDisplay = 3;break;
-                        case 0b00100110:numberToDisplay = 6;break;
-                        case 0b00010110:numberToDisplay = 9;break;
-                        case 0b01000011:numberToDisplay = 1;break;
-                        case 0b01000101:numberToDisplay = 2;break;
-                        case 0b00100011:numberToDisplay = 4;break;
-                        case 0b00100101:numberToDisplay = 5;break;
-                        case 0b00010011:numberToDisplay = 7;break;
-                        case 0b00010101:numberToDisplay = 8;break;
-                        case 0b00001101:numberToDisplay = 0x00;break;
-                        case 0b00001011:numberToDisplay = 0x0a;break;       
-                        case 0b00001110:numberToDisplay = 0x0b;break;}
-    
-	
-	switch(keystate) {                                       // check the state machine
-		case KEY_IDLE:
-      if (matrix & 0b01111000){                            // check if a keypad has been pressed
-        KeyTimer=new Kernel::OSTimer(10);                  // starts a 10ms debounce timer
-        KeyTimer.Set(10);
-        lastpressed = matrix;                              // save the current matrix of key pressed
-        keystate = KEY_PRESSDETECTED;}                     // change state to KEY_PRESSDETECTED 
-    
-      else {unsigned int col = (matrix<<1)|0b00000001;     //if no keypress was detected, move to next column
-        if ((col & 0b00000111)==0b00000111){               
-          col = 0b00000110;}                               //reset to check 'column 1' after checking 'column 3'
-      
-			  iicreg[1]=col;                                     // Then write the column to the I2C
-			IICWrite(KEY_ADDR_IIC,iicreg,2);}
-      break;
-		
-	  case KEY_PRESSDETECTED:
-         
-      if(KeyTimer.isExpired()) {                          // confirm the keypress after debounce timer expores
-         if (lastpressed == matrix){
-         Kernel::OS.MessageQueue.Post(MSG_ID_CHANGE_7SEG, (void *)numberToDisplay, Kernel::MQ_OWNER_CALLER, Kernel::MQ_CONTEXT_TASK); // post keypress to MSG_ID_CHANGE_7SEG
-         Kernel::OS.MessageQueue.Post(MSG_ID_KEY_PRESSED, (void *)numberToDisplay, Kernel::MQ_OWNER_CALLER, Kernel::MQ_CONTEXT_TASK); // post keypress to MSG_ID_KEY_PRESSED
-         lastValueDisplayed=numberToDisplay;              // save the last value of the keypress
-         keystate = KEY_PRESSED;}                         // Change state to KEY_PRESSED
-            
-         else{ keystate = KEY_IDLE;                       //Return to state KEY_IDLE if the keypress wasn't debounced
-         }
-      }   
-      break;
-
-		case KEY_PRESSED:	                                    // check for a key release.  
-        if (lastpressed != matrix){                       //checks prvious keypress with current keypress state
-           unsigned int dp = 0x0c;                        //post a decimal point value to the MSG_ID_CHANGE_7SEG and MSG_ID_KEY_RELEASED  
-           Kernel::OS.MessageQueue.Post(MSG_ID_KEY_RELEASED, (void *)lastValueDisplayed, Kernel::MQ_OWNER_CALLER, Kernel::MQ_CONTEXT_TASK); //numberToDisplay
-           Kernel::OS.MessageQueue.Post(MSG_ID_CHANGE_7SEG, (void *)dp, Kernel::MQ_OWNER_CALLER, Kernel::MQ_CONTEXT_TASK);
-           keystate = KEY_IDLE;}                          //change state to KEY_IDLE to await next press
-    
-        else{ keystate = KEY_PRESSED;}                    //remain in KEY_PRESSED if keypress hasn't been released
-                
-        break;
-      
-
-		default:			
-      // catch-all. We should never get here
-		  // but this gives us belt and braces.
-			keystate=KEY_IDLE;
-			break;
-	}
-}
+///////////////////////////////////////////////////////////////////////////////
+/// KEYPAD.CPP
+///
+/// Keyboard module
+///
+/// The port expander watches the rows for us. While no key is down all
+/// three columns are driven, so a press on any key changes a row input,
+/// and the MCP23017 pulls INTA (wired to PC0) low. Only then does the task
+/// scan and debounce; an idle keypad costs no I2C traffic at all.
+///
+/// Dr J A Gow / Dr M A Oliver 2022
+///
+//////////////////////////////////////////////////////////////////////////////
+
+#include <Arduino.h>
+#include "common.h"
+#include "keypad.h"
+#include "kernel.h"
+#include "iic.h"
+#include "event.h"
+#include "pinchange.h"
+#include "prf.h"
+#include "sched.h"
+#include "topics.h"
+
+//
+// MCP23017 registers (IOCON.BANK=0, the power on default)
+
+#define KEY_REG_IODIRA		0x00
+#define KEY_REG_IPOLA		0x02
+#define KEY_REG_GPINTENA	0x04
+#define KEY_REG_INTCONA		0x08
+#define KEY_REG_IOCON		0x0a
+#define KEY_REG_GPIOA		0x12
+
+#define KEY_IOCON_ODR		0b00000100		// INT pins open drain
+
+//
+// Port A: columns out on GPA0-2 (driven low to select), rows in on GPA3-6
+
+#define KEY_ROWS			0b01111000
+#define KEY_COLS_ALL		0b00000000		// every column selected
+#define KEY_COL_FIRST		0b00000110		// column on GPA0 selected
+
+//
+// INTA is on PC0 (PCINT8)
+
+#define KEY_INT_PIN			0b00000001
+
+//
+// This enum defines the states used by the state machine
+
+typedef enum _KEYSTATE {
+
+	KEY_IDLE,
+	KEY_SCANNING,
+	KEY_PRESSDETECTED,
+	KEY_PRESSED,
+	KEY_RELEASEDETECTED
+
+} KEYSTATE;
+
+//
+// The task runs every KEY_TASK_PERIOD ms, so the debounce is counted in
+// task runs rather than with a timer of its own.
+
+#define KEY_TASK_PERIOD		5
+#define KEY_DEBOUNCE_MS		10
+#define KEY_DEBOUNCE_RUNS	((KEY_DEBOUNCE_MS+KEY_TASK_PERIOD-1)/KEY_TASK_PERIOD)
+
+static unsigned char keydebounce=0;		// runs left before a press is confirmed
+
+// Set (from the event ring) when the expander has signalled a change
+
+static unsigned char keychanged=0;
+
+// Columns tried in this scan without finding a key
+
+static unsigned char colsscanned=0;
+
+//
+// Forward definition of keypad task handler
+
+void KEYTaskHandler(void * context);
+
+//
+// Exported functions
+
+///////////////////////////////////////////////////////////////////////////////
+/// KEYInitializeKeypad
+///
+/// This is called once at system startup. It initializes the keypad driver.
+/// This module is the only place where hardware related to the keypad is
+/// directly accessed, so here is where we set the IO parameters. We then
+/// register the message handler so it picks up the messages posted from
+/// the control application
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void KEYInitializeKeypad(void)
+{
+	unsigned char iicreg[2]; // space to put our required I2C data in.
+
+	// Configure the port expander. We want GPIA0,1 and 2 as outputs
+	// We also need GPIA3-7 as inputs. We can then usefully construct
+	// these into a byte we only need to read once.
+
+	iicreg[0]=KEY_REG_IODIRA;
+	iicreg[1]=0xf8;		// bottom 3 pins output
+	IICWrite(KEY_ADDR_IIC,iicreg,2);
+
+	// Now, because the hardware designer pulled everything
+	// high and used inverse logic, we set the relevant bits in
+	// the IPOLA register to put it back to rights
+
+	iicreg[0]=KEY_REG_IPOLA;
+	iicreg[1]=KEY_ROWS;
+	IICWrite(KEY_ADDR_IIC,iicreg,2);
+
+	// Interrupt on any change of a row (INTCONA zero compares against the
+	// previous value), with INTA open drain so it can share the line
+	// safely. The MCU pull-up on PC0 holds it high.
+
+	iicreg[0]=KEY_REG_IOCON;
+	iicreg[1]=KEY_IOCON_ODR;
+	IICWrite(KEY_ADDR_IIC,iicreg,2);
+
+	iicreg[0]=KEY_REG_INTCONA;
+	iicreg[1]=0x00;
+	IICWrite(KEY_ADDR_IIC,iicreg,2);
+
+	iicreg[0]=KEY_REG_GPINTENA;
+	iicreg[1]=KEY_ROWS;
+	IICWrite(KEY_ADDR_IIC,iicreg,2);
+
+	// PC0 as an input with pull-up, on the pin change interrupt shared
+	// with the encoder and tacho. INTA is active low.
+
+	DDRC  &= ~KEY_INT_PIN;
+	PORTC |= KEY_INT_PIN;
+	PINAddHandler(KEY_INT_PIN,PIN_EDGE_FALLING,KEYInterruptHandler);	// PCINT8
+
+	// The ISR's MSGKEYCHANGE comes back to KEYChangeMessageHandler, routed
+	// in topics.h.
+
+	// Register the task handler with the scheduler. We do not need to pass
+	// any context, as our state is declared with the scope limited to this
+	// module
+	SCHAddTask(KEYTaskHandler,(void *)NULL,KEY_TASK_PERIOD,0,SCH_PRIO_HIGH);
+
+	// A scan will be run straight away, in case a key is already down.
+	keychanged=1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// KEYInterruptHandler
+///
+/// Called from the pin change ISR on a falling edge of INTA. The expander
+/// holds INTA low until port A is read, so there is one edge per change
+/// however long the task takes to respond.
+///
+/// @scope: EXPORTED
+/// @context: INTERRUPT
+/// @param: unsigned char pins - PINC as sampled by the ISR, unused
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void KEYInterruptHandler(unsigned char pins)
+{
+	EVTPost(MSGKEYCHANGE{});
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// KEYChangeMessageHandler
+///
+/// The expander has signalled a change. The task picks this up next pass.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: const MSGKEYCHANGE & msg - no data
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void KEYChangeMessageHandler(const MSGKEYCHANGE & msg)
+{
+	PRF_SCOPE(PRF_MESSAGES);
+
+	keychanged=1;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// KEYReadPort
+///
+/// Read port A. Reading GPIOA also clears the expander's interrupt.
+///
+//////////////////////////////////////////////////////////////////////////////
+
+static unsigned char KEYReadPort(void)
+{
+	unsigned char matrix=0;
+
+	// The register address and the read go in one transaction with a
+	// repeated START, so nothing else can get onto the bus in between and
+	// move the expander's register pointer.
+	IICReadRegs(KEY_ADDR_IIC,KEY_REG_GPIOA,&matrix,1);
+	return matrix;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// KEYWriteColumns
+///
+/// Select columns (a zero bit selects)
+///
+//////////////////////////////////////////////////////////////////////////////
+
+static void KEYWriteColumns(unsigned char cols)
+{
+	unsigned char iicreg[2];
+
+	iicreg[0]=KEY_REG_GPIOA;
+	iicreg[1]=cols;
+	IICWrite(KEY_ADDR_IIC,iicreg,2);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// KEYArm
+///
+/// Go back to waiting for the expander: select every column so any press
+/// shows on a row, then read the port to clear any interrupt raised by the
+/// scanning. If a key is down already there will be no edge for it, so
+/// we go straight to scanning instead.
+///
+//////////////////////////////////////////////////////////////////////////////
+
+static KEYSTATE KEYArm(void)
+{
+	KEYWriteColumns(KEY_COLS_ALL);
+	keychanged=0;		// before the read, so a change after it is not lost
+	if(KEYReadPort()&KEY_ROWS) {
+		KEYWriteColumns(KEY_COL_FIRST);
+		colsscanned=0;
+		return KEY_SCANNING;
+	}
+	return KEY_IDLE;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// KEYTaskHandler
+///
+/// This is our main task handler for the keypad. It sleeps until the
+/// expander signals a change, then scans the columns in turn. It simply
+/// uses a delay and a state machine to debounce, with a map to translate
+/// keys to values
+///
+/// The 'context' parameter is unused in this function
+///
+//////////////////////////////////////////////////////////////////////////////
+
+void KEYTaskHandler(void * context)
+{
+	PRF_SCOPE(PRF_TASK_KEYPAD);
+
+	unsigned char matrix;
+	static unsigned char lastpressed;		  // needs to be remembered across calls to KEYTaskHandler
+	static KEYSTATE keystate = KEY_IDLE;	// needs to hold state across calls to KEYTaskHandler
+  static unsigned char numberToDisplay;
+  static unsigned char lastValueDisplayed;
+
+	// Nothing to do, and no bus traffic, until the expander says so. That
+	// goes for a key being held down too: its release changes a row.
+
+	if(keystate==KEY_IDLE || keystate==KEY_PRESSED) {
+		if(!keychanged) {
+			return;
+		}
+		keychanged=0;
+		if(keystate==KEY_IDLE) {
+			KEYWriteColumns(KEY_COL_FIRST);
+			colsscanned=0;
+			keystate=KEY_SCANNING;
+			return;		// let the column settle before reading
+		}
+	}
+
+	// No need to look at the port until the debounce time is up, either
+
+	if(keystate==KEY_PRESSDETECTED && --keydebounce) {
+		return;
+	}
+
+  // Following this operation, the value of Port A will be stored in the variable 'matrix'
+	matrix=KEYReadPort();
+
+  switch (lastpressed) {            // A switch case system to represent the different keypad buttons and expected output
+                        case 0b01000110:numberToDisplay = 3;break;
+                        case 0b00100110:numberToDisplay = 6;break;
+                        case 0b00010110:numberToDisplay = 9;break;
+                        case 0b01000011:numberToDisplay = 1;break;
+                        case 0b01000101:numberToDisplay = 2;break;
+                        case 0b00100011:numberToDisplay = 4;break;
+                        case 0b00100101:numberToDisplay = 5;break;
+                        case 0b00010011:numberToDisplay = 7;break;
+                        case 0b00010101:numberToDisplay = 8;break;
+                        case 0b00001101:numberToDisplay = 0x00;break;
+                        case 0b00001011:numberToDisplay = 0x0a;break;
+                        case 0b00001110:numberToDisplay = 0x0b;break;}
+
+
+	switch(keystate) {                                       // check the state machine
+		case KEY_SCANNING:
+      if (matrix & KEY_ROWS){                              // check if a keypad has been pressed
+        keydebounce = KEY_DEBOUNCE_RUNS;                   // starts a 10ms debounce
+        lastpressed = matrix;                              // save the current matrix of key pressed
+        keystate = KEY_PRESSDETECTED;}                     // change state to KEY_PRESSDETECTED
+
+      else if (++colsscanned >= 3){                        // all three columns and no key: it was
+        keystate = KEYArm();}                              // a release or a bounce, so wait again
+
+      else {unsigned int col = (matrix<<1)|0b00000001;     //if no keypress was detected, move to next column
+        if ((col & 0b00000111)==0b00000111){
+          col = KEY_COL_FIRST;}                            //reset to check 'column 1' after checking 'column 3'
+
+			KEYWriteColumns(col & 0b00000111);}                // Then write the column to the I2C
+      break;
+
+	  case KEY_PRESSDETECTED:                                 // the debounce time is up: confirm the keypress
+
+      if (lastpressed == matrix){
+         MsgPost(MSG7SEG{numberToDisplay});               // post keypress to the 7-seg
+         MsgPost(MSGKEYPRESSED{numberToDisplay});         // and to whoever wants key presses
+         lastValueDisplayed=numberToDisplay;              // save the last value of the keypress
+         keystate = KEY_PRESSED;}                         // Change state to KEY_PRESSED
+
+      else{ keystate = KEYArm();                          //Back to waiting if the keypress wasn't debounced
+      }
+      break;
+
+		case KEY_PRESSED:	                                    // check for a key release.
+        if (lastpressed != matrix){                       //checks prvious keypress with current keypress state
+           MsgPost(MSGKEYRELEASED{lastValueDisplayed});   //post the key released
+           MsgPost(MSG7SEG{0x0c});                        //and a decimal point to the 7-seg
+           keystate = KEYArm();}                          //wait for the expander to signal the next press
+
+        else{ keystate = KEY_PRESSED;}                    //remain in KEY_PRESSED if keypress hasn't been released
+
+        break;
+
+
+		default:
+      // catch-all. We should never get here
+		  // but this gives us belt and braces.
+			keystate=KEYArm();
+			break;
+	}
+}
@@ -10,6 +10,10 @@
 #ifndef KEYPAD_H_
 #define KEYPAD_H_
 
+//
+// Port expander I2C addr
+
+#define KEY_ADDR_IIC	0x40
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -24,6 +28,7 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 void KEYInitializeKeypad(void);
+void KEYInterruptHandler(unsigned char pins);
 
 
 #endif
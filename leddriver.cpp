@@ -2,22 +2,16 @@
 /// LEDDRIVER.CPP
 ///
 /// This module is responsible for the control of the LED. It contains a
-/// handler that runs in response to a posted message to either turn on or
-/// turn off the LED. Note the 'creative' use of the context variable - although
-/// declared as a pointer it is not used as a pointer at all. Very common in
-/// embedded design and device driver design, but generally makes computer
-/// scientists have a fit.
+/// handler that runs in response to a posted message (MSGLED, routed to it
+/// in topics.h) to either turn on or turn off the LED.
 ///
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "leddriver.h"
 #include "common.h"
 #include "kernel.h"
-
-
-// prototype the message handler function here.
-
-void LEDControlMessageHandler(void * context);
+#include "prf.h"
+#include "topics.h"
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -25,31 +19,29 @@ void LEDControlMessageHandler(void * context);
 ///
 /// This is called once at system startup. It initializes the LED driver.
 /// This module is the only place where hardware related to the LED is
-/// directly accessed, so here is where we set the IO parameters. We then
-/// register the message handler so it picks up the messages posted from
-/// the control application
+/// directly accessed, so here is where we set the IO parameters. The
+/// message handler needs no registering: the route in topics.h calls it.
 ///
 ///////////////////////////////////////////////////////////////////////////////
 
 void LEDInitializeDriver(void)
 {
 	DDRB |= 0b00100000;
-	Kernel::OS.MessageQueue.Subscribe(MSG_ID_CHANGE_LED, LEDControlMessageHandler);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 /// LEDControlMessageHandler
 ///
-/// This function is called in response to a posted message
-/// The 'context' parameter is not used as a pointer, but is cast to
-/// an integer, which is used as a boolean. Zero means LED off, nonzero
-/// means LED on.
+/// This function is called in response to a posted message. Zero means LED
+/// off, nonzero means LED on.
 ///
 ///////////////////////////////////////////////////////////////////////////////
 
-void LEDControlMessageHandler(void * context)
+void LEDControlMessageHandler(const MSGLED & msg)
 {
-	if((int)context) {
+	PRF_SCOPE(PRF_MESSAGES);
+
+	if(msg.on) {
 		PORTB |= 0b00100000;
 	} else {
 		PORTB &= ~0b00100000;
@@ -0,0 +1,102 @@
+///////////////////////////////////////////////////////////////////////////////
+/// MSGBUS.CPP
+///
+/// The flush list behind the latest-value topics. See msgbus.h.
+///
+/// A topic goes on the list when its slot goes from clean to dirty, so it
+/// is on it at most once, and the list never holds more entries than there
+/// are latest-value topics. The task takes each entry off before calling
+/// it, so a subscriber that posts to a latest-value topic - its own
+/// included - just puts it back on for the next run.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#include <Arduino.h>
+#include <kernel.h>
+#include "msgbus.h"
+
+static MSGFLUSH msgdirty[MSG_MAX_LATEST];
+static unsigned char msgndirty=0;
+
+void MsgTask(void * context);
+
+/////////////////////////////
+/// Exported functions
+/////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// MsgInitialize
+///
+/// Empty the flush list and register the flush task
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void MsgInitialize(void)
+{
+	msgndirty=0;
+
+	Kernel::OS.TaskManager.RegisterTaskHandler(MsgTask,(void *)NULL);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// MsgMarkDirty
+///
+/// Put a latest-value topic on the flush list. Should the list ever be
+/// full (MSG_MAX_LATEST set lower than the number of such topics) the
+/// topic is flushed there and then, as a plain topic would be, rather
+/// than lost.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: MSGFLUSH flush - the topic's flush function
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void MsgMarkDirty(MSGFLUSH flush)
+{
+	if(msgndirty<MSG_MAX_LATEST) {
+		msgdirty[msgndirty++]=flush;
+	} else {
+		flush();
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// MsgTask
+///
+/// Deliver every dirty latest-value topic once. Only the entries on the
+/// list when the task starts are flushed; any put on by a subscriber wait
+/// for the next run.
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: void * context - unused
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void MsgTask(void * context)
+{
+	MSGFLUSH pending[MSG_MAX_LATEST];
+	unsigned char n=msgndirty;
+	unsigned char idx;
+
+	if(!n) {
+		return;
+	}
+
+	for(idx=0;idx<n;idx++) {
+		pending[idx]=msgdirty[idx];
+	}
+	msgndirty=0;
+
+	for(idx=0;idx<n;idx++) {
+		pending[idx]();
+	}
+}
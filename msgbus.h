@@ -0,0 +1,151 @@
+///////////////////////////////////////////////////////////////////////////////
+/// MSGBUS.H
+///
+/// Typed message bus. A topic is a payload type: a struct carrying the data
+/// and the numeric message ID it stands for. Its subscribers are listed
+/// once, at compile time, by specializing MsgRoute for it (see topics.h):
+///
+///   template<> struct MsgRoute<MSGDEMANDRPS>
+///       : MsgSubscribers<MSGDEMANDRPS, DISPUpdateDemandRPS> {};
+///
+/// MsgPost(msg) then compiles to a direct call of each subscriber in turn,
+/// with the payload passed by reference. There is no cast through void *,
+/// so a handler taking the wrong type is a compile error, and no run time
+/// subscriber lookup or queue. Posting a topic with no route is a compile
+/// error too; a route with no subscribers costs nothing.
+///
+/// Delivery is immediate, in the caller's context, so it is for task
+/// context only. Interrupts post through the event ring instead (EVTPost,
+/// event.h), which delivers here from a task. A subscriber may post in
+/// turn, but must not rely on the poster having finished what it was
+/// doing.
+///
+/// A topic that carries state rather than events - a speed, say, where
+/// only the newest value matters - can be routed through MsgLatest
+/// instead:
+///
+///   template<> struct MsgRoute<MSGACTUALRPS>
+///       : MsgLatest<MSGACTUALRPS, DISPUpdateRPS> {};
+///
+/// Posting it then only overwrites the topic's one slot and marks it
+/// dirty. The flush task (MsgInitialize) delivers the slot once on its
+/// next run, however many posts there were since the last, so a burst of
+/// posts costs one slot of RAM and one run of each subscriber.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _MSGBUS_H_
+#define _MSGBUS_H_
+
+//
+// Exported functions
+
+///////////////////////////////////////////////////////////////////////////////
+/// MsgInitialize
+///
+/// Empty the flush list and register the flush task. Call this before any
+/// module that posts a latest-value topic.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void MsgInitialize(void);
+
+//
+// A list of subscribers to one topic, called in the order given
+
+template<typename T, void (*... Handlers)(const T &)>
+struct MsgSubscribers;
+
+template<typename T>
+struct MsgSubscribers<T>
+{
+	static inline void Deliver(const T & msg) { (void)msg; }
+};
+
+template<typename T, void (*First)(const T &), void (*... Rest)(const T &)>
+struct MsgSubscribers<T, First, Rest...>
+{
+	static inline void Deliver(const T & msg)
+	{
+		First(msg);
+		MsgSubscribers<T, Rest...>::Deliver(msg);
+	}
+};
+
+//
+// Settings. The flush list has room for every latest-value topic dirty at
+// once; each entry is a function pointer.
+
+#define MSG_MAX_LATEST		4
+
+//
+// Flush list, for MsgLatest only. See msgbus.cpp.
+
+typedef void (*MSGFLUSH)(void);
+
+void MsgMarkDirty(MSGFLUSH flush);
+
+//
+// A latest-value topic: a slot holding the newest message, and its
+// subscribers, called once from the flush task with whatever the slot
+// holds then.
+
+template<typename T, void (*... Handlers)(const T &)>
+struct MsgLatest
+{
+	static T				slot;
+	static unsigned char	dirty;
+
+	static inline void Deliver(const T & msg)
+	{
+		slot=msg;
+		if(!dirty) {
+			dirty=1;
+			MsgMarkDirty(Flush);
+		}
+	}
+
+	static void Flush(void)
+	{
+		dirty=0;
+		MsgSubscribers<T, Handlers...>::Deliver(slot);
+	}
+};
+
+template<typename T, void (*... Handlers)(const T &)>
+T MsgLatest<T, Handlers...>::slot;
+
+template<typename T, void (*... Handlers)(const T &)>
+unsigned char MsgLatest<T, Handlers...>::dirty=0;
+
+//
+// The route for a topic. Only specializations exist: a topic nobody has
+// routed can not be posted.
+
+template<typename T>
+struct MsgRoute;
+
+///////////////////////////////////////////////////////////////////////////////
+/// MsgPost
+///
+/// Deliver a message to every subscriber of its topic
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: const T & msg - the message
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+static inline void MsgPost(const T & msg)
+{
+	MsgRoute<T>::Deliver(msg);
+}
+
+#endif
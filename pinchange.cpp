@@ -11,50 +11,123 @@
 
 #include <kernel.h>
 #include "pinchange.h"
-#include "encoder.h"
-#include "revcount.h"
+#include "prf.h"
 
+typedef struct _PINENTRY {
+
+	unsigned char	rising;			// pins whose rising edges we want
+	unsigned char	falling;		// and falling
+	PINHANDLER		handler;
+	unsigned int	count;			// written by the ISR
+
+} PINENTRY;
+
+//
+// The port C bank. Entries are only added with the interrupt held off,
+// so the ISR never sees one half written.
+
+static volatile PINENTRY pinentries[PIN_MAX_HANDLERS];
+static volatile unsigned char pinnentries=0;
 static unsigned char lastPinC=0;
 
 ///////////////////////////////////////////////////////////////////////////////
 /// PINInitialize
 ///
-/// This is called once at system startup. This function enables the pin change
-/// functionality and enables the interrupt associated with it
+/// This is called once at system startup. This function empties the table;
+/// the pin change interrupt is enabled by the first PINAddHandler
 ///
 ///////////////////////////////////////////////////////////////////////////////
 
 void PINInitialize(void)
 {
-	// INC ENC A (on schematic) is attached to A1 -> PORTC bit 1
-	// INC ENC B (on schematic) is attached to A2 -> PORTC bit 2
-	//
-	// According to ATMega328P datasheet, PC1 -> PCINT9
-	//                                    PC2 -> PCINT10
+	// The modules on the pin change interrupt, all on port C (PCINT1):
 	//
-	// We need to enable both as inputs, but we only need to enable
-	// the pin change interrupt on one of the two, as the
-	// encoder works with relative phase.
+	//   PC0 -> PCINT8    keypad expander INTA, falling edges
+	//   PC1 -> PCINT9    encoder channel A, both edges
+	//   PC2 -> PCINT10   encoder channel B, both edges
+	//   PC3 -> PCINT11   beam-breaker tacho, rising edges
 	//
-	// The beam breaker is on PC3
-
+	// Each sets up its own pins and registers here.
 
 	// For timing only
 	DDRD |= 0b00000100;	// Port D bit 2 is broken out to a test point.
 
+	pinnentries=0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// PINAddHandler
+///
+/// Add an entry to the table, and enable the interrupt on its pins. The
+/// pins' last state is sampled now, so the first edge is seen as one.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: unsigned char mask - port C pins, one bit each
+/// @param: unsigned char edge - PIN_EDGE_RISING, PIN_EDGE_FALLING or PIN_EDGE_BOTH
+/// @param: PINHANDLER handler - called from the ISR on each such edge
+/// @return: PINHANDLE - the entry, or PIN_NONE if the table is full
+///
+///////////////////////////////////////////////////////////////////////////////
+
+PINHANDLE PINAddHandler(unsigned char mask, unsigned char edge, PINHANDLER handler)
+{
+	unsigned char idx=pinnentries;
+
+	if(idx>=PIN_MAX_HANDLERS) {
+		return PIN_NONE;
+	}
+
+	unsigned char sreg=SREG;
+	cli();
 
-	DDRC &= ~0b00001110; // PC1, PC2 and PC3 set to inputs
+	pinentries[idx].rising=(edge&PIN_EDGE_RISING)?mask:0;
+	pinentries[idx].falling=(edge&PIN_EDGE_FALLING)?mask:0;
+	pinentries[idx].handler=handler;
+	pinentries[idx].count=0;
+	pinnentries=idx+1;
 
-	// now set up the pin change ints on A1. We use pin change interrupt 0,
-	// as this is used by both encoder and beam-breaker tacho
+	lastPinC=(lastPinC&~mask)|(PINC&mask);
+	PCMSK1 |= mask;
+	PCICR  |= 0b00000010;	// PCIE1
 
-	PCMSK1 |= 0b00001010;	// Interrupts on PC3 (tacho) and PC1 (encoder)
+	SREG=sreg;
+	return (PINHANDLE)idx;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// PINGetCount
+///
+/// Number of times an entry's handler has been called
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: PINHANDLE pin - from PINAddHandler
+/// @return: unsigned int - count, or zero if there is no such entry
+///
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned int PINGetCount(PINHANDLE pin)
+{
+	unsigned int count;
+
+	if(pin<0 || pin>=pinnentries) {
+		return 0;
+	}
+
+	unsigned char sreg=SREG;
+	cli();
+	count=pinentries[pin].count;
+	SREG=sreg;
+	return count;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 /// ISR - Pin change interrupt
 ///
-/// This ISR is triggered when the beam is brkoen
+/// One sample of the port, one XOR against the last to find what changed,
+/// then a walk down the table. An entry that is not interested costs two
+/// ANDs and a test.
 ///
 /// @context: INTERRUPT
 /// @scope: INTERNAL
@@ -63,20 +136,25 @@ void PINInitialize(void)
 
 ISR(PCINT1_vect)
 {
-	// Ok. The problem here is that the rotary encoder is on the same
-	// interrupt as the beam-breaker. We need to discriminate. So we
-	// look for a positive edge change over the previous value of the pin.
+	PRF_SCOPE(PRF_ISR_PCINT1);
+
 	PORTD |= 0b00000100;	//PD2 on
 
-	if(PINC&0b00001000 && !(lastPinC&0b00001000)) {
-		REVInterruptHandler();
-	}
+	unsigned char pins=PINC;
+	unsigned char changed=pins^lastPinC;
+	unsigned char rising=changed&pins;
+	unsigned char falling=changed&~pins;
+	unsigned char n=pinnentries;
+	volatile PINENTRY * entry=pinentries;
 
-	if(PINC&0b00000010 && !(lastPinC&0b00000010)) {
-		ENCInterruptHandler();
+	lastPinC=pins;
+
+	for(;n;n--,entry++) {
+		if((entry->rising&rising) | (entry->falling&falling)) {
+			entry->count++;
+			entry->handler(pins);
+		}
 	}
 
-	lastPinC=PINC&0b00001010;
 	PORTD &= ~0b00000100;	//PD2 off
-
 }
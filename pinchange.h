@@ -5,6 +5,15 @@
 /// that services multiple modules - so it is handled here by the ISR and
 /// dispatched then to the modules that need it.
 ///
+/// Each module registers the pins it wants, the edges it wants on them and
+/// a handler (PINAddHandler). The ISR samples the port once, works out
+/// which pins rose and which fell since last time, and calls the handler
+/// of every entry with an edge it asked for, in the order they were
+/// registered. So the tacho, registered first, is the first test the ISR
+/// makes. Each entry counts the edges it has been called for.
+///
+/// Only port C (PCINT1) is used on this board, so only its bank is built.
+///
 /// Dr J A Gow 2022
 ///
 //////////////////////////////////////////////////////////////////////////////
@@ -12,16 +21,71 @@
 #ifndef PINCHANGE_H_
 #define PINCHANGE_H_
 
+//
+// Room in the table. Each entry is 6 bytes of RAM, and costs a few cycles
+// of every pin change interrupt.
+
+#define PIN_MAX_HANDLERS	4
+
+//
+// Which edges an entry wants
+
+#define PIN_EDGE_RISING		0x01
+#define PIN_EDGE_FALLING	0x02
+#define PIN_EDGE_BOTH		(PIN_EDGE_RISING|PIN_EDGE_FALLING)
+
+//
+// A handler is passed the port as the ISR sampled it
+
+typedef void (*PINHANDLER)(unsigned char pins);
+
+//
+// An entry is named by its place in the table
+
+typedef signed char PINHANDLE;
+
+#define PIN_NONE			(-1)
 
 ///////////////////////////////////////////////////////////////////////////////
 /// PINInitialize
 ///
-/// This is called once at system startup. This function enables the pin change
-/// functionality and enables the interrupt associated with it
+/// This is called once at system startup, before any module registers a
+/// handler. It empties the table; the interrupt is enabled as the first
+/// handler is added.
 ///
 ///////////////////////////////////////////////////////////////////////////////
 
 void PINInitialize(void);
 
+///////////////////////////////////////////////////////////////////////////////
+/// PINAddHandler
+///
+/// Add an entry to the table, and enable the pin change interrupt on its
+/// pins. The pins should already be set up as inputs.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: unsigned char mask - port C pins, one bit each
+/// @param: unsigned char edge - PIN_EDGE_RISING, PIN_EDGE_FALLING or PIN_EDGE_BOTH
+/// @param: PINHANDLER handler - called from the ISR on each such edge
+/// @return: PINHANDLE - the entry, or PIN_NONE if the table is full
+///
+///////////////////////////////////////////////////////////////////////////////
+
+PINHANDLE PINAddHandler(unsigned char mask, unsigned char edge, PINHANDLER handler);
+
+///////////////////////////////////////////////////////////////////////////////
+/// PINGetCount
+///
+/// Number of times an entry's handler has been called. It wraps at 16 bits.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: PINHANDLE pin - from PINAddHandler
+/// @return: unsigned int - count, or zero if there is no such entry
+///
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned int PINGetCount(PINHANDLE pin);
 
 #endif
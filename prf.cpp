@@ -0,0 +1,325 @@
+///////////////////////////////////////////////////////////////////////////////
+/// PRF.CPP
+///
+/// Execution time profiler. See prf.h.
+///
+/// The dump is built a line at a time into a buffer and handed to the
+/// UART as fast as its transmit ring will take it, so no task pass is held
+/// up waiting for the serial port.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#include <Arduino.h>
+#include <string.h>
+#include <kernel.h>
+#include "prf.h"
+
+#ifdef PRF_ENABLE
+
+#include "uart.h"
+#include "fmt.h"
+#include "revcount.h"
+#include "sched.h"
+
+//
+// Figures for one probe. When the run count would overflow, everything is
+// halved, so the mean and histogram keep following what the code does now
+// rather than freezing.
+
+typedef struct _PRFPROBE {
+
+	unsigned int	count;
+	unsigned long	total;				// ticks
+	unsigned int	min;
+	unsigned int	max;
+	unsigned int	hist[PRF_BUCKETS];
+
+} PRFPROBE;
+
+static const char prfnames[PRF_NUM_PROBES][8] PROGMEM = {
+	"pcint1",
+	"timer1",
+	"timer2",
+	"twi",
+	"uart",
+	"pwm",
+	"control",
+	"display",
+	"keypad",
+	"iic",
+	"event",
+	"msgs"
+};
+
+//
+// Longest dump line: the name, five labelled figures and the rest of the
+// histogram at up to 5 digits and a separator each, CR LF, and room for
+// the terminator FMTUnsigned writes.
+
+#define PRF_LINE_LEN	(7+3+4*5+5*6+(PRF_BUCKETS-1)*6+2+1)
+
+//
+// Module variables. probes[] is written by interrupts for the ISR probes,
+// so is only touched with interrupts off.
+
+static PRFPROBE probes[PRF_NUM_PROBES];
+static char prfline[PRF_LINE_LEN];
+static unsigned char prflen=0;			// bytes in prfline
+static unsigned char prfsent=0;			// of which sent
+static signed char prfdump=-1;			// next dump line, -1 if none
+
+void PRFTask(void * context);
+void PRFDumpCommand(void);
+
+///////////////////////////////////////////////////////////////////////////////
+/// PRFReset
+///
+/// Clear all the figures
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void PRFReset(void)
+{
+	unsigned char sreg=SREG;
+	cli();
+
+	memset(probes,0,sizeof(probes));
+	for(unsigned char id=0;id<PRF_NUM_PROBES;id++) {
+		probes[id].min=0xffff;
+	}
+
+	SREG=sreg;
+}
+
+/////////////////////////////
+/// Exported functions
+/////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// PRFInitialize
+///
+/// Clear the figures and register the task that serves the serial port
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void PRFInitialize(void)
+{
+	PRFReset();
+	prflen=prfsent=0;
+	prfdump=-1;
+
+	SCHAddTask(PRFTask,(void *)NULL,0,0,SCH_PRIO_LOW);
+	UARTAddCommand('p',PRFDumpCommand);
+	UARTAddCommand('r',PRFReset);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// PRFStart
+///
+/// Timestamp the entry to a probe
+///
+/// @scope: EXPORTED
+/// @context: TASK or INTERRUPT
+/// @param: NONE
+/// @return: unsigned long - timestamp to hand to PRFStop
+///
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned long PRFStart(void)
+{
+	unsigned long now;
+	unsigned char sreg=SREG;
+	cli();
+
+	now=REVTimestamp();
+
+	SREG=sreg;
+	return now;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// PRFStop
+///
+/// Account for a run of a probe that started at the given timestamp
+///
+/// @scope: EXPORTED
+/// @context: TASK or INTERRUPT
+/// @param: unsigned char id - probe
+/// @param: unsigned long start - from PRFStart
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void PRFStop(unsigned char id, unsigned long start)
+{
+	PRFPROBE * pr=&probes[id];
+	unsigned long ticks;
+	unsigned long rem;
+	unsigned char bucket=0;
+	unsigned char sreg=SREG;
+	cli();
+
+	ticks=REVTimestamp()-start;
+	for(rem=ticks;rem && bucket<PRF_BUCKETS-1;rem>>=1) {
+		bucket++;
+	}
+
+	if(pr->count==0xffff) {
+		pr->count>>=1;
+		pr->total>>=1;
+		for(unsigned char idx=0;idx<PRF_BUCKETS;idx++) {
+			pr->hist[idx]>>=1;
+		}
+	}
+	pr->count++;
+	pr->total+=ticks;
+	pr->hist[bucket]++;
+	if(ticks>0xffff) {
+		ticks=0xffff;
+	}
+	if(ticks<pr->min) {
+		pr->min=(unsigned int)ticks;
+	}
+	if(ticks>pr->max) {
+		pr->max=(unsigned int)ticks;
+	}
+
+	SREG=sreg;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// PRFAppend / PRFAppendNum
+///
+/// Add text, or a space and a number, to the line being built
+///
+/// @scope: INTERNAL
+/// @context: TASK
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void PRFAppend(const char * str)
+{
+	while(*str) {
+		prfline[prflen++]=*str++;
+	}
+}
+
+static void PRFAppendNum(const char * label, unsigned int value)
+{
+	PRFAppend(label);
+	prflen+=FMTUnsigned(&prfline[prflen],value,0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// PRFBuildLine
+///
+/// Build the next line of the dump: a header giving the tick length, then
+/// one line per probe of
+///
+///   name n=runs min=ticks max=ticks avg=ticks h=bucket0 ... bucketN
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: unsigned char line - zero for the header, then 1 + probe
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void PRFBuildLine(unsigned char line)
+{
+	PRFPROBE pr;
+
+	prflen=prfsent=0;
+	if(!line) {
+		PRFAppendNum("PRF us/tick=",(unsigned int)(1000000UL/REV_TICKS_PER_SEC));
+		PRFAppend("\r\n");
+		return;
+	}
+
+	// A consistent copy: the ISR probes may update at any time.
+
+	unsigned char sreg=SREG;
+	cli();
+	memcpy(&pr,&probes[line-1],sizeof(pr));
+	SREG=sreg;
+
+	for(unsigned char idx=0;idx<sizeof(prfnames[0]);idx++) {
+		char c=pgm_read_byte(&prfnames[line-1][idx]);
+
+		if(!c) {
+			break;
+		}
+		prfline[prflen++]=c;
+	}
+	PRFAppendNum(" n=",pr.count);
+	PRFAppendNum(" min=",pr.count?pr.min:0);
+	PRFAppendNum(" max=",pr.max);
+	PRFAppendNum(" avg=",pr.count?(unsigned int)(pr.total/pr.count):0);
+	PRFAppendNum(" h=",pr.hist[0]);
+	for(unsigned char idx=1;idx<PRF_BUCKETS;idx++) {
+		PRFAppendNum(" ",pr.hist[idx]);
+	}
+	PRFAppend("\r\n");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// PRFDumpCommand
+///
+/// Start a dump, unless one is already going. Called by the UART task on
+/// a 'p'.
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void PRFDumpCommand(void)
+{
+	if(prfdump<0) {
+		prfdump=0;
+		PRFBuildLine(prfdump);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// PRFTask
+///
+/// Feed any dump in progress to the UART
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: void * context - unused
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void PRFTask(void * context)
+{
+	while(prfdump>=0) {
+		while(prfsent<prflen) {
+			if(UARTPutChar(prfline[prfsent])) {
+				return;					// busy, carry on next pass
+			}
+			prfsent++;
+		}
+		if(++prfdump>PRF_NUM_PROBES) {
+			prfdump=-1;
+		} else {
+			PRFBuildLine(prfdump);
+		}
+	}
+}
+
+#endif
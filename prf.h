@@ -0,0 +1,113 @@
+///////////////////////////////////////////////////////////////////////////////
+/// PRF.H
+///
+/// Execution time profiler. Each probe is a piece of code - a task handler,
+/// the message handlers, an ISR - timed from entry to exit against Timer1
+/// (REVTimestamp, 4us ticks). Per probe we keep the number of runs, min,
+/// max, mean and a log2 histogram of the run time. Send 'p' on the serial
+/// port for a dump, 'r' to clear the figures.
+///
+/// Times are inclusive: a task probe also counts any interrupts that ran
+/// while it did. The histogram shows how often that happens.
+///
+/// The profiler is only built in with PRF_ENABLE defined. Without it the
+/// probes compile to nothing and the module is empty.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _PRF_H_
+#define _PRF_H_
+
+//
+// Define to build the profiler in. It costs about 300 bytes of RAM and a
+// few microseconds per probe.
+
+//#define PRF_ENABLE
+
+//
+// Histogram buckets. Bucket 0 holds runs under one tick, bucket n runs of
+// 2^(n-1) to 2^n-1 ticks, and the last everything longer: with 10 buckets
+// that is 256 ticks (1ms, a whole task loop budget) and up.
+
+#define PRF_BUCKETS		10
+
+//
+// The probes
+
+typedef enum _PRFID {
+
+	PRF_ISR_PCINT1,
+	PRF_ISR_TIMER1,
+	PRF_ISR_TIMER2,
+	PRF_ISR_TWI,
+	PRF_ISR_UART,
+	PRF_ISR_PWM,
+	PRF_TASK_CONTROL,
+	PRF_TASK_DISPLAY,
+	PRF_TASK_KEYPAD,
+	PRF_TASK_IIC,
+	PRF_TASK_EVENT,
+	PRF_MESSAGES,				// all message handlers together
+	PRF_NUM_PROBES
+
+} PRFID;
+
+#ifdef PRF_ENABLE
+
+//
+// Exported functions
+
+///////////////////////////////////////////////////////////////////////////////
+/// PRFInitialize
+///
+/// Clear the figures and register the task that serves the serial port.
+/// Call after REVInitialize (which starts Timer1), SCHInitialize and
+/// UARTInitialize.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void PRFInitialize(void);
+
+///////////////////////////////////////////////////////////////////////////////
+/// PRFStart / PRFStop
+///
+/// Timestamp the entry to a probe, and account for its run at the exit.
+/// Use PRF_SCOPE rather than calling these.
+///
+/// @scope: EXPORTED
+/// @context: TASK or INTERRUPT
+///
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned long PRFStart(void);
+void PRFStop(unsigned char id, unsigned long start);
+
+//
+// Times from here to the end of the enclosing block, whichever way it is
+// left. Put it first in a task handler or ISR.
+
+class PRFScope
+{
+public:
+	PRFScope(unsigned char probe) : id(probe), start(PRFStart()) {}
+	~PRFScope() { PRFStop(id,start); }
+
+private:
+	unsigned char	id;
+	unsigned long	start;
+};
+
+#define PRF_SCOPE(id)	PRFScope prfscope(id)
+
+#else
+
+#define PRF_SCOPE(id)
+
+#endif
+
+#endif
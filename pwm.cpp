@@ -9,6 +9,22 @@
 
 #include <kernel.h>
 #include "pwm.h"
+#include "prf.h"
+
+#if PWM_DITHER_BITS
+
+#define PWM_DITHER_MASK		((1U<<PWM_DITHER_BITS)-1)
+
+//
+// The compare B match is placed half way through the PWM period, well
+// clear of BOTTOM, where the buffered OCR0A is loaded.
+
+#define PWM_UPDATE_AT		0x80
+
+static volatile unsigned int pwmduty=0;		// the duty asked for
+static unsigned int pwmresidue=0;			// fraction not yet sent, interrupt only
+
+#endif
 
 ///////////////////////////////////////////////////////////////////////////////
 /// PWMInitialize
@@ -16,7 +32,8 @@
 /// This is called once at system startup. This function sets the PWM function
 /// of Timer0. The core libraries use Timer0 to produce a 1ms timer tick - it
 /// is easy to extend this to generate 8-bit PWM with a 1ms period and a period
-/// register range of 0-0xff
+/// register range of 0-0xff. With dithering, the compare B interrupt is
+/// enabled as well.
 ///
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -25,22 +42,67 @@ void PWMInitialize(void)
 	DDRD|=0b01000000;		// PD6 to output
 	TCCR0A |= 0b10000011;	// Clear on match, fast pwm mode
 	OCR0A = 0;				// set duty to zero on init
+
+#if PWM_DITHER_BITS
+	pwmduty=0;
+	pwmresidue=0;
+	OCR0B = PWM_UPDATE_AT;	// OC0B stays disconnected: only the interrupt
+	TIMSK0 |= 0b00000100;	// OCIE0B
+#endif
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 /// PWMSetDuty
 ///
-/// Set the duty cycle. The argument is an unsigned char, yielding duty
-/// between 0 (0x00) and 1 (0xff)
+/// Set the duty cycle, in PWM_DUTY_BITS: from 0 to PWM_DUTY_MAX, which is
+/// the old 8 bit duty shifted up by PWM_DITHER_BITS
 ///
 /// @scope: EXPORTED
 /// @context: ANY
-/// @param: unsigned char duty - value of duty between 0x00 and 0xff
+/// @param: unsigned int duty - value of duty between 0 and PWM_DUTY_MAX
 /// @return: none
 ///
 ///////////////////////////////////////////////////////////////////////////////
 
-void PWMSetDuty(unsigned char duty)
+void PWMSetDuty(unsigned int duty)
 {
+	if(duty>PWM_DUTY_MAX) {
+		duty=PWM_DUTY_MAX;
+	}
+
+#if PWM_DITHER_BITS
+	// Two bytes: keep the modulator from seeing half of it
+	unsigned char sreg=SREG;
+	cli();
+	pwmduty=duty;
+	SREG=sreg;
+#else
 	OCR0A=duty;
+#endif
 }
+
+#if PWM_DITHER_BITS
+
+///////////////////////////////////////////////////////////////////////////////
+/// ISR - Timer 0 compare match B
+///
+/// The sigma-delta modulator, once per PWM period. The duty plus the
+/// residue can not reach beyond the next whole step, so the register
+/// never overflows: at PWM_DUTY_MAX it simply stays at 0xff.
+///
+/// @context: INTERRUPT
+/// @scope: INTERNAL
+///
+///////////////////////////////////////////////////////////////////////////////
+
+ISR(TIMER0_COMPB_vect)
+{
+	PRF_SCOPE(PRF_ISR_PWM);
+
+	unsigned int acc=pwmduty+pwmresidue;
+
+	OCR0A=(unsigned char)(acc>>PWM_DITHER_BITS);
+	pwmresidue=acc&PWM_DITHER_MASK;
+}
+
+#endif
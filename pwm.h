@@ -10,6 +10,25 @@
 #ifndef PWM_H_
 #define PWM_H_
 
+//
+// Duty resolution. Timer0 is shared with the core's millisecond tick, so
+// it has to stay in 8 bit fast PWM at /64, and OCR0A only holds 8 bits.
+// The PWM_DITHER_BITS below those are made up by first order sigma-delta
+// (error feedback) modulation: once per PWM period the compare B interrupt
+// writes the whole part of the duty plus whatever fraction has built up,
+// and carries the remainder into the next period. Over 2^PWM_DITHER_BITS
+// periods (16ms at 4 bits) the average duty is exact to PWM_DUTY_BITS,
+// which the motor's inertia smooths out completely.
+//
+// Set PWM_DITHER_BITS to 0 to write OCR0A directly, with no interrupt.
+
+#define PWM_DITHER_BITS		4
+#define PWM_DUTY_BITS		(8+PWM_DITHER_BITS)
+#define PWM_DUTY_MAX		(255U<<PWM_DITHER_BITS)		// full on
+
+#if PWM_DITHER_BITS<0 || PWM_DITHER_BITS>8
+#error PWM_DITHER_BITS must be from 0 to 8
+#endif
 
 ///////////////////////////////////////////////////////////////////////////////
 /// PWMInitialize
@@ -17,7 +36,8 @@
 /// This is called once at system startup. This function sets the PWM function
 /// of Timer0. The core libraries use Timer0 to produce a 1ms timer tick - it
 /// is easy to extend this to generate 8-bit PWM with a 1ms period and a period
-/// register range of 0-0xff
+/// register range of 0-0xff. With dithering, the compare B interrupt is
+/// enabled as well.
 ///
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -26,17 +46,17 @@ void PWMInitialize(void);
 ///////////////////////////////////////////////////////////////////////////////
 /// PWMSetDuty
 ///
-/// Set the duty cycle. The argument is an unsigned char, yielding duty
-/// between 0 (0x00) and 1 (0xff)
+/// Set the duty cycle, in PWM_DUTY_BITS: from 0 to PWM_DUTY_MAX, which is
+/// the old 8 bit duty shifted up by PWM_DITHER_BITS
 ///
 /// @scope: EXPORTED
 /// @context: ANY
-/// @param: unsigned char duty - value of duty between 0x00 and 0xff
+/// @param: unsigned int duty - value of duty between 0 and PWM_DUTY_MAX
 /// @return: none
 ///
 ///////////////////////////////////////////////////////////////////////////////
 
-void PWMSetDuty(unsigned char duty);
+void PWMSetDuty(unsigned int duty);
 
 
 #endif
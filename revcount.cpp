@@ -10,6 +10,9 @@
 #include <kernel.h>
 #include "revcount.h"
 #include "control.h"
+#include "prf.h"
+#include "pinchange.h"
+#include "common.h"
 
 //
 // Module variables used by interrupt context.
@@ -17,6 +20,94 @@
 unsigned long currpscount=0;
 unsigned long rpscount=0;
 
+static volatile unsigned long revepoch=0;		// Timer1 ticks at the last sample
+static volatile unsigned long revlastedge=0;	// timestamp of the last rising edge
+static volatile unsigned long revperiod=0;		// ticks between the last two edges
+static volatile unsigned char revedges=0;		// edges seen, up to 2
+static volatile unsigned int revglitches=0;		// edges dropped by the filter
+
+static REVESTIMATE revestimate={0,1,0};			// made at each sample
+
+//
+// The sliding window: for each of the last REV_WINDOW_LOOPS samples, the
+// pulses counted in its loop period and the last edge as of its end. The
+// entry at revslot is the oldest, as of one whole window ago.
+
+static unsigned int revcounts[REV_WINDOW_LOOPS];
+static unsigned long revwinedge[REV_WINDOW_LOOPS];
+static unsigned char revwinvalid[REV_WINDOW_LOOPS];	// revwinedge is a real edge
+static unsigned char revslot=0;
+static unsigned long revwincount=0;				// sum of revcounts
+
+#if REV_MEDIAN_PERIODS
+
+//
+// The last REV_MEDIAN_PERIODS pulse periods, in no particular order, and
+// how many of them are from since the motor last started
+
+static unsigned long revperiods[REV_MEDIAN_PERIODS];
+static unsigned char revpslot=0;
+static unsigned char revnperiods=0;
+
+#endif
+
+//
+// Below 1 RPS we call the motor stopped, rather than wait ever longer for
+// the next edge.
+
+#define REV_STOPPED_TICKS	(REV_TICKS_PER_SEC/REV_PULSES_PER_REV)
+
+//
+// The shortest pulse period the motor can make, at REV_GLITCH_PERCENT of
+// RPS_MAX. At /64 that is 185 ticks, 0.74ms.
+
+#define REV_MIN_PERIOD_TICKS	((REV_TICKS_PER_SEC*100UL)/(RPS_MAX*1UL*REV_GLITCH_PERCENT*REV_PULSES_PER_REV))
+
+#if REV_MIN_PERIOD_TICKS<1
+#error REV_GLITCH_PERCENT of RPS_MAX is faster than Timer1 can time
+#endif
+
+//
+// Scale from counts per speed window to RPS in the PI loop's fixed point
+// format, worked out by the compiler so no floating point reaches the
+// target. (This was the magic 0.39: a 0.131s window times 3 pulses.) The
+// scale carries REV_COUNT_FRAC more fraction bits than the result, so
+// rounding it does not bias the speed.
+
+#define REV_COUNTS_PER_RPS	(REV_WINDOW_SECONDS*REV_PULSES_PER_REV)
+#define REV_COUNT_FRAC		8
+#define REV_COUNT_TO_RPS	((unsigned long)((1UL<<(CTRL_RPS_FRAC+REV_COUNT_FRAC))/REV_COUNTS_PER_RPS+0.5))
+#define REV_RPS_FIXED_MAX	(1023<<CTRL_RPS_FRAC)
+
+//
+// RPS in the same format from a period in ticks: this over the period
+
+#define REV_PERIOD_TO_RPS	((REV_TICKS_PER_SEC<<CTRL_RPS_FRAC)/REV_PULSES_PER_REV)
+
+//
+// The M/T estimate multiplies REV_PERIOD_TO_RPS by the pulse count, so
+// the count must be limited to keep that in 32 bits (at /64 that is 3221
+// pulses in a window, far beyond any real speed).
+
+#define REV_MT_MAX_COUNT	(0xffffffffUL/REV_PERIOD_TO_RPS)
+
+//
+// Clock select bits for the prescaler
+
+#if REV_PRESCALER==1
+#define REV_CS_BITS			0b001
+#elif REV_PRESCALER==8
+#define REV_CS_BITS			0b010
+#elif REV_PRESCALER==64
+#define REV_CS_BITS			0b011
+#elif REV_PRESCALER==256
+#define REV_CS_BITS			0b100
+#elif REV_PRESCALER==1024
+#define REV_CS_BITS			0b101
+#else
+#error REV_PRESCALER must be 1, 8, 64, 256 or 1024
+#endif
+
 ///////////////////////////////////////////////////////////////////////////////
 /// REVInitialize
 ///
@@ -29,26 +120,167 @@ unsigned long rpscount=0;
 void REVInitialize(void)
 {
 	// this section sets up Timer1 to give an interrupt every
-	// 0.262144 seconds. We use this to count revs.
-	// We have a 16MHz clock. We use the prescaler to divide by 64, then
-	// the timer will overflow every 65536 cycles. With a 16MHz clock, that is
-	// 0.262144 seconds.
-	//
-	// We then set up in CTC mode, so we can alter the resolution and get
-	// the loop running faster. We know we have enough time, so we can
-	// increase the sample rate a little - even by a factor of 2.
+	// REV_LOOP_TICKS ticks of F_CPU/REV_PRESCALER: the PI loop's sample.
+	// In CTC mode the counter clears on the tick after it matches OCR1A,
+	// so the period is OCR1A+1 ticks, and stays the same without the ISR
+	// touching the timer.
 
 	TCCR1A=0;
-	TCCR1B=0b00001011; 		// prescaler /64, set WGM12 to change resolution
-	OCR1A = 0x7fff;			// half the value
-	TIMSK1 = 0b00000010;	// int on capture/compare A only (clock/0xffff)
+	TCCR1B=(1<<WGM12)|REV_CS_BITS;	// CTC on OCR1A
+	OCR1A = REV_LOOP_TICKS-1;
+	TIMSK1 = 0b00000010;	// int on capture/compare A only
 
 	// this next section sets up the beam-breaker so we can generate
 	// an interrupt every time the beam is broken
 
 	DDRC &= ~0b00001000;	// beam-breaker on pin PC3
-	PCMSK1 |= 0b00001000;	// PCINT11 enabled
-	PCICR  |= 0b00000010;	// PCIE1 enabled
+
+	// The tacho counts rising edges. It registers first, so it is the
+	// first entry the pin change ISR tests.
+
+	PINAddHandler(0b00001000,PIN_EDGE_RISING,REVInterruptHandler);
+}
+
+#if REV_MODE!=REV_MODE_COUNT
+
+#if REV_MEDIAN_PERIODS
+
+///////////////////////////////////////////////////////////////////////////////
+/// REVMedianPeriod
+///
+/// The median of the recent pulse periods, by insertion sort of a copy.
+/// Until there are enough since the motor started, the latest alone.
+///
+/// @context: INTERRUPT (or with interrupts disabled)
+/// @scope: INTERNAL
+/// @param: NONE
+/// @return: unsigned long - period in ticks
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static unsigned long REVMedianPeriod(void)
+{
+	unsigned long sorted[REV_MEDIAN_PERIODS];
+	unsigned char idx;
+	unsigned char pos;
+
+	if(revnperiods<REV_MEDIAN_PERIODS) {
+		return revperiod;
+	}
+	for(idx=0;idx<REV_MEDIAN_PERIODS;idx++) {
+		unsigned long p=revperiods[idx];
+
+		for(pos=idx;pos && sorted[pos-1]>p;pos--) {
+			sorted[pos]=sorted[pos-1];
+		}
+		sorted[pos]=p;
+	}
+	return sorted[REV_MEDIAN_PERIODS/2];
+}
+
+#define REV_PERIOD()	REVMedianPeriod()
+#else
+#define REV_PERIOD()	revperiod
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// REVGetPeriod
+///
+/// The current pulse period in Timer1 ticks. If it has been longer than
+/// that since the last edge the motor is slowing down, and the time since
+/// the edge is a better (upper) bound.
+///
+/// @context: INTERRUPT (or with interrupts disabled)
+/// @scope: INTERNAL
+/// @param: NONE
+/// @return: unsigned long - period in ticks, or zero if stopped
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static unsigned long REVGetPeriod(void)
+{
+	unsigned long since;
+	unsigned long period;
+
+	if(revedges<2) {
+		return 0;
+	}
+	since=REVTimestamp()-revlastedge;
+	if(since>REV_STOPPED_TICKS) {
+		return 0;
+	}
+	period=REV_PERIOD();
+	return (since>period)?since:period;
+}
+
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// REVUpdateEstimate
+///
+/// Make the speed estimate for the sample just ended, in whichever mode is
+/// built. In REV_MODE_MT the pulses counted in the window and the time
+/// between the last edge now and the last edge as of the start of the
+/// window describe exactly the same stretch of rotation, so their ratio
+/// has the resolution of a timer tick over up to a whole window.
+///
+/// @context: INTERRUPT
+/// @scope: INTERNAL
+/// @param: unsigned long count - pulses counted in the window
+/// @param: unsigned long fromedge - the last edge as of the window start
+/// @param: unsigned char fromvalid - nonzero if fromedge is a real edge
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void REVUpdateEstimate(unsigned long count, unsigned long fromedge, unsigned char fromvalid)
+{
+	unsigned long rps;
+	unsigned long res;
+
+#if REV_MODE==REV_MODE_COUNT
+	rps=(count*REV_COUNT_TO_RPS)>>REV_COUNT_FRAC;
+	res=REV_COUNT_TO_RPS>>REV_COUNT_FRAC;
+#else
+	unsigned long ticks=0;
+
+#if REV_MODE==REV_MODE_MT
+	if(count>REV_MT_MAX_COUNT) {
+		count=REV_MT_MAX_COUNT;
+	}
+	if(count && fromvalid) {
+		ticks=revlastedge-fromedge;
+		rps=ticks?(REV_PERIOD_TO_RPS*count)/ticks:0;
+	}
+	if(!ticks)
+#endif
+	{
+		// a single period, or the time since the last edge
+		ticks=REVGetPeriod();
+		rps=ticks?REV_PERIOD_TO_RPS/ticks:0;
+	}
+
+	if(!count) {
+		// nothing arrived in the window: rps is a bound, not a measurement
+		res=rps;
+	} else {
+		res=ticks?rps/ticks+1:rps;
+	}
+#endif
+
+	if(rps>REV_RPS_FIXED_MAX) {
+		rps=REV_RPS_FIXED_MAX;
+	}
+	if(res<(1<<CTRL_RPS_FRAC) && !rps) {
+		res=(1<<CTRL_RPS_FRAC);			// stopped: we only know it is under 1 RPS
+	}
+	if(res>REV_RPS_FIXED_MAX) {
+		res=REV_RPS_FIXED_MAX;
+	}
+
+	revestimate.rps=(int)rps;
+	revestimate.resolution=res?(unsigned int)res:1;
+	revestimate.pulses=(count>255)?255:(unsigned char)count;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -67,7 +299,87 @@ void REVInitialize(void)
 
 double REVGetRevsPerSec(void)
 {
-	return ((double)currpscount)/0.39;
+#if REV_MODE==REV_MODE_MT
+	return ((double)REVGetRevsPerSecFixed())/(1<<CTRL_RPS_FRAC);
+#elif REV_MODE==REV_MODE_PERIOD
+	unsigned char sreg=SREG;
+	unsigned long period;
+
+	cli();
+	period=REVGetPeriod();
+	SREG=sreg;
+
+	return period?((double)REV_TICKS_PER_SEC/REV_PULSES_PER_REV)/period:0.0;
+#else
+	return ((double)currpscount)/REV_COUNTS_PER_RPS;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// REVGetRevsPerSecFixed
+///
+/// As REVGetRevsPerSec, but computed in integer arithmetic and returned in
+/// the fixed point format used by the PI loop (see CTRL_RPS_FRAC in
+/// control.h). The result is limited to 1023 RPS so the controller error can
+/// never overflow. This is the version used on the sample interrupt path.
+///
+/// @context: ANY
+/// @scope: EXPORTED
+/// @param: NONE
+/// @return: int - revs per second, Q11.4
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int REVGetRevsPerSecFixed(void)
+{
+#if REV_MODE==REV_MODE_MT
+	unsigned char sreg=SREG;
+	unsigned long rps;
+
+	cli();
+	rps=revestimate.rps;
+	SREG=sreg;
+#elif REV_MODE==REV_MODE_PERIOD
+	unsigned char sreg=SREG;
+	unsigned long period;
+	unsigned long rps;
+
+	cli();
+	period=REVGetPeriod();
+	SREG=sreg;
+
+	if(!period) {
+		return 0;
+	}
+	rps=REV_PERIOD_TO_RPS/period;
+#else
+	unsigned long rps=(currpscount*REV_COUNT_TO_RPS)>>REV_COUNT_FRAC;
+#endif
+
+	return (rps>REV_RPS_FIXED_MAX)?REV_RPS_FIXED_MAX:(int)rps;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// REVGetEstimate
+///
+/// Get the speed estimate made at the last sample, with its resolution.
+/// In REV_MODE_COUNT and REV_MODE_PERIOD this is filled in from the same
+/// measurement REVGetRevsPerSecFixed uses.
+///
+/// @context: ANY
+/// @scope: EXPORTED
+/// @param: REVESTIMATE * est - filled in
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void REVGetEstimate(REVESTIMATE * est)
+{
+	unsigned char sreg=SREG;
+
+	cli();
+	*est=revestimate;
+	SREG=sreg;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -109,9 +421,9 @@ void REVEnableOvfInterrupt(void)
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-/// ISR - Timer 1 overflow.
+/// ISR - Timer 1 compare match A.
 ///
-/// This ISR is triggered every time the timer 1 overflow wraps around
+/// This ISR is triggered every REV_LOOP_TICKS, by the CTC clear.
 /// THIS IS OUR SAMPLE EVENT INTERRUPT.
 ///
 /// @context: INTERRUPT
@@ -121,28 +433,147 @@ void REVEnableOvfInterrupt(void)
 
 ISR(TIMER1_COMPA_vect)
 {
-	OCR1A = 0x7fff;			// half the value
+	unsigned long fromedge;
+	unsigned char fromvalid;
+	unsigned int count;
+
+	// A new loop period starts on this match: extend the timestamps.
+	revepoch+=REV_LOOP_TICKS;
+
+	// Only now is REVTimestamp right again, so the probe starts here. It
+	// still covers the speed estimate and the PI loop, which are the bulk.
+	PRF_SCOPE(PRF_ISR_TIMER1);
 
 	// if this is called, we need to count the number of pin-change
-	// interrupts we have, and save this in the currpm global.
-	currpscount=rpscount;
+	// interrupts we have. The window slides on by one loop period: this
+	// period's count replaces the oldest in the sum, and the oldest
+	// entry's edge marks where the window now starts.
+	count=(rpscount>0xffff)?0xffff:(unsigned int)rpscount;
 	rpscount=0;
 
+	revwincount+=count;
+	revwincount-=revcounts[revslot];
+	revcounts[revslot]=count;
+	fromedge=revwinedge[revslot];
+	fromvalid=revwinvalid[revslot];
+	revwinedge[revslot]=revlastedge;
+	revwinvalid[revslot]=(revedges!=0);
+	if(++revslot>=REV_WINDOW_LOOPS) {
+		revslot=0;
+	}
+
+	currpscount=revwincount;
+	REVUpdateEstimate(currpscount,fromedge,fromvalid);
+
+#ifdef CTRL_FIXED_POINT
+	CTRLPILoop(REVGetRevsPerSecFixed());
+#else
 	CTRLPILoop(REVGetRevsPerSec());
+#endif
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 /// REVInterruptHandler
 ///
-/// This ISR is triggered when the beam is brkoen
+/// Called from the pin change ISR each time the beam is broken
 ///
 /// @context: INTERRUPT
 /// @scope: INTERNAL
+/// @param: unsigned char pins - PINC as sampled by the ISR, unused
+/// @return: none
 ///
 ///////////////////////////////////////////////////////////////////////////////
 
-void REVInterruptHandler(void)
+void REVInterruptHandler(unsigned char pins)
 {
+	unsigned long now=REVTimestamp();
+	unsigned long period=now-revlastedge;
+
+	// An edge sooner than the motor could turn is noise, or the last one
+	// bouncing. Drop it: the next is timed from the last good edge.
+	if(revedges && period<REV_MIN_PERIOD_TICKS) {
+		revglitches++;
+		return;
+	}
+
 	// we know we have a valid interrupt from the beam break.
 	rpscount++;
+
+#if REV_MEDIAN_PERIODS
+	if(revedges) {
+		if(period>REV_STOPPED_TICKS) {
+			// From a standstill: forget the old periods, and this one,
+			// which spans the stop.
+			revnperiods=0;
+		} else {
+			revperiods[revpslot]=period;
+			if(++revpslot>=REV_MEDIAN_PERIODS) {
+				revpslot=0;
+			}
+			if(revnperiods<REV_MEDIAN_PERIODS) {
+				revnperiods++;
+			}
+		}
+	}
+#endif
+
+	revperiod=period;
+	revlastedge=now;
+	if(revedges<2) {
+		revedges++;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// REVGetGlitches
+///
+/// Number of beam-break edges the glitch filter has dropped
+///
+/// @context: ANY
+/// @scope: EXPORTED
+/// @param: NONE
+/// @return: unsigned int - count
+///
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned int REVGetGlitches(void)
+{
+	unsigned char sreg=SREG;
+	unsigned int count;
+
+	cli();
+	count=revglitches;
+	SREG=sreg;
+	return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// REVTimestamp
+///
+/// Timer1 time, extended to 32 bits by counting samples. Ticks are
+/// 1/REV_TICKS_PER_SEC seconds and, at /64, wrap after about 4.7 hours;
+/// differences between timestamps wrap cleanly.
+///
+/// @context: INTERRUPT (or with interrupts disabled)
+/// @scope: EXPORTED
+/// @param: NONE
+/// @return: unsigned long - timestamp in Timer1 ticks
+///
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned long REVTimestamp(void)
+{
+	unsigned int cnt=TCNT1;
+	unsigned long base=revepoch;
+
+	// If the compare match is pending the counter may already have cleared,
+	// but the ISR has not yet moved the epoch on: a low count tells us
+	// which side of the clear the read was. OCF1A is set on the same tick
+	// that clears the counter, so with it clear any count, the compare
+	// value included, belongs to the current window.
+
+	if((TIFR1&(1<<OCF1A)) && cnt<REV_LOOP_TICKS/2) {
+		base+=REV_LOOP_TICKS;
+	}
+	return base+cnt;
 }
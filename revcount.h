@@ -10,6 +10,105 @@
 #ifndef REVCOUNT_H_
 #define REVCOUNT_H_
 
+//
+// How speed is measured. REV_MODE_COUNT counts beam-break pulses over each
+// Timer1 sample window. REV_MODE_PERIOD timestamps every rising edge with
+// Timer1 and works speed out from the time between the last two, so each
+// pulse gives a fresh measurement with a resolution of one timer tick.
+//
+// REV_MODE_MT combines the two (the M/T method): at each sample it takes
+// the pulses counted in the window and the time between the last edge of
+// this window and the last edge of the previous one, which spans exactly
+// that many pulses. At high speed that is many pulses over nearly a whole
+// window; at low speed it degrades gracefully to a single period, and when
+// no pulse arrived in the window the time since the last edge still bounds
+// the speed. Each estimate carries its resolution (REVESTIMATE below).
+//
+// The Timer1 input capture pin (ICP1, PB0) is the seven segment clock line,
+// so the timestamp is read in the pin change interrupt instead.
+
+#define REV_MODE_COUNT		0
+#define REV_MODE_PERIOD		1
+#define REV_MODE_MT			2
+
+#define REV_MODE			REV_MODE_MT
+
+//
+// Timing. Timer1 runs at F_CPU/REV_PRESCALER in CTC mode, and each compare
+// match is one sample of the PI loop, every REV_LOOP_TICKS ticks. Speed is
+// measured over the last REV_WINDOW_LOOPS of those samples, a window that
+// slides on by one sample each time, so the loop can run faster than the
+// window without losing the resolution a long window gives. With one loop
+// per window this is the original arrangement: a fresh window each sample.
+//
+// Everything that depends on the timing - the count to RPS scale, the
+// timestamp extension, the loop's gains per sample - is worked out from
+// these by the compiler.
+//
+// The defaults run the loop at about 30Hz over the original 131ms window.
+// REV_LOOP_TICKS must be at most 65536, and REV_PRESCALER one the timer
+// has (1, 8, 64, 256 or 1024). The beam-breaker gives REV_PULSES_PER_REV
+// pulses per rev.
+
+#define REV_PULSES_PER_REV	3
+#define REV_PRESCALER		64
+#define REV_LOOP_TICKS		0x2000UL
+#define REV_WINDOW_LOOPS	4
+
+#define REV_TICKS_PER_SEC	(F_CPU/REV_PRESCALER)
+#define REV_WINDOW_TICKS	(REV_LOOP_TICKS*REV_WINDOW_LOOPS)
+
+#if REV_LOOP_TICKS<2 || REV_LOOP_TICKS>0x10000UL
+#error REV_LOOP_TICKS must be from 2 to 65536
+#endif
+
+#if REV_WINDOW_LOOPS<1 || REV_WINDOW_LOOPS>16
+#error REV_WINDOW_LOOPS must be from 1 to 16
+#endif
+
+//
+// Glitch filter. Every beam-break edge is timestamped, and one that comes
+// sooner after the last good edge than the motor could possibly turn is
+// dropped as noise or a bouncing edge, and counted (REVGetGlitches). The
+// fastest possible is taken as REV_GLITCH_PERCENT of RPS_MAX, which leaves
+// room for overshoot.
+//
+// With REV_MEDIAN_PERIODS set (odd, 3 to 7) the single pulse period the
+// estimators fall back on - all the time in REV_MODE_PERIOD, at low speed
+// in REV_MODE_MT - is the median of that many recent periods, so a glitch
+// that gets past the filter can not drag the speed to a wild value. It
+// costs that many periods of lag. 0 uses the latest period alone.
+
+#define REV_GLITCH_PERCENT	150
+#define REV_MEDIAN_PERIODS	3
+
+#if REV_MEDIAN_PERIODS && (!(REV_MEDIAN_PERIODS&1) || REV_MEDIAN_PERIODS<3 || REV_MEDIAN_PERIODS>7)
+#error REV_MEDIAN_PERIODS must be 0, 3, 5 or 7
+#endif
+
+//
+// The sample period of the PI loop, and the speed window, in seconds, for
+// working out gains and scales. Only for use in constant expressions the
+// compiler folds.
+
+#define REV_SAMPLE_SECONDS	((double)REV_LOOP_TICKS/REV_TICKS_PER_SEC)
+#define REV_WINDOW_SECONDS	((double)REV_WINDOW_TICKS/REV_TICKS_PER_SEC)
+
+//
+// A speed estimate, in the PI loop's fixed point format (Q11.4, see
+// CTRL_RPS_FRAC). 'resolution' is the change in speed one timer tick (or,
+// when counting, one pulse) would have made to this estimate: a measure of
+// how much to trust it. When no pulse arrived in the window, 'pulses' is
+// zero and 'rps' is only an upper bound, so 'resolution' equals 'rps'.
+
+typedef struct _REVESTIMATE {
+
+	int				rps;			// RPS, Q11.4
+	unsigned int	resolution;		// RPS per tick (or per count), Q11.4, at least 1
+	unsigned char	pulses;			// pulses the estimate was made from, saturating
+
+} REVESTIMATE;
+
 
 ///////////////////////////////////////////////////////////////////////////////
 /// REVInitialize
@@ -61,6 +160,9 @@ void REVEnableOvfInterrupt(void);
 /// interrupt, and is slow. It can be used for interface and display, but
 /// will not be a quick solution for real-time rps control in a feedback loop.
 ///
+/// In REV_MODE_PERIOD this is the speed from the latest pulse period (or
+/// the time since the last pulse, if that is longer: the motor is slowing).
+///
 /// @context: TASK
 /// @scope: EXPORTED
 /// @param: NONE
@@ -70,17 +172,83 @@ void REVEnableOvfInterrupt(void);
 
 double REVGetRevsPerSec(void);
 
+///////////////////////////////////////////////////////////////////////////////
+/// REVGetRevsPerSecFixed
+///
+/// As REVGetRevsPerSec, but computed in integer arithmetic and returned in
+/// the fixed point format used by the PI loop (see CTRL_RPS_FRAC in
+/// control.h). The result is limited to 1023 RPS so the controller error can
+/// never overflow. This is the version used on the sample interrupt path.
+///
+/// @context: ANY
+/// @scope: EXPORTED
+/// @param: NONE
+/// @return: int - revs per second, Q11.4
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int REVGetRevsPerSecFixed(void);
+
+///////////////////////////////////////////////////////////////////////////////
+/// REVGetEstimate
+///
+/// Get the speed estimate made at the last sample, with its resolution.
+/// In REV_MODE_COUNT and REV_MODE_PERIOD this is filled in from the same
+/// measurement REVGetRevsPerSecFixed uses.
+///
+/// @context: ANY
+/// @scope: EXPORTED
+/// @param: REVESTIMATE * est - filled in
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void REVGetEstimate(REVESTIMATE * est);
+
+///////////////////////////////////////////////////////////////////////////////
+/// REVGetGlitches
+///
+/// Number of beam-break edges the glitch filter has dropped since
+/// initialization. It wraps at 16 bits.
+///
+/// @context: ANY
+/// @scope: EXPORTED
+/// @param: NONE
+/// @return: unsigned int - count
+///
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned int REVGetGlitches(void);
+
+///////////////////////////////////////////////////////////////////////////////
+/// REVTimestamp
+///
+/// Timer1 time, extended to 32 bits by counting samples. Ticks are
+/// 1/REV_TICKS_PER_SEC seconds and, at /64, wrap after about 4.7 hours;
+/// differences between timestamps wrap cleanly.
+///
+/// @context: INTERRUPT (or with interrupts disabled)
+/// @scope: EXPORTED
+/// @param: NONE
+/// @return: unsigned long - timestamp in Timer1 ticks
+///
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned long REVTimestamp(void);
+
 ///////////////////////////////////////////////////////////////////////////////
 /// REVInterruptHandler
 ///
-/// This ISR is triggered when the beam is brkoen
+/// Called from the pin change ISR each time the beam is broken
 ///
 /// @context: INTERRUPT
 /// @scope: INTERNAL
+/// @param: unsigned char pins - PINC as sampled by the ISR, unused
+/// @return: none
 ///
 ///////////////////////////////////////////////////////////////////////////////
 
-void REVInterruptHandler(void);
+void REVInterruptHandler(unsigned char pins);
 
 
 #endif
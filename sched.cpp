@@ -0,0 +1,195 @@
+///////////////////////////////////////////////////////////////////////////////
+/// SCHED.CPP
+///
+/// Periodic task scheduler. See sched.h.
+///
+/// The table is kept in run order as tasks are added, so a pass is a single
+/// walk down it. Release times are millis() values and are compared by
+/// signed difference, so they wrap cleanly.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#include <Arduino.h>
+#include <stdlib.h>
+#include <string.h>
+#include <kernel.h>
+#include "sched.h"
+
+typedef struct _SCHTASK {
+
+	SCHHANDLER		handler;
+	void *			context;
+	unsigned long	release;		// millis() when next due
+	SCHSTATS		stats;
+
+} SCHTASK;
+
+static SCHTASK schtasks[SCH_MAX_TASKS];
+static unsigned char schntasks=0;
+
+void SCHTask(void * context);
+
+///////////////////////////////////////////////////////////////////////////////
+/// SCHRunsBefore
+///
+/// The run order: priority, then period (background last)
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: a, b - tasks to compare
+/// @return: int - nonzero if a runs before b
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static int SCHRunsBefore(const SCHSTATS * a, const SCHSTATS * b)
+{
+	if(a->priority!=b->priority) {
+		return a->priority<b->priority;
+	}
+	if(!b->period) {
+		return a->period!=0;
+	}
+	return a->period && a->period<b->period;
+}
+
+/////////////////////////////
+/// Exported functions
+/////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// SCHInitialize
+///
+/// Empty the table and register the scheduler with the kernel
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void SCHInitialize(void)
+{
+	schntasks=0;
+
+	Kernel::OS.TaskManager.RegisterTaskHandler(SCHTask,(void *)NULL);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// SCHAddTask
+///
+/// Add a task at its place in the run order
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: SCHHANDLER handler - task function, which must not block
+/// @param: void * context - passed to the handler
+/// @param: unsigned int period - ms between releases, zero for background
+/// @param: unsigned int phase - ms until the first release
+/// @param: unsigned char priority - SCH_PRIO_*
+/// @return: int - zero, or -1 if the table is full (SCH_ABORT_ON_FULL
+///                undefined; with it, a full table aborts)
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int SCHAddTask(SCHHANDLER handler, void * context, unsigned int period, unsigned int phase, unsigned char priority)
+{
+	SCHTASK task;
+	unsigned char idx;
+
+	if(schntasks>=SCH_MAX_TASKS) {
+#ifdef SCH_ABORT_ON_FULL
+		abort();					// interrupts off and a dead loop on the AVR
+#endif
+		return -1;
+	}
+
+	memset(&task,0,sizeof(task));
+	task.handler=handler;
+	task.context=context;
+	task.release=millis()+phase;
+	task.stats.period=period;
+	task.stats.priority=priority;
+
+	// Shuffle the tasks that run after this one down a place. Tasks that
+	// tie keep the order they were added in.
+
+	for(idx=schntasks;idx && SCHRunsBefore(&task.stats,&schtasks[idx-1].stats);idx--) {
+		schtasks[idx]=schtasks[idx-1];
+	}
+	schtasks[idx]=task;
+	schntasks++;
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// SCHGetTaskCount / SCHGetStats
+///
+/// Number of tasks, and the figures for one, by its place in the run order
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: unsigned char idx - 0 to SCHGetTaskCount()-1
+/// @param: SCHSTATS * stats - filled in
+/// @return: int - zero, or -1 if there is no such task
+///
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned char SCHGetTaskCount(void)
+{
+	return schntasks;
+}
+
+int SCHGetStats(unsigned char idx, SCHSTATS * stats)
+{
+	if(idx>=schntasks) {
+		return -1;
+	}
+	*stats=schtasks[idx].stats;
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// SCHTask
+///
+/// One pass of the scheduler: walk the table in run order, calling every
+/// task that is due, until the pass budget is spent
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: void * context - unused
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void SCHTask(void * context)
+{
+	unsigned long start=micros();
+
+	for(unsigned char idx=0;idx<schntasks;idx++) {
+		SCHTASK * task=&schtasks[idx];
+		unsigned long now=millis();
+		long late=(long)(now-task->release);
+
+		if(task->stats.period) {
+			if(late<0) {
+				continue;				// not due yet
+			}
+			if(late>task->stats.maxlate) {
+				task->stats.maxlate=(late>0xffff)?0xffff:(unsigned int)late;
+			}
+			task->release+=task->stats.period;
+			if((long)(now-task->release)>=0) {
+				task->stats.overruns++;
+				task->release=now+task->stats.period;
+			}
+		}
+
+		task->stats.runs++;
+		task->handler(task->context);
+
+		if(micros()-start>=SCH_PASS_BUDGET_US) {
+			break;						// the rest, if due, go next pass
+		}
+	}
+}
@@ -0,0 +1,133 @@
+///////////////////////////////////////////////////////////////////////////////
+/// SCHED.H
+///
+/// Periodic task scheduler. The kernel's task manager calls every task on
+/// every pass, and each then has to check a timer of its own to find out it
+/// has nothing to do. Tasks registered here instead have a period and a
+/// phase (both in milliseconds) and a priority, and are only called when
+/// they are due.
+///
+/// Each pass the due tasks run in priority order, and within a priority in
+/// rate monotonic order (shortest period first). Tasks with a period of
+/// zero are background tasks: they run on every pass after the periodic
+/// ones, in the slack. Once a pass has taken SCH_PASS_BUDGET_US the rest
+/// wait for the next pass, so the long jobs at the end of the order can
+/// not hold up the short, urgent ones at the front.
+///
+/// A task that starts a whole period or more after it was due has missed a
+/// release: this is counted as an overrun, and its releases are
+/// resynchronized to the current time rather than run back to back to
+/// catch up.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _SCHED_H_
+#define _SCHED_H_
+
+#include "prf.h"
+#include "tel.h"
+
+//
+// Table size: one entry for each task the firmware adds. The control
+// module's three, the keypad's, the display's and the tuner's are always
+// there. The profiler and the recorder each add one, and the UART one
+// more if either is built in.
+
+#define SCH_CORE_TASKS		6
+
+#if defined(PRF_ENABLE) && defined(TEL_ENABLE)
+#define SCH_MAX_TASKS		(SCH_CORE_TASKS+3)
+#elif defined(PRF_ENABLE) || defined(TEL_ENABLE)
+#define SCH_MAX_TASKS		(SCH_CORE_TASKS+2)
+#else
+#define SCH_MAX_TASKS		SCH_CORE_TASKS
+#endif
+
+//
+// Define to stop dead (abort) when a task will not fit, rather than run on
+// without it. A full table means SCH_CORE_TASKS has fallen behind the code.
+
+#define SCH_ABORT_ON_FULL
+
+//
+// The time one pass may spend in scheduled tasks before the rest are left
+// for the next pass
+
+#define SCH_PASS_BUDGET_US	1000
+
+//
+// Priorities. Lower runs first.
+
+#define SCH_PRIO_HIGH		0
+#define SCH_PRIO_NORMAL		1
+#define SCH_PRIO_LOW		2
+
+typedef void (*SCHHANDLER)(void * context);
+
+//
+// Figures for one task
+
+typedef struct _SCHSTATS {
+
+	unsigned int	period;			// ms, zero for background
+	unsigned char	priority;
+	unsigned long	runs;
+	unsigned int	overruns;		// releases missed
+	unsigned int	maxlate;		// worst start after release, ms
+
+} SCHSTATS;
+
+//
+// Exported functions
+
+///////////////////////////////////////////////////////////////////////////////
+/// SCHInitialize
+///
+/// Empty the table and register the scheduler with the kernel task manager.
+/// Call this before any module that adds a task.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void SCHInitialize(void);
+
+///////////////////////////////////////////////////////////////////////////////
+/// SCHAddTask
+///
+/// Add a task. It is first due 'phase' ms from now, then every 'period' ms.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: SCHHANDLER handler - task function, which must not block
+/// @param: void * context - passed to the handler
+/// @param: unsigned int period - ms between releases, zero for background
+/// @param: unsigned int phase - ms until the first release
+/// @param: unsigned char priority - SCH_PRIO_*
+/// @return: int - zero, or -1 if the table is full (SCH_ABORT_ON_FULL
+///                undefined; with it, a full table aborts)
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int SCHAddTask(SCHHANDLER handler, void * context, unsigned int period, unsigned int phase, unsigned char priority);
+
+///////////////////////////////////////////////////////////////////////////////
+/// SCHGetTaskCount / SCHGetStats
+///
+/// Number of tasks, and the figures for one, by its place in the run order
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: unsigned char idx - 0 to SCHGetTaskCount()-1
+/// @param: SCHSTATS * stats - filled in
+/// @return: int - zero, or -1 if there is no such task
+///
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned char SCHGetTaskCount(void);
+int SCHGetStats(unsigned char idx, SCHSTATS * stats);
+
+#endif
@@ -1,127 +1,295 @@
-///////////////////////////////////////////////////////////////////////////////
-/// SSEGDRIVER.CPP
-///
-/// This is the driver for the seven segment display. It is a shell - you
-/// should populate with your own code
-///
-///////////////////////////////////////////////////////////////////////////////
-
-#include "ssegdriver.h"
-#include "common.h"
-#include "kernel.h"
-
-// prototype the message handler function here.
-
-void SSEGControlMessageHandler(void * context);
-
-byte seven_seg[] = {
-  0b11000000, //Displays "0"
-  0b11001111, //Displays "1"
-  0b10100100, //Displays "2"
-  0b10110000, //Displays "3"
-  0b10011001, //Displays "4"
-  0b10010010, //Displays "5"
-  0b10000010, //Displays "6"
-  0b11111000, //Displays "7"
-  0b10000000, //Displays "8"
-  0b10011000, //Displays "9"
-  0b10000011, //Displays "b"
-  0b10000110, //Displays "E"
-  0b01111111, //blank with dp
-  0b01111111, //blank with dp
-  0b01111111, //blank with dp
-  0b01111111, //blank with dp
-};
-
-// array mapping values to segments - you may need something like that here
-
-
-///////////////////////////////////////////////////////////////////////////////
-/// SSEGInitializeDriver
-///
-/// This is called once at system startup. It initializes the seven segment
-/// display driver.
-/// This module is the only place where hardware related to the seven segment
-/// display is directly accessed, so here is where we set the IO parameters.
-///
-///////////////////////////////////////////////////////////////////////////////
-
-void SSEGInitializeDriver(void)
-{
-  // This is the code that configures the pins on the ATMega328 as
-  // outputs WITHOUT CHANGING OTHER PINS (note the use of bitwise-OR)
-
-  // DATA (SER on HC595) is on PORTD bit 4
-  // CLK  (SRCLK on HC595) is on PORTB bit 0
-  // EN   (ECLK on HC595) is on PORTD bit 7
-
-  DDRD |= 0b10010000;	// set to o/p
-  DDRB |= 0b00000001; // set to o/p
-
-  // set EN high, data low, clock low (as initial)
-
-  PORTD |= 0b10000000;
-  PORTB &= ~0b00000001;
-  PORTD &= ~0b00010000;
-
-  // This line registers the message handler with the OS in order
-  // that it can receive messages posted to it under the MSG_ID_CHANGE_7SEG
-  // ID
-
-  Kernel::OS.MessageQueue.Subscribe(MSG_ID_CHANGE_7SEG, SSEGControlMessageHandler);
-}
-
-
-///////////////////////////////////////////////////////////////////////////////
-/// LEDControlMessageHandler
-///
-/// This function is called in response to a posted message
-/// The 'context' parameter is not used as a pointer, but is cast to
-/// an integer, which is used as a boolean. Zero means LED off, nonzero
-/// means LED on.
-///
-///////////////////////////////////////////////////////////////////////////////
-
-void SSEGControlMessageHandler(void * context)
-{
-  unsigned int value = (unsigned int)context;
-  byte mask;                           ///Declare byte(8-bit) variable called "mask"
-  mask = 0b10000000;                   //Most significant bit of "mask" set to 'High'
-  PORTD &= ~0b10000000;                //EN set 'LOW',awaiting information from data line
-  int i;
-  unsigned int index; 
-  
- if (value & 0b00010000){                      // ()resets the "num" for the second count and turns the decimal point "ON". (when the 4th bit comes on)
-    index = value-16;
-    seven_seg[index] &= ~0b10000000;}    
-    
- else if (value > 11){                 //Turns "ON" the dp during blanks (12 to 15)
-    seven_seg[index] &= ~0b10000000;}
- 
-  
- else { index = value;                   //Turns "OFF" dp for anyother counts
-    seven_seg[index] |= 0b10000000;
-  }
-  
-  for (i = 0; i < 8; ++i) {            //"For" loop to check each bit 
-    bool b = seven_seg[index] & mask;
-
-    if ( b == LOW ) {
-      PORTD &= ~0b00010000;            //data line "LOW" if 'b' is "lOW"
-    }         
-    else {
-      PORTD |= 0b00010000;             //data line "HIGH" if 'b' is "HIGH"
-
-    }         
-    PORTB |= 0b00000001;               //clock line "HIGH"
-    mask = mask >> 1;                  //Right-shift the mask by a bit
-    PORTB &= ~0b0000001;               //clock line "LOW"
-    
-  }
-  PORTD |= 0b10000000;                 //latch line "HIGH"
-}
-/// your code goes here, as well as above if you ned to declare statics
-/// or module globals.
-
-// Remember that the logic sense of the outputs of the port expander
-// are INVERTED: a logic '0' will light the segment
+///////////////////////////////////////////////////////////////////////////////
+/// SSEGDRIVER.CPP
+///
+/// This is the driver for the seven segment display.
+///
+/// The task side never touches the hardware. It builds the new segment
+/// patterns in the back buffer and then flips the front buffer index (a
+/// single byte, so the flip is atomic). The Timer2 ISR only ever reads the
+/// front buffer, so it can never show a half-updated number.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#include <Arduino.h>
+#include <string.h>
+#include "ssegdriver.h"
+#include "common.h"
+#include "kernel.h"
+#include "fmt.h"
+#include "prf.h"
+#include "topics.h"
+
+//
+// Pins. DATA (SER on HC595) is on PORTD bit 4, CLK (SRCLK) on PORTB bit 0
+// and EN (RCLK, the latch) on PORTD bit 7. These are not the SPI pins
+// (MOSI is PB3, SCK is PB5, which drives the LED), so the SPI peripheral
+// can not do the shifting; SSEGShiftByte below is the next best thing.
+
+#define SSEG_DATA		0b00010000		// PD4
+#define SSEG_CLK		0b00000001		// PB0
+#define SSEG_LATCH		0b10000000		// PD7
+
+//
+// Glyphs, as the segment byte: bit 7 is the decimal point, and a zero
+// lights the segment. Indices 0-11 are the values the keypad posts; 12-15
+// are blank. The decimal point is added when the byte is sent, so the
+// table is never modified and lives in flash.
+
+#define SSEG_GLYPH_BLANK	12
+#define SSEG_GLYPH_DASH		16
+#define SSEG_DP				0b10000000
+
+static const unsigned char sseg_glyphs[] PROGMEM = {
+  0b11000000, //Displays "0"
+  0b11001111, //Displays "1"
+  0b10100100, //Displays "2"
+  0b10110000, //Displays "3"
+  0b10011001, //Displays "4"
+  0b10010010, //Displays "5"
+  0b10000010, //Displays "6"
+  0b11111000, //Displays "7"
+  0b10000000, //Displays "8"
+  0b10011000, //Displays "9"
+  0b10000011, //Displays "b"
+  0b10000110, //Displays "E"
+  0b11111111, //blank
+  0b11111111, //blank
+  0b11111111, //blank
+  0b11111111, //blank
+  0b10111111, //Displays "-"
+};
+
+//
+// Timer2 compare value for the refresh rate, CTC mode at /1024
+
+#define SSEG_TIMER2_TOP		((F_CPU/1024)/(SSEG_REFRESH_HZ*SSEG_NUM_DIGITS)-1)
+
+#if SSEG_TIMER2_TOP>255 || SSEG_TIMER2_TOP<1
+#error SSEG_REFRESH_HZ*SSEG_NUM_DIGITS is out of the Timer2 range
+#endif
+
+//
+// Module variables. Digit 0 is the rightmost. The ISR reads
+// ssegbuf[ssegfront] only.
+
+static unsigned char ssegbuf[2][SSEG_NUM_DIGITS];	// segment bytes, dp included
+static volatile unsigned char ssegfront=0;
+static unsigned char ssegdigit=0;					// ISR: next digit to show
+#if SSEG_NUM_DIGITS==1
+static unsigned char ssegshown=0;					// ISR: byte on the digit now
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// SSEGShiftByte
+///
+/// Shift a byte out MSB first. The loop is unrolled and every bit is the
+/// same few single-cycle bit set/clear instructions (sbi/cbi on the port),
+/// so it always takes the same time - about 40 cycles a byte against some
+/// 300 for the old read-modify-write loop - and can not disturb other bits
+/// on the same ports, even from an ISR.
+///
+/// @scope: INTERNAL
+/// @context: INTERRUPT
+/// @param: unsigned char b - byte to send
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#define SSEG_SHIFT_BIT(b,n)									\
+	if((b)&(1<<(n))) { PORTD|=SSEG_DATA; } else { PORTD&=~SSEG_DATA; }	\
+	PORTB|=SSEG_CLK;											\
+	PORTB&=~SSEG_CLK;
+
+static inline void SSEGShiftByte(unsigned char b)
+{
+	SSEG_SHIFT_BIT(b,7)
+	SSEG_SHIFT_BIT(b,6)
+	SSEG_SHIFT_BIT(b,5)
+	SSEG_SHIFT_BIT(b,4)
+	SSEG_SHIFT_BIT(b,3)
+	SSEG_SHIFT_BIT(b,2)
+	SSEG_SHIFT_BIT(b,1)
+	SSEG_SHIFT_BIT(b,0)
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// SSEGBackBuffer / SSEGFlip
+///
+/// Get the back buffer, primed with what is showing now so callers need
+/// only change the digits they want, then make it the front buffer.
+///
+/// @scope: INTERNAL
+/// @context: TASK
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static unsigned char * SSEGBackBuffer(void)
+{
+	unsigned char * back=ssegbuf[ssegfront^1];
+
+	memcpy(back,ssegbuf[ssegfront],SSEG_NUM_DIGITS);
+	return back;
+}
+
+static void SSEGFlip(void)
+{
+	ssegfront^=1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// SSEGInitializeDriver
+///
+/// This is called once at system startup. It initializes the seven segment
+/// display driver.
+/// This module is the only place where hardware related to the seven segment
+/// display is directly accessed, so here is where we set the IO parameters.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void SSEGInitializeDriver(void)
+{
+  // This is the code that configures the pins on the ATMega328 as
+  // outputs WITHOUT CHANGING OTHER PINS (note the use of bitwise-OR)
+
+  DDRD |= SSEG_DATA|SSEG_LATCH;	// set to o/p
+  DDRB |= SSEG_CLK; // set to o/p
+
+  // set EN high, data low, clock low (as initial)
+
+  PORTD |= SSEG_LATCH;
+  PORTB &= ~SSEG_CLK;
+  PORTD &= ~SSEG_DATA;
+
+  // Start blank. ssegshown differs from a blank, so a single digit is
+  // sent on the first interrupt.
+
+  memset(ssegbuf,0xff,sizeof(ssegbuf));
+  ssegfront=0;
+  ssegdigit=0;
+#if SSEG_NUM_DIGITS==1
+  ssegshown=0;
+#endif
+
+  // Timer2 in CTC mode, /1024, interrupt on compare match A
+
+  TCCR2A = (1<<WGM21);
+  TCCR2B = (1<<CS22)|(1<<CS21)|(1<<CS20);
+  OCR2A  = SSEG_TIMER2_TOP;
+  TCNT2  = 0;
+  TIMSK2 |= (1<<OCIE2A);
+
+  // The message handlers are routed to in topics.h: MSG7SEG, and the
+  // actual RPS too if there are digits enough to show it
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// SSEGShowNumber
+///
+/// Show a number across all the digits, right aligned with leading blanks
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: unsigned int value - number to show
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void SSEGShowNumber(unsigned int value)
+{
+	unsigned char * back=SSEGBackBuffer();
+	char num[FMT_UNSIGNED_LEN];
+	unsigned char len=FMTUnsigned(num,value,0);
+
+	for(unsigned char idx=0;idx<SSEG_NUM_DIGITS;idx++) {
+		unsigned char glyph;
+
+		if(len>SSEG_NUM_DIGITS) {
+			glyph=SSEG_GLYPH_DASH;
+		} else if(idx<len) {
+			glyph=num[len-1-idx]-'0';
+		} else {
+			glyph=SSEG_GLYPH_BLANK;
+		}
+		back[idx]=pgm_read_byte(&sseg_glyphs[glyph]);
+	}
+	SSEGFlip();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// SSEGControlMessageHandler
+///
+/// This function is called in response to a posted message, with the
+/// glyph to show on the rightmost digit: 0-11 as the table above.
+/// Adding 16 turns the decimal point on; 12-15 are a blank with the
+/// decimal point on.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void SSEGControlMessageHandler(const MSG7SEG & msg)
+{
+  PRF_SCOPE(PRF_MESSAGES);
+
+  unsigned char value = msg.glyph;
+  unsigned char glyph = value & 0x0f;
+  unsigned char * back = SSEGBackBuffer();
+
+  back[0] = pgm_read_byte(&sseg_glyphs[glyph]);
+  if ((value & 0b00010000) || glyph >= SSEG_GLYPH_BLANK) {
+    back[0] &= ~SSEG_DP;                 //Turns "ON" the dp (it is active low)
+  }
+  SSEGFlip();
+}
+
+#ifdef SSEG_SHOW_ACTUAL_RPS
+///////////////////////////////////////////////////////////////////////////////
+/// SSEGActualRPSHandler
+///
+/// Message handler for the actual RPS, when there are digits enough to
+/// show it
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void SSEGActualRPSHandler(const MSGACTUALRPS & msg)
+{
+  PRF_SCOPE(PRF_MESSAGES);
+
+  SSEGShowNumber(msg.rps);
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// ISR(TIMER2_COMPA_vect)
+///
+/// Show the next digit: its select byte (if multiplexed) and its segments
+/// are shifted out and latched together. A single digit is only resent
+/// when it changes.
+///
+/// @scope: INTERNAL
+/// @context: INTERRUPT
+///
+///////////////////////////////////////////////////////////////////////////////
+
+ISR(TIMER2_COMPA_vect)
+{
+	PRF_SCOPE(PRF_ISR_TIMER2);
+
+	unsigned char segs=ssegbuf[ssegfront][ssegdigit];
+
+#if SSEG_NUM_DIGITS==1
+	if(segs==ssegshown) {
+		return;
+	}
+	ssegshown=segs;
+#endif
+
+	PORTD &= (unsigned char)~SSEG_LATCH;
+#if SSEG_NUM_DIGITS>1
+	SSEGShiftByte(~(1<<ssegdigit));		// to the cascaded select register
+#endif
+	SSEGShiftByte(segs);
+	PORTD |= SSEG_LATCH;
+
+	if(++ssegdigit>=SSEG_NUM_DIGITS) {
+		ssegdigit=0;
+	}
+}
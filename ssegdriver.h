@@ -1,14 +1,37 @@
 ///////////////////////////////////////////////////////////////////////////////
 /// SSEGDRIVER.H
 ///
-/// This is the driver for the seven segment display. It is a shell - you
-/// should populate with your own code
+/// This is the driver for the seven segment display. The digits are held
+/// in a double buffered array and shifted out to the 74HC595 from the
+/// Timer2 compare interrupt, one digit per interrupt, so a multiplexed
+/// display is refreshed without the task loop.
 ///
 ///////////////////////////////////////////////////////////////////////////////
 
 #ifndef SSEGDRIVER_H_
 #define SSEGDRIVER_H_
 
+//
+// Number of digits. The board has one, driven straight from the segment
+// 74HC595. For more, a second 74HC595 is cascaded after it (QH' to SER,
+// sharing clock and latch) to drive the digit commons: its output n is
+// pulled low to select digit n, digit 0 being the rightmost.
+
+#define SSEG_NUM_DIGITS		1
+
+//
+// Refresh rate of each digit. The Timer2 interrupt runs at
+// SSEG_REFRESH_HZ*SSEG_NUM_DIGITS.
+
+#define SSEG_REFRESH_HZ		100
+
+//
+// With three or more digits there is room for the whole actual RPS, so it
+// is shown there rather than the last key pressed.
+
+#if SSEG_NUM_DIGITS>=3
+#define SSEG_SHOW_ACTUAL_RPS
+#endif
 
 ///////////////////////////////////////////////////////////////////////////////
 /// SSEGInitializeDriver
@@ -22,6 +45,21 @@
 
 void SSEGInitializeDriver(void);
 
+///////////////////////////////////////////////////////////////////////////////
+/// SSEGShowNumber
+///
+/// Show a number across all the digits, right aligned with leading blanks.
+/// If it does not fit, every digit shows a dash.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: unsigned int value - number to show
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void SSEGShowNumber(unsigned int value);
+
 
 
 #endif
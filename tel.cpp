@@ -0,0 +1,366 @@
+///////////////////////////////////////////////////////////////////////////////
+/// TEL.CPP
+///
+/// Control loop telemetry recorder. See tel.h.
+///
+/// The ring is written by the sample interrupt at the head and read by the
+/// task at the tail. While streaming it is a plain single producer, single
+/// consumer queue, as the event ring is (event.h). In a triggered capture
+/// the interrupt overwrites it freely and the task does not read it at all
+/// until the interrupt has finished with it (TEL_STATE_CAPTURED), so
+/// neither side ever has to wait for the other.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#include <Arduino.h>
+#include <kernel.h>
+#include "tel.h"
+
+#ifdef TEL_ENABLE
+
+#include "uart.h"
+#include "sched.h"
+
+#define TEL_MASK			(TEL_RING_LEN-1)
+
+typedef enum _TELSTATE {
+
+	TEL_STATE_OFF,
+	TEL_STATE_STREAM,
+	TEL_STATE_ARMED,			// recording, waiting for the trigger
+	TEL_STATE_TRIGGERED,		// recording the post-trigger samples
+	TEL_STATE_CAPTURED			// recording stopped, ring being sent
+
+} TELSTATE;
+
+typedef struct _TELRECORD {
+
+	unsigned int	seq;
+	int				demand;
+	int				actual;
+	int				error;
+	long			state;
+	unsigned char	duty;
+
+} TELRECORD;
+
+//
+// Module variables. Those the interrupt writes are volatile.
+
+static volatile TELRECORD telrecs[TEL_RING_LEN];
+static volatile unsigned char telhead=0;		// written by the interrupt
+static volatile unsigned char teltail=0;		// written by the task
+static volatile unsigned char telstate=TEL_STATE_OFF;
+static volatile unsigned char telfill=0;		// records in a capture, up to TEL_RING_LEN
+static volatile unsigned char telpost=0;		// post-trigger records still to take
+static volatile unsigned char telforce=0;		// trigger on the next sample
+static volatile unsigned int teltrigseq=0;
+static unsigned int telseq=0;					// interrupt only
+static int teldemand=0;							// interrupt only
+static unsigned char telheadersent=0;			// task only
+
+void TELTask(void * context);
+void TELStreamCommand(void);
+void TELArmCommand(void);
+void TELForceCommand(void);
+void TELStopCommand(void);
+
+///////////////////////////////////////////////////////////////////////////////
+/// TELPut16 / TELPut32
+///
+/// Store a field little endian
+///
+/// @scope: INTERNAL
+/// @context: TASK
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static unsigned char * TELPut16(unsigned char * p, unsigned int value)
+{
+	*p++=(unsigned char)value;
+	*p++=(unsigned char)(value>>8);
+	return p;
+}
+
+static unsigned char * TELPut32(unsigned char * p, unsigned long value)
+{
+	p=TELPut16(p,(unsigned int)value);
+	return TELPut16(p,(unsigned int)(value>>16));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// TELSendFrame
+///
+/// Frame a payload and queue it on the UART, all or nothing
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: unsigned char type - TEL_FRAME_...
+/// @param: const unsigned char * payload - the payload
+/// @param: unsigned char len - its length, at most TEL_SAMPLE_LEN
+/// @return: int - zero if queued, -1 if the UART has no room
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static int TELSendFrame(unsigned char type, const unsigned char * payload, unsigned char len)
+{
+	unsigned char frame[TEL_SAMPLE_LEN+TEL_FRAME_OVERHEAD];
+	unsigned char crc=0;
+	unsigned char idx;
+
+	frame[0]=TEL_SYNC0;
+	frame[1]=TEL_SYNC1;
+	frame[2]=type;
+	frame[3]=len;
+	for(idx=0;idx<len;idx++) {
+		frame[4+idx]=payload[idx];
+	}
+
+	// CRC-8, polynomial 0x07, over type, length and payload
+
+	for(idx=2;idx<len+4;idx++) {
+		crc^=frame[idx];
+		for(unsigned char bit=0;bit<8;bit++) {
+			crc=(crc&0x80)?(unsigned char)((crc<<1)^0x07):(unsigned char)(crc<<1);
+		}
+	}
+	frame[len+4]=crc;
+
+	return UARTWrite(frame,len+TEL_FRAME_OVERHEAD);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// TELSendRecords
+///
+/// Send records from the tail up to the head for as long as the UART has
+/// room. A record's slot is only given back once its frame is queued.
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void TELSendRecords(void)
+{
+	unsigned char tail=teltail;
+	unsigned char head=telhead;
+
+	while(tail!=head) {
+		volatile TELRECORD * rec=&telrecs[tail&TEL_MASK];
+		unsigned char payload[TEL_SAMPLE_LEN];
+		unsigned char * p=payload;
+
+		p=TELPut16(p,rec->seq);
+		p=TELPut16(p,(unsigned int)rec->demand);
+		p=TELPut16(p,(unsigned int)rec->actual);
+		p=TELPut16(p,(unsigned int)rec->error);
+		p=TELPut32(p,(unsigned long)rec->state);
+		*p=rec->duty;
+
+		if(TELSendFrame(TEL_FRAME_SAMPLE,payload,TEL_SAMPLE_LEN)) {
+			break;						// UART full, carry on next pass
+		}
+		tail++;
+		teltail=tail;
+	}
+}
+
+/////////////////////////////
+/// Exported functions
+/////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// TELInitialize
+///
+/// Empty the ring, add the task and register the command characters
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void TELInitialize(void)
+{
+	telstate=TEL_STATE_OFF;
+	telhead=teltail=0;
+
+	SCHAddTask(TELTask,(void *)NULL,0,0,SCH_PRIO_LOW);
+	UARTAddCommand('s',TELStreamCommand);
+	UARTAddCommand('t',TELArmCommand);
+	UARTAddCommand('f',TELForceCommand);
+	UARTAddCommand('x',TELStopCommand);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// TELRecord
+///
+/// Record one sample, if recording. Every sample gets a sequence number,
+/// recorded or not, so the host can see what was dropped.
+///
+/// @scope: EXPORTED
+/// @context: INTERRUPT
+/// @param: int demand - RPS, Q11.4
+/// @param: int actual - RPS, Q11.4
+/// @param: int error - RPS, Q11.4
+/// @param: long state - controller state, Q15.16
+/// @param: unsigned char duty - PWM duty
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void TELRecord(int demand, int actual, int error, long state, unsigned char duty)
+{
+	unsigned char tstate=telstate;
+	unsigned char head=telhead;
+	unsigned int seq=telseq++;
+	volatile TELRECORD * rec;
+
+	switch(tstate) {
+
+		case TEL_STATE_STREAM:
+			if((unsigned char)(head-teltail)>=TEL_RING_LEN) {
+				return;					// dropped: the line is behind
+			}
+			break;
+
+		case TEL_STATE_ARMED:
+			if(telforce || (telfill && demand!=teldemand)) {
+				tstate=TEL_STATE_TRIGGERED;
+				teltrigseq=seq;
+				telpost=TEL_POST_TRIGGER;
+				telforce=0;
+			}
+			teldemand=demand;
+			break;
+
+		case TEL_STATE_TRIGGERED:
+			break;
+
+		default:
+			return;
+	}
+
+	rec=&telrecs[head&TEL_MASK];
+	rec->seq=seq;
+	rec->demand=demand;
+	rec->actual=actual;
+	rec->error=error;
+	rec->state=state;
+	rec->duty=duty;
+	telhead=head+1;		// publish
+
+	if(tstate!=TEL_STATE_STREAM) {
+		if(telfill<TEL_RING_LEN) {
+			telfill++;
+		}
+		if(tstate==TEL_STATE_TRIGGERED && !--telpost) {
+			tstate=TEL_STATE_CAPTURED;
+		}
+		telstate=tstate;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// TELStreamCommand / TELArmCommand / TELForceCommand / TELStopCommand
+///
+/// The command characters 's', 't', 'f' and 'x'. Whatever was being
+/// recorded is abandoned. The interrupt is held off while the ring is
+/// reset, so it never sees the state and indices disagree.
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void TELStreamCommand(void)
+{
+	unsigned char sreg=SREG;
+	cli();
+
+	telhead=teltail=0;
+	telstate=TEL_STATE_STREAM;
+
+	SREG=sreg;
+}
+
+void TELArmCommand(void)
+{
+	unsigned char sreg=SREG;
+	cli();
+
+	telhead=teltail=0;
+	telfill=0;
+	telforce=0;
+	telheadersent=0;
+	telstate=TEL_STATE_ARMED;
+
+	SREG=sreg;
+}
+
+void TELForceCommand(void)
+{
+	if(telstate==TEL_STATE_ARMED) {
+		telforce=1;
+	}
+}
+
+void TELStopCommand(void)
+{
+	telstate=TEL_STATE_OFF;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// TELTask
+///
+/// Send what has been recorded. A capture goes out as its header, then the
+/// ring from the oldest sample kept, and recording is then off until it
+/// is re-armed.
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: void * context - unused
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void TELTask(void * context)
+{
+	switch(telstate) {
+
+		case TEL_STATE_STREAM:
+			TELSendRecords();
+			break;
+
+		case TEL_STATE_CAPTURED:
+			// The interrupt has stopped writing, so nothing here changes
+			// under us.
+			if(!telheadersent) {
+				unsigned char payload[TEL_CAPTURE_LEN];
+
+				TELPut16(payload,teltrigseq);
+				payload[2]=telfill-TEL_POST_TRIGGER;
+				payload[3]=TEL_POST_TRIGGER;
+				if(TELSendFrame(TEL_FRAME_CAPTURE,payload,TEL_CAPTURE_LEN)) {
+					break;
+				}
+				teltail=telhead-telfill;
+				telheadersent=1;
+			}
+			TELSendRecords();
+			if(teltail==telhead) {
+				telstate=TEL_STATE_OFF;
+			}
+			break;
+
+		default:
+			break;
+	}
+}
+
+#endif
@@ -0,0 +1,134 @@
+///////////////////////////////////////////////////////////////////////////////
+/// TEL.H
+///
+/// Control loop telemetry recorder. Every run of the PI loop, in the
+/// Timer1 sample interrupt, writes one fixed size record - demand, measured
+/// speed, error, controller state and duty - to a ring in RAM. A task
+/// frames the records and hands them to the interrupt driven UART.
+///
+/// Two ways to record, chosen by a command character on the serial port:
+///
+///   's'  stream: every record is sent. If the line can not keep up the
+///        ring fills and records are dropped; the gap in the sequence
+///        numbers shows where.
+///   't'  triggered capture: the ring is overwritten continuously (the
+///        pre-trigger history) until the demand changes, or 'f' is sent.
+///        Recording then carries on for TEL_POST_TRIGGER more samples and
+///        stops, and the whole ring is sent at whatever rate the line
+///        allows. One shot: send 't' again for the next.
+///   'x'  stop.
+///
+/// The wire format (below) is decoded to CSV by host/tools/teldecode.cpp.
+///
+/// The recorder is only built in with TEL_ENABLE defined. Without it
+/// TEL_RECORD compiles to nothing and the module is empty.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _TEL_H_
+#define _TEL_H_
+
+//
+// Define to build the recorder in. It costs TEL_RING_LEN*13 bytes of RAM
+// and a few microseconds of each sample interrupt.
+
+//#define TEL_ENABLE
+
+//
+// Ring size in records: a power of two no greater than 128. A triggered
+// capture holds TEL_RING_LEN-TEL_POST_TRIGGER samples from before the
+// trigger.
+
+#define TEL_RING_LEN		32
+#define TEL_POST_TRIGGER	24
+
+#if (TEL_RING_LEN & (TEL_RING_LEN-1)) || TEL_RING_LEN>128
+#error TEL_RING_LEN must be a power of two no greater than 128
+#endif
+
+#if TEL_POST_TRIGGER<1 || TEL_POST_TRIGGER>=TEL_RING_LEN
+#error TEL_POST_TRIGGER must be at least 1 and less than TEL_RING_LEN
+#endif
+
+//
+// Wire format. Each frame is
+//
+//   TEL_SYNC0 TEL_SYNC1 type length payload[length] crc
+//
+// where crc is CRC-8 (polynomial 0x07, initial value 0) over type, length
+// and the payload. Multi-byte fields are little endian. Anything else on
+// the line (the profiler's text dump, say) falls between frames and is
+// skipped by the decoder.
+//
+// TEL_FRAME_SAMPLE payload:
+//   seq     u16   sample number, counting every sample interrupt
+//   demand  s16   RPS, Q11.4
+//   actual  s16   RPS, Q11.4
+//   error   s16   RPS, Q11.4
+//   state   s32   controller state, Q15.16: the limited output in the
+//                 velocity form loop, the integrator with CTRL_GAIN_SCHEDULE
+//   duty    u8    PWM duty, whole counts (the dither is not recorded)
+//
+// TEL_FRAME_CAPTURE payload, sent before the samples of a capture:
+//   seq     u16   sample number of the trigger
+//   pre     u8    samples in the capture before the trigger
+//   post    u8    samples from the trigger on
+
+#define TEL_SYNC0			0xa5
+#define TEL_SYNC1			0x5a
+
+#define TEL_FRAME_SAMPLE	0x01
+#define TEL_FRAME_CAPTURE	0x02
+
+#define TEL_SAMPLE_LEN		13
+#define TEL_CAPTURE_LEN		4
+#define TEL_FRAME_OVERHEAD	5
+
+#ifdef TEL_ENABLE
+
+//
+// Exported functions
+
+///////////////////////////////////////////////////////////////////////////////
+/// TELInitialize
+///
+/// Empty the ring, add the task that sends it and register the command
+/// characters. Call after UARTInitialize.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void TELInitialize(void);
+
+///////////////////////////////////////////////////////////////////////////////
+/// TELRecord
+///
+/// Record one sample of the control loop. Use TEL_RECORD rather than
+/// calling this.
+///
+/// @scope: EXPORTED
+/// @context: INTERRUPT
+/// @param: int demand - RPS, Q11.4
+/// @param: int actual - RPS, Q11.4
+/// @param: int error - RPS, Q11.4
+/// @param: long state - controller state, Q15.16
+/// @param: unsigned char duty - PWM duty
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void TELRecord(int demand, int actual, int error, long state, unsigned char duty);
+
+#define TEL_RECORD(demand,actual,error,state,duty)	TELRecord(demand,actual,error,state,duty)
+
+#else
+
+#define TEL_RECORD(demand,actual,error,state,duty)
+
+#endif
+
+#endif
@@ -0,0 +1,265 @@
+///////////////////////////////////////////////////////////////////////////////
+/// TIMER.CPP
+///
+/// Static software timer pool on a hashed timing wheel. See timer.h.
+///
+/// Each slot heads a doubly linked list of pool indices, so a timer can be
+/// unlinked from the middle of its list without a search. tmrnow is the
+/// last millisecond the wheel has been turned to; TMRTask turns it one
+/// slot at a time up to millis(), so a late task pass catches up rather
+/// than losing ticks.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#include <Arduino.h>
+#include <string.h>
+#include <kernel.h>
+#include "timer.h"
+
+#define TMR_SLOT_MASK		(TMR_WHEEL_SLOTS-1)
+
+#define TMR_FLAG_ARMED		0x01
+#define TMR_FLAG_EXPIRED	0x02
+
+typedef struct _TMRTIMER {
+
+	TMRCALLBACK		callback;
+	void *			context;
+	unsigned int	rounds;			// whole turns of the wheel still to go
+	unsigned char	next;			// list links, TMR_NONE at the ends
+	unsigned char	prev;
+	unsigned char	flags;
+
+} TMRTIMER;
+
+static TMRTIMER tmrpool[TMR_MAX_TIMERS];
+static unsigned char tmrwheel[TMR_WHEEL_SLOTS];		// list heads
+static unsigned char tmrslot[TMR_MAX_TIMERS];		// slot each timer is on
+static unsigned char tmrcount=0;					// timers created
+static unsigned long tmrnow=0;
+
+void TMRTask(void * context);
+
+///////////////////////////////////////////////////////////////////////////////
+/// TMRUnlink
+///
+/// Take an armed timer off its slot's list
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: TMRHANDLE timer - an armed timer
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void TMRUnlink(TMRHANDLE timer)
+{
+	TMRTIMER * t=&tmrpool[timer];
+
+	if(t->prev!=TMR_NONE) {
+		tmrpool[t->prev].next=t->next;
+	} else {
+		tmrwheel[tmrslot[timer]]=t->next;
+	}
+	if(t->next!=TMR_NONE) {
+		tmrpool[t->next].prev=t->prev;
+	}
+	t->flags&=~TMR_FLAG_ARMED;
+}
+
+/////////////////////////////
+/// Exported functions
+/////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// TMRInitialize
+///
+/// Empty the pool and the wheel, and register the tick task
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void TMRInitialize(void)
+{
+	memset(tmrwheel,TMR_NONE,sizeof(tmrwheel));
+	tmrcount=0;
+	tmrnow=millis();
+
+	Kernel::OS.TaskManager.RegisterTaskHandler(TMRTask,(void *)NULL);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// TMRCreate
+///
+/// Take the next timer from the pool
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: TMRCALLBACK callback - called on expiry, or NULL to only flag it
+/// @param: void * context - passed to the callback
+/// @return: TMRHANDLE - the timer, or TMR_NONE if the pool is used up
+///
+///////////////////////////////////////////////////////////////////////////////
+
+TMRHANDLE TMRCreate(TMRCALLBACK callback, void * context)
+{
+	TMRTIMER * t;
+
+	if(tmrcount>=TMR_MAX_TIMERS) {
+		return TMR_NONE;
+	}
+	t=&tmrpool[tmrcount];
+	t->callback=callback;
+	t->context=context;
+	t->flags=0;
+	return tmrcount++;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// TMRArm
+///
+/// Put the timer on the slot its expiry hashes to. The slot for time
+/// tmrnow+ms next comes round after ms%TMR_WHEEL_SLOTS ticks (or a whole
+/// turn, if that is zero), so the rest is counted in turns. TMR_NONE, from
+/// a TMRCreate that failed, is ignored.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: TMRHANDLE timer - from TMRCreate
+/// @param: unsigned int ms - time to expiry, at least 1
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void TMRArm(TMRHANDLE timer, unsigned int ms)
+{
+	TMRTIMER * t;
+	unsigned char slot;
+
+	if(timer>=tmrcount) {
+		return;
+	}
+	t=&tmrpool[timer];
+	if(t->flags&TMR_FLAG_ARMED) {
+		TMRUnlink(timer);
+	}
+	if(!ms) {
+		ms=1;
+	}
+
+	slot=(unsigned char)((tmrnow+ms)&TMR_SLOT_MASK);
+	t->rounds=(ms-1)/TMR_WHEEL_SLOTS;
+	t->prev=TMR_NONE;
+	t->next=tmrwheel[slot];
+	if(t->next!=TMR_NONE) {
+		tmrpool[t->next].prev=timer;
+	}
+	tmrwheel[slot]=timer;
+	tmrslot[timer]=slot;
+	t->flags=TMR_FLAG_ARMED;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// TMRCancel
+///
+/// Stop a timer, if armed, and clear its expired flag. TMR_NONE is
+/// ignored.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: TMRHANDLE timer - from TMRCreate
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void TMRCancel(TMRHANDLE timer)
+{
+	if(timer>=tmrcount) {
+		return;
+	}
+	if(tmrpool[timer].flags&TMR_FLAG_ARMED) {
+		TMRUnlink(timer);
+	}
+	tmrpool[timer].flags=0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// TMRIsExpired / TMRIsArmed
+///
+/// Whether a timer has expired since it was last armed, and whether it is
+/// still running. TMR_NONE is never armed and always expired, so nothing
+/// polling it waits for ever.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: TMRHANDLE timer - from TMRCreate
+/// @return: int - nonzero if so
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int TMRIsExpired(TMRHANDLE timer)
+{
+	if(timer>=tmrcount) {
+		return 1;
+	}
+	return (tmrpool[timer].flags&TMR_FLAG_EXPIRED)!=0;
+}
+
+int TMRIsArmed(TMRHANDLE timer)
+{
+	if(timer>=tmrcount) {
+		return 0;
+	}
+	return (tmrpool[timer].flags&TMR_FLAG_ARMED)!=0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// TMRTask
+///
+/// Turn the wheel up to the current time. The timers due on each slot are
+/// taken off the wheel first and their callbacks called after, so a
+/// callback is free to arm or cancel anything, this slot's timers included.
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: void * context - unused
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void TMRTask(void * context)
+{
+	unsigned long now=millis();
+
+	while(tmrnow!=now) {
+		unsigned int fired=0;
+		unsigned char idx;
+
+		tmrnow++;
+		idx=tmrwheel[tmrnow&TMR_SLOT_MASK];
+		while(idx!=TMR_NONE) {
+			TMRTIMER * t=&tmrpool[idx];
+			unsigned char next=t->next;
+
+			if(t->rounds) {
+				t->rounds--;
+			} else {
+				TMRUnlink(idx);
+				t->flags|=TMR_FLAG_EXPIRED;
+				fired|=(1<<idx);
+			}
+			idx=next;
+		}
+
+		for(idx=0;fired;idx++,fired>>=1) {
+			// an earlier callback may have re-armed or cancelled it
+			if((fired&1) && (tmrpool[idx].flags&TMR_FLAG_EXPIRED) && tmrpool[idx].callback) {
+				tmrpool[idx].callback(tmrpool[idx].context);
+			}
+		}
+	}
+}
@@ -0,0 +1,128 @@
+///////////////////////////////////////////////////////////////////////////////
+/// TIMER.H
+///
+/// Static software timer pool on a hashed timing wheel. Every timer the
+/// firmware needs is taken from a fixed pool at initialization, so nothing
+/// is ever allocated on the heap at run time.
+///
+/// The wheel has TMR_WHEEL_SLOTS slots of one millisecond. An armed timer
+/// sits on the list of the slot its expiry time hashes to, with the number
+/// of whole turns of the wheel still to go. Arming and cancelling are a
+/// list link and unlink, O(1). Each millisecond tick visits one slot and
+/// only looks at the timers on it.
+///
+/// A timer either calls its callback when it expires, or (with no
+/// callback) just sets its expired flag for its owner to poll. Callbacks
+/// run in task context, from TMRTask, and may re-arm or cancel any timer.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+//
+// Pool size (at most 16), and wheel size (a power of two). One timer is
+// 9 bytes of RAM, one slot 1 byte.
+
+#define TMR_MAX_TIMERS		8
+#define TMR_WHEEL_SLOTS		16
+
+#if TMR_MAX_TIMERS>16
+#error TMR_MAX_TIMERS can be no more than 16
+#endif
+
+#if (TMR_WHEEL_SLOTS & (TMR_WHEEL_SLOTS-1))
+#error TMR_WHEEL_SLOTS must be a power of two
+#endif
+
+//
+// A timer is named by its place in the pool
+
+typedef unsigned char TMRHANDLE;
+
+#define TMR_NONE			0xff
+
+typedef void (*TMRCALLBACK)(void * context);
+
+//
+// Exported functions
+
+///////////////////////////////////////////////////////////////////////////////
+/// TMRInitialize
+///
+/// Empty the pool and the wheel, and register the tick task. Call this
+/// before any module that creates a timer.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void TMRInitialize(void);
+
+///////////////////////////////////////////////////////////////////////////////
+/// TMRCreate
+///
+/// Take a timer from the pool. It starts disarmed. Timers are not given
+/// back: create them once, at initialization.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: TMRCALLBACK callback - called on expiry, or NULL to only flag it
+/// @param: void * context - passed to the callback
+/// @return: TMRHANDLE - the timer, or TMR_NONE if the pool is used up
+///
+///////////////////////////////////////////////////////////////////////////////
+
+TMRHANDLE TMRCreate(TMRCALLBACK callback, void * context);
+
+///////////////////////////////////////////////////////////////////////////////
+/// TMRArm
+///
+/// Start (or restart) a timer to expire 'ms' milliseconds from now. This
+/// clears its expired flag. TMR_NONE is ignored.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: TMRHANDLE timer - from TMRCreate
+/// @param: unsigned int ms - time to expiry, at least 1
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void TMRArm(TMRHANDLE timer, unsigned int ms);
+
+///////////////////////////////////////////////////////////////////////////////
+/// TMRCancel
+///
+/// Stop a timer, if armed, and clear its expired flag. TMR_NONE is
+/// ignored.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: TMRHANDLE timer - from TMRCreate
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void TMRCancel(TMRHANDLE timer);
+
+///////////////////////////////////////////////////////////////////////////////
+/// TMRIsExpired / TMRIsArmed
+///
+/// Whether a timer has expired since it was last armed, and whether it is
+/// still running. TMR_NONE is never armed and always expired.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: TMRHANDLE timer - from TMRCreate
+/// @return: int - nonzero if so
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int TMRIsExpired(TMRHANDLE timer);
+int TMRIsArmed(TMRHANDLE timer);
+
+#endif
@@ -0,0 +1,173 @@
+///////////////////////////////////////////////////////////////////////////////
+/// TOPICS.H
+///
+/// The typed messages passed between modules in task context, and who
+/// receives each. See msgbus.h. Each payload keeps the numeric ID from
+/// common.h it replaces, as ID.
+///
+/// To add a subscriber, add its handler to the topic's route here.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _TOPICS_H_
+#define _TOPICS_H_
+
+#include "common.h"
+#include "msgbus.h"
+#include "ssegdriver.h"
+
+//
+// The payloads
+
+typedef struct _MSGLED {
+
+	enum { ID=MSG_ID_CHANGE_LED };
+	unsigned char	on;				// nonzero to light the LED
+
+} MSGLED;
+
+typedef struct _MSG7SEG {
+
+	enum { ID=MSG_ID_CHANGE_7SEG };
+	unsigned char	glyph;			// 0-11, +16 for the decimal point
+
+} MSG7SEG;
+
+typedef struct _MSGKEYPRESSED {
+
+	enum { ID=MSG_ID_KEY_PRESSED };
+	unsigned char	key;			// 0-9, 0x0a for *, 0x0b for #
+
+} MSGKEYPRESSED;
+
+typedef struct _MSGKEYRELEASED {
+
+	enum { ID=MSG_ID_KEY_RELEASED };
+	unsigned char	key;
+
+} MSGKEYRELEASED;
+
+//
+// Posted from the pin change interrupt through the event ring (event.h)
+
+typedef struct _MSGKEYCHANGE {
+
+	enum { ID=MSG_ID_KEY_CHANGE };	// the expander has flagged a change of row
+
+} MSGKEYCHANGE;
+
+typedef struct _MSGACTUALRPS {
+
+	enum { ID=MSG_ID_NEW_ACTUAL_RPS };
+	unsigned int	rps;
+
+} MSGACTUALRPS;
+
+typedef struct _MSGDEMANDRPS {
+
+	enum { ID=MSG_ID_NEW_DEMAND_RPS };
+	unsigned int	rps;
+
+} MSGDEMANDRPS;
+
+typedef struct _MSGKEYPADRPS {
+
+	enum { ID=MSG_ID_NEW_RPS_KEYPAD };
+	unsigned int	rps;			// already checked against RPS_MIN/RPS_MAX
+
+} MSGKEYPADRPS;
+
+typedef struct _MSGAUTOTUNE {
+
+	enum { ID=MSG_ID_AUTOTUNE };
+	unsigned char	on;				// nonzero to start, zero to stop
+
+} MSGAUTOTUNE;
+
+typedef struct _MSGTUNESTATUS {
+
+	enum { ID=MSG_ID_TUNE_STATUS };
+	unsigned char	status;			// TUNESTATUS, tune.h
+
+} MSGTUNESTATUS;
+
+typedef struct _MSGPROGRAM {
+
+	enum { ID=MSG_ID_PROGRAM };
+	unsigned char	on;				// nonzero to run the setpoint program, zero to stop
+
+} MSGPROGRAM;
+
+typedef struct _MSGPROGRAMRPS {
+
+	enum { ID=MSG_ID_PROGRAM_RPS };
+	unsigned int	rps;			// the program's next demand, within RPS_MIN/RPS_MAX
+
+} MSGPROGRAMRPS;
+
+//
+// The subscribers
+
+void LEDControlMessageHandler(const MSGLED & msg);
+void SSEGControlMessageHandler(const MSG7SEG & msg);
+void SSEGActualRPSHandler(const MSGACTUALRPS & msg);
+void DISPUpdateRPS(const MSGACTUALRPS & msg);
+void DISPUpdateDemandRPS(const MSGDEMANDRPS & msg);
+void DISPKeyPressed(const MSGKEYPRESSED & msg);
+void KEYChangeMessageHandler(const MSGKEYCHANGE & msg);
+void CTRLNewRPS(const MSGKEYPADRPS & msg);
+void TUNEAutoTune(const MSGAUTOTUNE & msg);
+void DISPTuneStatus(const MSGTUNESTATUS & msg);
+void TRAJRunProgram(const MSGPROGRAM & msg);
+void CTRLProgramRPS(const MSGPROGRAMRPS & msg);
+
+//
+// The routes
+
+template<> struct MsgRoute<MSGLED>
+	: MsgSubscribers<MSGLED, LEDControlMessageHandler> {};
+
+template<> struct MsgRoute<MSG7SEG>
+	: MsgSubscribers<MSG7SEG, SSEGControlMessageHandler> {};
+
+template<> struct MsgRoute<MSGKEYPRESSED>
+	: MsgSubscribers<MSGKEYPRESSED, DISPKeyPressed> {};
+
+template<> struct MsgRoute<MSGKEYRELEASED>
+	: MsgSubscribers<MSGKEYRELEASED> {};
+
+template<> struct MsgRoute<MSGKEYCHANGE>
+	: MsgSubscribers<MSGKEYCHANGE, KEYChangeMessageHandler> {};
+
+//
+// The speeds are state: a subscriber only wants the newest, however many
+// were posted since it last ran (the demand changes on every encoder
+// click).
+
+#ifdef SSEG_SHOW_ACTUAL_RPS
+template<> struct MsgRoute<MSGACTUALRPS>
+	: MsgLatest<MSGACTUALRPS, DISPUpdateRPS, SSEGActualRPSHandler> {};
+#else
+template<> struct MsgRoute<MSGACTUALRPS>
+	: MsgLatest<MSGACTUALRPS, DISPUpdateRPS> {};
+#endif
+
+template<> struct MsgRoute<MSGDEMANDRPS>
+	: MsgLatest<MSGDEMANDRPS, DISPUpdateDemandRPS> {};
+
+template<> struct MsgRoute<MSGKEYPADRPS>
+	: MsgSubscribers<MSGKEYPADRPS, CTRLNewRPS> {};
+
+template<> struct MsgRoute<MSGAUTOTUNE>
+	: MsgSubscribers<MSGAUTOTUNE, TUNEAutoTune> {};
+
+template<> struct MsgRoute<MSGTUNESTATUS>
+	: MsgSubscribers<MSGTUNESTATUS, DISPTuneStatus> {};
+
+template<> struct MsgRoute<MSGPROGRAM>
+	: MsgSubscribers<MSGPROGRAM, TRAJRunProgram> {};
+
+template<> struct MsgRoute<MSGPROGRAMRPS>
+	: MsgSubscribers<MSGPROGRAMRPS, CTRLProgramRPS> {};
+
+#endif
@@ -0,0 +1,291 @@
+///////////////////////////////////////////////////////////////////////////////
+/// TRAJ.CPP
+///
+/// Setpoint trajectory generator and setpoint program. See traj.h.
+///
+/// The generator's state is only touched by the sample interrupt, bar the
+/// target, which the task writes with the interrupt held off. The program
+/// is task only: its timer's callback runs from TMRTask.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#include <Arduino.h>
+#include <kernel.h>
+#include "traj.h"
+#include "revcount.h"
+#include "timer.h"
+#include "topics.h"
+
+#define TRAJ_ONE			(1L<<TRAJ_FRAC)
+#define TRAJ_PROGRAM_MASK	(TRAJ_PROGRAM_LEN-1)
+
+//
+// One step of the rate, as a change of setpoint per sample (Q15.16), and
+// the most steps the rate may take. For the trapezoid there is just the
+// one step, of the whole acceleration.
+
+#if TRAJ_MAX_JERK
+#define TRAJ_STEP			((long)(TRAJ_MAX_JERK*REV_SAMPLE_SECONDS*REV_SAMPLE_SECONDS*TRAJ_ONE+0.5))
+#define TRAJ_RATE_STEPS		((int)(TRAJ_MAX_ACCEL/(TRAJ_MAX_JERK*REV_SAMPLE_SECONDS)+0.5))
+#define TRAJ_RATE_MAX		((TRAJ_RATE_STEPS<1)?1:TRAJ_RATE_STEPS)
+#else
+#define TRAJ_STEP			((long)(TRAJ_MAX_ACCEL*REV_SAMPLE_SECONDS*TRAJ_ONE+0.5))
+#define TRAJ_RATE_MAX		1
+#endif
+
+//
+// The built-in program, run by MSGPROGRAM
+
+typedef struct _TRAJENTRY {
+
+	unsigned int	rps;
+	unsigned int	ms;				// hold time
+
+} TRAJENTRY;
+
+static const TRAJENTRY trajdemo[]={
+
+	{ 100,		4000 },
+	{ 250,		4000 },
+	{ 50,		4000 },
+	{ RPS_MAX,	4000 },
+	{ RPS_MIN,	4000 },
+	{ 180,		4000 }
+};
+
+#define TRAJ_DEMO_STEPS		(sizeof(trajdemo)/sizeof(trajdemo[0]))
+
+//
+// Module variables. The generator's are written by the interrupt, bar
+// trajtarget.
+
+static long trajtarget=0;				// Q15.16
+static long trajsetpoint=0;				// Q15.16
+#ifdef TRAJ_ENABLE
+static int trajrate=0;					// steps of TRAJ_STEP per sample
+#endif
+
+static TRAJENTRY trajprog[TRAJ_PROGRAM_LEN];
+static unsigned char trajhead=0;		// next free entry
+static unsigned char trajtail=0;		// next entry to run
+static TMRHANDLE trajtimer=TMR_NONE;
+
+void TRAJNextStep(void * context);
+
+#ifdef TRAJ_ENABLE
+
+///////////////////////////////////////////////////////////////////////////////
+/// TRAJStopDistance
+///
+/// How far the setpoint moves from taking rate n this sample and then
+/// coming down a step at a time to a standstill
+///
+/// @scope: INTERNAL
+/// @context: INTERRUPT
+/// @param: int n - the rate, 0 to TRAJ_RATE_MAX
+/// @return: long - distance, Q15.16
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static long TRAJStopDistance(int n)
+{
+	return (long)((n*(n+1))>>1)*TRAJ_STEP;
+}
+
+#endif
+
+/////////////////////////////
+/// Exported functions
+/////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// TRAJInitialize
+///
+/// Empty the program and take its timer
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void TRAJInitialize(void)
+{
+	trajhead=trajtail=0;
+	trajtimer=TMRCreate(TRAJNextStep,(void *)NULL);
+
+	// The request to run the program arrives at TRAJRunProgram, routed in
+	// topics.h.
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// TRAJSetTarget
+///
+/// Set the demand the setpoint is to move to
+///
+/// @scope: EXPORTED
+/// @context: TASK, sample interrupt held off
+/// @param: unsigned int rps - the demand
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void TRAJSetTarget(unsigned int rps)
+{
+	trajtarget=(long)rps<<TRAJ_FRAC;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// TRAJStep
+///
+/// Move the setpoint on by one sample. The sums are done as if the target
+/// were above the setpoint, with the signs turned round if it is not. A
+/// rate already heading away from the target (the demand has reversed)
+/// is brought round a step at a time. The last part step onto the target
+/// is taken as it is, so the setpoint always lands exactly.
+///
+/// @scope: EXPORTED
+/// @context: INTERRUPT
+/// @param: NONE
+/// @return: long - the setpoint for this sample, RPS in Q15.16
+///
+///////////////////////////////////////////////////////////////////////////////
+
+long TRAJStep(void)
+{
+#ifdef TRAJ_ENABLE
+	long err=trajtarget-trajsetpoint;
+	int rate=trajrate;
+	long move;
+	unsigned char down=(err<0);
+
+	if(down) {
+		err=-err;
+		rate=-rate;
+	}
+
+	if(rate<0) {
+		rate++;
+	} else if(rate<TRAJ_RATE_MAX && TRAJStopDistance(rate+1)<=err) {
+		rate++;
+	} else if(rate && TRAJStopDistance(rate)>err) {
+		rate--;
+	}
+
+	move=(long)rate*TRAJ_STEP;
+	if(rate>=0 && (move>=err || (!rate && err<TRAJ_STEP))) {
+		move=err;						// arrived
+		rate=0;
+	}
+
+	if(down) {
+		move=-move;
+		rate=-rate;
+	}
+	trajsetpoint+=move;
+	trajrate=rate;
+#else
+	trajsetpoint=trajtarget;
+#endif
+	return trajsetpoint;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// TRAJQueueStep
+///
+/// Add an entry to the end of the program, and start it if it was idle
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: unsigned int rps - the demand, RPS_MIN to RPS_MAX
+/// @param: unsigned int ms - how long to hold it, at least 1
+/// @return: int - zero if queued, -1 if out of range, the queue is full or
+///                there was no timer for the program
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int TRAJQueueStep(unsigned int rps, unsigned int ms)
+{
+	if(rps<RPS_MIN || rps>RPS_MAX || !ms || trajtimer==TMR_NONE) {
+		return -1;
+	}
+	if((unsigned char)(trajhead-trajtail)>=TRAJ_PROGRAM_LEN) {
+		return -1;
+	}
+	trajprog[trajhead&TRAJ_PROGRAM_MASK].rps=rps;
+	trajprog[trajhead&TRAJ_PROGRAM_MASK].ms=ms;
+	trajhead++;
+
+	if(!TMRIsArmed(trajtimer)) {
+		TRAJNextStep(NULL);
+	}
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// TRAJClearProgram
+///
+/// Abandon the program
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void TRAJClearProgram(void)
+{
+	trajhead=trajtail=0;
+	TMRCancel(trajtimer);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// TRAJRunProgram
+///
+/// Message handler: run the built-in program from the start, or stop
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: const MSGPROGRAM & msg - nonzero on to run, zero to stop
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void TRAJRunProgram(const MSGPROGRAM & msg)
+{
+	TRAJClearProgram();
+	if(msg.on) {
+		for(unsigned char idx=0;idx<TRAJ_DEMO_STEPS;idx++) {
+			TRAJQueueStep(trajdemo[idx].rps,trajdemo[idx].ms);
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// TRAJNextStep
+///
+/// Timer callback: the entry running has held for its time, so make the
+/// next one the demand. The program stops when the queue runs dry.
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: void * context - unused
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void TRAJNextStep(void * context)
+{
+	TRAJENTRY * entry;
+
+	if(trajtail==trajhead) {
+		return;
+	}
+	entry=&trajprog[trajtail&TRAJ_PROGRAM_MASK];
+	trajtail++;
+
+	MsgPost(MSGPROGRAMRPS{entry->rps});
+	TMRArm(trajtimer,entry->ms);
+}
@@ -0,0 +1,133 @@
+///////////////////////////////////////////////////////////////////////////////
+/// TRAJ.H
+///
+/// Setpoint trajectory generator. A new demand no longer reaches the PI
+/// loop as a step: at every sample, in the Timer1 interrupt, the setpoint
+/// the loop works to is moved towards the demand with its rate of change
+/// (the motor's acceleration) limited to TRAJ_MAX_ACCEL and, for an
+/// S-curve, the change of that rate (the jerk) limited to TRAJ_MAX_JERK.
+/// With TRAJ_MAX_JERK 0 the profile is trapezoidal: the setpoint ramps at
+/// TRAJ_MAX_ACCEL straight to the demand.
+///
+/// The generator is integer only. The setpoint is Q15.16 RPS, and its rate
+/// is a whole number n of steps of J.T^2 per sample, so the distance it
+/// needs to stop from rate n is the triangle number n(n+1)/2 of steps. At
+/// each sample the rate goes up a step, stays, or comes down a step,
+/// whichever is fastest without being unable to stop at the demand.
+///
+/// The module also runs a small program of timed setpoints: each entry
+/// becomes the demand in turn (as MSGPROGRAMRPS, topics.h) and holds for
+/// its time before the next. MSGPROGRAM starts the built-in program, or
+/// stops whichever is running; any demand entered by hand stops it too.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _TRAJ_H_
+#define _TRAJ_H_
+
+//
+// Define to shape the setpoint. Without it, each new demand is passed
+// straight to the loop as before.
+
+#define TRAJ_ENABLE
+
+//
+// The profile: acceleration in RPS per second, and jerk in RPS per second
+// squared, or 0 for a trapezoidal profile.
+
+#define TRAJ_MAX_ACCEL		250
+#define TRAJ_MAX_JERK		1500
+
+//
+// The setpoint's format, RPS in Q15.16
+
+#define TRAJ_FRAC			16
+
+//
+// Room in the program queue, a power of two no greater than 128. An
+// entry holds for at most 65535ms.
+
+#define TRAJ_PROGRAM_LEN	8
+
+#if (TRAJ_PROGRAM_LEN & (TRAJ_PROGRAM_LEN-1)) || TRAJ_PROGRAM_LEN>128
+#error TRAJ_PROGRAM_LEN must be a power of two no greater than 128
+#endif
+
+//
+// Exported functions
+
+///////////////////////////////////////////////////////////////////////////////
+/// TRAJInitialize
+///
+/// Empty the program and take its timer. Call after TMRInitialize.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void TRAJInitialize(void);
+
+///////////////////////////////////////////////////////////////////////////////
+/// TRAJSetTarget
+///
+/// Set the demand the setpoint is to move to. Call with the sample
+/// interrupt held off, as CTRLWriteRPS does.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: unsigned int rps - the demand
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void TRAJSetTarget(unsigned int rps);
+
+///////////////////////////////////////////////////////////////////////////////
+/// TRAJStep
+///
+/// Move the setpoint on by one sample. Called by the PI loop.
+///
+/// @scope: EXPORTED
+/// @context: INTERRUPT
+/// @param: NONE
+/// @return: long - the setpoint for this sample, RPS in Q15.16
+///
+///////////////////////////////////////////////////////////////////////////////
+
+long TRAJStep(void);
+
+///////////////////////////////////////////////////////////////////////////////
+/// TRAJQueueStep
+///
+/// Add an entry to the end of the program. It runs at once if the program
+/// was idle, otherwise when the entries before it have finished.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: unsigned int rps - the demand, RPS_MIN to RPS_MAX
+/// @param: unsigned int ms - how long to hold it, at least 1
+/// @return: int - zero if queued, -1 if out of range, the queue is full or
+///                there was no timer for the program
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int TRAJQueueStep(unsigned int rps, unsigned int ms);
+
+///////////////////////////////////////////////////////////////////////////////
+/// TRAJClearProgram
+///
+/// Abandon the program. The demand stays where the program left it.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void TRAJClearProgram(void);
+
+#endif
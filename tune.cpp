@@ -0,0 +1,316 @@
+///////////////////////////////////////////////////////////////////////////////
+/// TUNE.CPP
+///
+/// Relay feedback auto-tuner. See tune.h.
+///
+/// The experiment runs in the sample interrupt, from TUNERelay, and only
+/// counts: samples per cycle and the speed swing in each. The task does
+/// the floating point once the interrupt has finished with the figures,
+/// so none of it is on the interrupt path. tunestate is the handover:
+/// the task only starts an experiment, and only reads the figures, in
+/// states the interrupt does not write them in.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#include <Arduino.h>
+#include <math.h>
+#include <kernel.h>
+#include "tune.h"
+#include "revcount.h"
+#include "sched.h"
+#include "topics.h"
+
+//
+// How often the task looks for a finished experiment, in ms
+
+#define TUNE_TASK_PERIOD	50
+
+//
+// The time limit, in PI samples
+
+#define TUNE_MAX_SAMPLES	((unsigned int)(TUNE_MAX_SECONDS/REV_SAMPLE_SECONDS))
+
+//
+// Speeds in the loop's own format, and sums of them
+
+#ifdef CTRL_FIXED_POINT
+typedef long TUNESUM;
+#define TUNE_RPS(x)			((CTRLRPS)(x)<<CTRL_RPS_FRAC)
+#define TUNE_TO_RPS(x)		((double)(x)/(1<<CTRL_RPS_FRAC))
+#else
+typedef double TUNESUM;
+#define TUNE_RPS(x)			((CTRLRPS)(x))
+#define TUNE_TO_RPS(x)		((double)(x))
+#endif
+
+typedef enum _TUNESTATE {
+
+	TUNE_STATE_IDLE,
+	TUNE_STATE_START,			// set by the task, picked up at the next sample
+	TUNE_STATE_RELAY,
+	TUNE_STATE_DONE,			// figures ready for the task
+	TUNE_STATE_FAILED
+
+} TUNESTATE;
+
+//
+// Module variables. The experiment's are only written by the interrupt.
+
+static volatile unsigned char tunestate=TUNE_STATE_IDLE;
+
+static CTRLRPS tunesetpoint;
+static CTRLRPS tunemin;					// speed swing in this cycle
+static CTRLRPS tunemax;
+static TUNESUM tuneswing;				// sum of whole cycle swings (2a)
+static unsigned int tunesamples;		// since the relay started
+static unsigned int tunelastrise;		// sample of the last switch to high
+static unsigned int tuneperiods;		// sum of whole cycle lengths, samples
+static unsigned char tunebias;
+static unsigned char tunehigh;			// relay output is high
+static unsigned char tunerises;			// switches to high so far
+
+static TUNERESULT tuneresult;
+static unsigned char tunehaveresult=0;
+
+void TUNETask(void * context);
+
+///////////////////////////////////////////////////////////////////////////////
+/// TUNEClampDuty
+///
+/// Bias plus an offset, limited to the duty range
+///
+/// @scope: INTERNAL
+/// @context: INTERRUPT
+/// @param: int duty - unlimited
+/// @return: unsigned char - 0 to 255
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static unsigned char TUNEClampDuty(int duty)
+{
+	if(duty<0) {
+		return 0;
+	}
+	if(duty>255) {
+		return 255;
+	}
+	return (unsigned char)duty;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// TUNECompute
+///
+/// Turn the figures from a finished experiment into gains, and use them
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: NONE
+/// @return: int - zero if the gains were set, -1 if the figures were no use
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static int TUNECompute(void)
+{
+	TUNERESULT r;
+	double a=TUNE_TO_RPS(tuneswing)/(2*TUNE_CYCLES);
+	double h=TUNE_HYST_RPS;
+
+	if(a<=h) {
+		return -1;						// no oscillation to speak of
+	}
+	r.ku=4*TUNE_RELAY_DUTY/(M_PI*sqrt(a*a-h*h));
+	r.pu=((double)tuneperiods/TUNE_CYCLES)*REV_SAMPLE_SECONDS;
+	r.kp=TUNE_KP_FACTOR*r.ku;
+	r.ti=TUNE_TI_FACTOR*r.pu;
+	r.a1=r.kp+r.kp*REV_SAMPLE_SECONDS/r.ti;
+	r.a0=-r.kp;
+
+	if(CTRLSetGains(r.a1,r.a0)) {
+		return -1;
+	}
+	tuneresult=r;
+	tunehaveresult=1;
+	return 0;
+}
+
+/////////////////////////////
+/// Exported functions
+/////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// TUNEInitialize
+///
+/// Add the task that turns a finished experiment into gains
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void TUNEInitialize(void)
+{
+	tunestate=TUNE_STATE_IDLE;
+	tunehaveresult=0;
+
+	// The request to start arrives at TUNEAutoTune, routed in topics.h.
+
+	SCHAddTask(TUNETask,(void *)NULL,TUNE_TASK_PERIOD,0,SCH_PRIO_LOW);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// TUNEAutoTune
+///
+/// Message handler: start an experiment, or stop one
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: const MSGAUTOTUNE & msg - nonzero on to start, zero to stop
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void TUNEAutoTune(const MSGAUTOTUNE & msg)
+{
+	unsigned char state=tunestate;
+
+	if(msg.on) {
+		if(state==TUNE_STATE_START || state==TUNE_STATE_RELAY) {
+			return;
+		}
+		tunestate=TUNE_STATE_START;
+		MsgPost(MSGTUNESTATUS{TUNE_STATUS_RUNNING});
+	} else if(state!=TUNE_STATE_IDLE) {
+		// The relay lets go at the next sample, and the PI loop carries on
+		// from the relay's last duty.
+		tunestate=TUNE_STATE_IDLE;
+		MsgPost(MSGTUNESTATUS{TUNE_STATUS_ABORTED});
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// TUNERelay
+///
+/// The experiment, one sample at a time. A cycle runs from one switch of
+/// the relay to high to the next.
+///
+/// @scope: EXPORTED
+/// @context: INTERRUPT
+/// @param: CTRLRPS demand - the demand
+/// @param: CTRLRPS actual - the measured speed
+/// @param: unsigned char * duty - the PI duty in, the relay duty out
+/// @return: int - nonzero if the duty was replaced
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int TUNERelay(CTRLRPS demand, CTRLRPS actual, unsigned char * duty)
+{
+	CTRLRPS e;
+
+	switch(tunestate) {
+
+		case TUNE_STATE_START:
+			tunesetpoint=demand;
+			tunebias=*duty;
+			tunehigh=(demand>actual);
+			tunemin=tunemax=actual;
+			tuneswing=0;
+			tunesamples=0;
+			tunelastrise=0;
+			tuneperiods=0;
+			tunerises=0;
+			tunestate=TUNE_STATE_RELAY;
+			break;
+
+		case TUNE_STATE_RELAY:
+			break;
+
+		default:
+			return 0;
+	}
+
+	if(demand!=tunesetpoint || ++tunesamples>TUNE_MAX_SAMPLES) {
+		tunestate=TUNE_STATE_FAILED;
+		return 0;
+	}
+
+	if(actual<tunemin) {
+		tunemin=actual;
+	}
+	if(actual>tunemax) {
+		tunemax=actual;
+	}
+
+	e=demand-actual;
+	if(!tunehigh && e>TUNE_RPS(TUNE_HYST_RPS)) {
+		tunehigh=1;
+		if(tunerises>TUNE_SETTLE_CYCLES) {
+			tuneperiods+=tunesamples-tunelastrise;
+			tuneswing+=tunemax-tunemin;
+		}
+		tunelastrise=tunesamples;
+		tunemin=tunemax=actual;
+		if(++tunerises>TUNE_SETTLE_CYCLES+TUNE_CYCLES) {
+			tunestate=TUNE_STATE_DONE;
+			return 0;
+		}
+	} else if(tunehigh && e<-TUNE_RPS(TUNE_HYST_RPS)) {
+		tunehigh=0;
+	}
+
+	*duty=TUNEClampDuty(tunehigh?(int)tunebias+TUNE_RELAY_DUTY:(int)tunebias-TUNE_RELAY_DUTY);
+	return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// TUNEGetResult
+///
+/// What the last successful experiment found
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: TUNERESULT * result - filled in
+/// @return: int - zero if there has been one, -1 if not
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int TUNEGetResult(TUNERESULT * result)
+{
+	if(!tunehaveresult) {
+		return -1;
+	}
+	*result=tuneresult;
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// TUNETask
+///
+/// Pick up a finished experiment, work out the gains and report
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: void * context - unused
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void TUNETask(void * context)
+{
+	switch(tunestate) {
+
+		case TUNE_STATE_DONE:
+			tunestate=TUNE_STATE_IDLE;
+			MsgPost(MSGTUNESTATUS{(unsigned char)(TUNECompute()?TUNE_STATUS_FAILED:TUNE_STATUS_DONE)});
+			break;
+
+		case TUNE_STATE_FAILED:
+			tunestate=TUNE_STATE_IDLE;
+			MsgPost(MSGTUNESTATUS{TUNE_STATUS_FAILED});
+			break;
+
+		default:
+			break;
+	}
+}
@@ -0,0 +1,128 @@
+///////////////////////////////////////////////////////////////////////////////
+/// TUNE.H
+///
+/// Relay feedback auto-tuner for the PI loop (Astrom and Hagglund). While
+/// it runs, the PI output is replaced by a relay: the duty is held at the
+/// bias plus TUNE_RELAY_DUTY while the motor is below the demand, and the
+/// bias minus TUNE_RELAY_DUTY while above, with TUNE_HYST_RPS of hysteresis.
+/// The bias is the duty the loop had when tuning started. The motor then
+/// oscillates about the demand at its ultimate period Pu, and the
+/// amplitude a of the speed gives the ultimate gain
+///
+///   Ku = 4.d / (pi.sqrt(a^2 - h^2))
+///
+/// for relay amplitude d and hysteresis h. Both are averaged over
+/// TUNE_CYCLES whole cycles, after TUNE_SETTLE_CYCLES to let the oscillation
+/// settle. The PI gains follow from the Ziegler-Nichols rules
+///
+///   Kp = TUNE_KP_FACTOR.Ku     Ti = TUNE_TI_FACTOR.Pu
+///
+/// and go to the loop through CTRLSetGains, in its difference equation
+/// form (backward Euler, sample period T):
+///
+///   out(t) = out(t-T) + (Kp + Kp.T/Ti).e(t) - Kp.e(t-T)
+///
+/// Tuning is started and stopped with MSGAUTOTUNE and reports through
+/// MSGTUNESTATUS (topics.h). It gives up, leaving the gains as they were,
+/// if the demand changes, or if no clean oscillation appears within
+/// TUNE_MAX_SECONDS.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _TUNE_H_
+#define _TUNE_H_
+
+#include "control.h"
+
+//
+// The experiment. The relay amplitude is in duty units (of 255); keep it
+// small enough that bias +/- amplitude does not hit either end.
+
+#define TUNE_RELAY_DUTY		32
+#define TUNE_HYST_RPS		1
+#define TUNE_SETTLE_CYCLES	2
+#define TUNE_CYCLES			4
+#define TUNE_MAX_SECONDS	50
+
+//
+// The tuning rule. These are the Ziegler-Nichols PI figures.
+
+#define TUNE_KP_FACTOR		0.45
+#define TUNE_TI_FACTOR		(1/1.2)
+
+//
+// Progress, as reported in MSGTUNESTATUS
+
+typedef enum _TUNESTATUS {
+
+	TUNE_STATUS_RUNNING,
+	TUNE_STATUS_DONE,			// new gains in use
+	TUNE_STATUS_FAILED,			// gains unchanged
+	TUNE_STATUS_ABORTED			// stopped by request, gains unchanged
+
+} TUNESTATUS;
+
+//
+// What the last successful experiment found
+
+typedef struct _TUNERESULT {
+
+	double		ku;				// ultimate gain, duty per RPS
+	double		pu;				// ultimate period, s
+	double		kp;
+	double		ti;				// s
+	double		a1;				// coefficients handed to CTRLSetGains
+	double		a0;
+
+} TUNERESULT;
+
+//
+// Exported functions
+
+///////////////////////////////////////////////////////////////////////////////
+/// TUNEInitialize
+///
+/// Add the task that turns a finished experiment into gains. Call after
+/// SCHInitialize.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void TUNEInitialize(void);
+
+///////////////////////////////////////////////////////////////////////////////
+/// TUNERelay
+///
+/// Called by the PI loop at every sample with the duty it has worked out.
+/// While tuning, this replaces the duty with the relay's.
+///
+/// @scope: EXPORTED
+/// @context: INTERRUPT
+/// @param: CTRLRPS demand - the demand
+/// @param: CTRLRPS actual - the measured speed
+/// @param: unsigned char * duty - the PI duty in, the relay duty out
+/// @return: int - nonzero if the duty was replaced
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int TUNERelay(CTRLRPS demand, CTRLRPS actual, unsigned char * duty);
+
+///////////////////////////////////////////////////////////////////////////////
+/// TUNEGetResult
+///
+/// What the last successful experiment found
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: TUNERESULT * result - filled in
+/// @return: int - zero if there has been one, -1 if not
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int TUNEGetResult(TUNERESULT * result);
+
+#endif
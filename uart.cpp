@@ -0,0 +1,242 @@
+///////////////////////////////////////////////////////////////////////////////
+/// UART.CPP
+///
+/// Driver for USART0. See uart.h.
+///
+/// The transmit ring is single producer, single consumer: tasks only ever
+/// add at the head, and the data register empty interrupt only takes from
+/// the tail. Each index is a single byte, written by one side only, so
+/// neither needs interrupts masked to update it. The interrupt turns
+/// itself off when the ring runs dry, and a write turns it back on.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#include <Arduino.h>
+#include "uart.h"
+#include "sched.h"
+#include "prf.h"
+
+#define UART_UBRR		((F_CPU/8+UART_BAUD/2)/UART_BAUD-1)
+#define UART_TX_MASK	(UART_TX_LEN-1)
+
+typedef struct _UARTCMD {
+
+	char			c;
+	UARTCOMMAND		handler;
+
+} UARTCMD;
+
+static volatile unsigned char uarttxbuf[UART_TX_LEN];
+static volatile unsigned char uarttxhead=0;		// next free slot, written by tasks
+static volatile unsigned char uarttxtail=0;		// next byte to send, written by the ISR
+
+static UARTCMD uartcmds[UART_MAX_COMMANDS];
+static unsigned char uartncmds=0;
+
+void UARTTask(void * context);
+
+///////////////////////////////////////////////////////////////////////////////
+/// UARTGetChar
+///
+/// Collect a received byte, if there is one. Bytes with a framing error
+/// are read (to clear them) and dropped.
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: NONE
+/// @return: int - the byte, or -1 if nothing has arrived
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static int UARTGetChar(void)
+{
+	unsigned char status=UCSR0A;
+	unsigned char c;
+
+	if(!(status&(1<<RXC0))) {
+		return -1;
+	}
+	c=UDR0;
+	if(status&(1<<FE0)) {
+		return -1;
+	}
+	return c;
+}
+
+/////////////////////////////
+/// Exported functions
+/////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// UARTInitialize
+///
+/// Set the line rate and format, enable the transmitter and receiver, and
+/// add the command task. The data register empty interrupt is enabled
+/// only while there is something to send; the receive interrupt is not
+/// used.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void UARTInitialize(void)
+{
+	uarttxhead=uarttxtail=0;
+	uartncmds=0;
+
+	UBRR0H=(unsigned char)(UART_UBRR>>8);
+	UBRR0L=(unsigned char)UART_UBRR;
+	UCSR0A=(1<<U2X0);
+	UCSR0C=(1<<UCSZ01)|(1<<UCSZ00);			// 8N1
+	UCSR0B=(1<<RXEN0)|(1<<TXEN0);
+
+	SCHAddTask(UARTTask,(void *)NULL,0,0,SCH_PRIO_LOW);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// UARTAddCommand
+///
+/// Add a command character to the table
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: char c - command character
+/// @param: UARTCOMMAND handler - called with no arguments
+/// @return: int - zero if added, -1 if the table is full
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int UARTAddCommand(char c, UARTCOMMAND handler)
+{
+	if(uartncmds>=UART_MAX_COMMANDS) {
+		return -1;
+	}
+	uartcmds[uartncmds].c=c;
+	uartcmds[uartncmds].handler=handler;
+	uartncmds++;
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// UARTPutChar
+///
+/// Queue a byte to send, if there is room
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: char c - byte to send
+/// @return: int - zero if queued, -1 if the ring is full
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int UARTPutChar(char c)
+{
+	return UARTWrite((const unsigned char *)&c,1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// UARTWrite
+///
+/// Queue a block of bytes to send, all or nothing. The head is only moved
+/// once they are all in the ring, so the interrupt never sees part of one.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: const unsigned char * buf - bytes to send
+/// @param: unsigned char len - how many, no more than UART_TX_LEN
+/// @return: int - zero if queued, -1 if there is not room for all of them
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int UARTWrite(const unsigned char * buf, unsigned char len)
+{
+	unsigned char head=uarttxhead;
+
+	if(len>UARTGetTxFree()) {
+		return -1;
+	}
+	while(len--) {
+		uarttxbuf[head&UART_TX_MASK]=*buf++;
+		head++;
+	}
+	uarttxhead=head;		// publish
+
+	// The interrupt may be clearing UDRIE0 as we set it; either way it
+	// ends up set with the bytes queued, which is what we want.
+
+	UCSR0B|=(1<<UDRIE0);
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// UARTGetTxFree
+///
+/// Room left in the transmit ring
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: NONE
+/// @return: unsigned char - bytes
+///
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned char UARTGetTxFree(void)
+{
+	return UART_TX_LEN-(unsigned char)(uarttxhead-uarttxtail);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// UARTTask
+///
+/// Act on a received command character, if there is one
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: void * context - unused
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void UARTTask(void * context)
+{
+	int c=UARTGetChar();
+
+	if(c<0) {
+		return;
+	}
+	for(unsigned char idx=0;idx<uartncmds;idx++) {
+		if(uartcmds[idx].c==(char)c) {
+			uartcmds[idx].handler();
+			break;
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// ISR - USART0 data register empty
+///
+/// Send the next byte from the ring. The interrupt is turned off with the
+/// last one, so it does not keep firing on an empty ring.
+///
+/// @context: INTERRUPT
+/// @scope: INTERNAL
+///
+///////////////////////////////////////////////////////////////////////////////
+
+ISR(USART_UDRE_vect)
+{
+	PRF_SCOPE(PRF_ISR_UART);
+
+	unsigned char tail=uarttxtail;
+
+	if(tail!=uarttxhead) {
+		UDR0=uarttxbuf[tail&UART_TX_MASK];
+		uarttxtail=++tail;
+	}
+	if(tail==uarttxhead) {
+		UCSR0B&=~(1<<UDRIE0);
+	}
+}
@@ -0,0 +1,121 @@
+///////////////////////////////////////////////////////////////////////////////
+/// UART.H
+///
+/// Driver for USART0 (the USB serial port on the board). Nothing here
+/// waits. Bytes to send go into a ring that the data register empty
+/// interrupt feeds to the line, so a task hands over what fits and carries
+/// on; if the ring is full the write is refused and can be tried again on
+/// a later pass.
+///
+/// Received bytes are single character commands. A module that wants one
+/// registers a handler for it, and the UART task calls it when the
+/// character arrives.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _UART_H_
+#define _UART_H_
+
+//
+// Line rate. 8 data bits, no parity, one stop bit. The divider is worked
+// out for double speed mode, which puts 115200 within 2.1% at 16MHz.
+
+#define UART_BAUD		115200UL
+
+//
+// Transmit ring size: a power of two no greater than 128, so the free
+// running 8 bit indices wrap cleanly. It must hold the longest single
+// UARTWrite.
+
+#define UART_TX_LEN		64
+
+#if (UART_TX_LEN & (UART_TX_LEN-1)) || UART_TX_LEN>128
+#error UART_TX_LEN must be a power of two no greater than 128
+#endif
+
+//
+// Command characters that can be registered
+
+#define UART_MAX_COMMANDS	8
+
+typedef void (*UARTCOMMAND)(void);
+
+//
+// Exported functions
+
+///////////////////////////////////////////////////////////////////////////////
+/// UARTInitialize
+///
+/// Set the line rate and format, enable the transmitter and receiver, and
+/// add the task that reads commands. Call after SCHInitialize.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void UARTInitialize(void);
+
+///////////////////////////////////////////////////////////////////////////////
+/// UARTAddCommand
+///
+/// Have a handler called, from the UART task, whenever the given character
+/// is received
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: char c - command character
+/// @param: UARTCOMMAND handler - called with no arguments
+/// @return: int - zero if added, -1 if the table is full
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int UARTAddCommand(char c, UARTCOMMAND handler);
+
+///////////////////////////////////////////////////////////////////////////////
+/// UARTPutChar
+///
+/// Queue a byte to send, if there is room
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: char c - byte to send
+/// @return: int - zero if queued, -1 if the ring is full
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int UARTPutChar(char c);
+
+///////////////////////////////////////////////////////////////////////////////
+/// UARTWrite
+///
+/// Queue a block of bytes to send, all or nothing, so that nothing anyone
+/// else sends can land in the middle of it
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: const unsigned char * buf - bytes to send
+/// @param: unsigned char len - how many, no more than UART_TX_LEN
+/// @return: int - zero if queued, -1 if there is not room for all of them
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int UARTWrite(const unsigned char * buf, unsigned char len);
+
+///////////////////////////////////////////////////////////////////////////////
+/// UARTGetTxFree
+///
+/// Room left in the transmit ring
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: NONE
+/// @return: unsigned char - bytes
+///
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned char UARTGetTxFree(void);
+
+#endif